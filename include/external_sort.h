@@ -3,11 +3,29 @@
 
 #include <stdint.h>
 #include "file/ion_file.h"
+#include "file/ion_file_cache.h"
 
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
+/* Sort key field types */
+#define    SORT_KEY_INT         0       /* Signed integer of width 1, 2, 4 or 8 */
+#define    SORT_KEY_UINT        1       /* Unsigned integer of width 1, 2, 4 or 8 */
+#define    SORT_KEY_FLOAT       2       /* float (width 4) or double (width 8) */
+#define    SORT_KEY_BYTES       3       /* Bytes compared unsigned (memcmp) */
+
+/* Sort key field directions */
+#define    SORT_KEY_ASC         0
+#define    SORT_KEY_DESC        1
+
+typedef struct {
+    uint16_t    offset;         /* Offset of field in record */
+    uint16_t    width;          /* Field size in bytes */
+    uint8_t     type;           /* SORT_KEY_INT, SORT_KEY_UINT, SORT_KEY_FLOAT or SORT_KEY_BYTES */
+    uint8_t     direction;      /* SORT_KEY_ASC or SORT_KEY_DESC */
+} sort_key_field_t;
+
 typedef struct {
     uint16_t	key_size;
     uint16_t	value_size;
@@ -17,6 +35,9 @@ typedef struct {
     uint16_t    num_values_last_page;
     int8_t      headerSize;
     int8_t      (*compare_fcn)(void *a, void *b);
+    ion_file_cache_t *cache;    /* Optional page cache over sort file (NULL if not used) */
+    sort_key_field_t *key_fields;   /* Optional key descriptor used by extern_sort_key_comparator() */
+    uint8_t     num_key_fields;
 } external_sort_t;
 
 typedef struct {
@@ -25,6 +46,11 @@ typedef struct {
     uint32_t num_memcpys;
     uint32_t num_compar;
     uint32_t num_runs;
+    uint32_t num_cache_hits;
+    uint32_t num_cache_misses;
+    uint32_t num_seeks;         /* Page reads and writes not at the current file position */
+    uint32_t num_filtered;      /* Input records removed by a filter predicate before sorting */
+    uint32_t bytes_saved;       /* Input bytes not stored in runs (filtered records and projected fields) */
     double time;
 } metrics_t;
 
@@ -40,11 +66,44 @@ typedef struct {
 	uint32_t recordSize;
 } file_iterator_state_t;
 
+typedef struct {
+	int (*iterator)(void *state, void* buffer);     /* Record-at-a-time iterator */
+	void *iteratorState;
+	uint16_t recordSize;
+} record_batch_iterator_state_t;
+
+typedef struct {
+	int (*iterator)(void *state, void* buffer);     /* Record-at-a-time iterator of input records */
+	void *iteratorState;
+	int8_t (*predicate)(void *state, void *record);             /* Returns 1 to sort record, 0 to remove it (NULL keeps all) */
+	void (*projection)(void *state, void *record, void *dst);   /* Copies fields of record kept for sorting to dst (NULL keeps all) */
+	void *callbackState;
+	void *inputRecord;              /* Space for one input record when there is a projection */
+	uint16_t inputRecordSize;
+	uint16_t recordSize;            /* Size of records sorted (es->record_size) */
+	uint32_t recordsOut;            /* Records returned for sorting */
+	metrics_t *metric;
+} filter_iterator_state_t;
+
+typedef struct {
+	char *page;                     /* Block being filled in the buffer before it is written to the file */
+	int16_t count;                  /* Number of entries in block */
+	int16_t capacity;               /* Entries that fit in block */
+	uint16_t entrySize;             /* Bytes per entry */
+	int32_t numblocks;              /* Blocks written to current run */
+	long writePos;                  /* Offset in file to write next block */
+} sort_page_writer_t;
+
 /* Constant declarations */
 #define    BLOCK_HEADER_SIZE    sizeof(int32_t)+sizeof(int16_t)
 #define    BLOCK_ID_OFFSET      0
 #define    BLOCK_COUNT_OFFSET   sizeof(uint32_t)
 
+/* Block header for runs stored as chains of blocks (block recycling) */
+#define    BLOCK_NEXT_OFFSET          (sizeof(int32_t)+sizeof(int16_t))
+#define    BLOCK_CHAIN_HEADER_SIZE    sizeof(int32_t)+sizeof(int16_t)+sizeof(int32_t)
+#define    BLOCK_CHAIN_END            -1
+
 
 #if defined(__cplusplus)
 }
@@ -0,0 +1,660 @@
+/******************************************************************************/
+/**
+@file		external_distribution_sort.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		External distribution (sample and bucket) sort with buckets stored
+			as block chains in a temporary file.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_distribution_sort.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/* Buckets are chains of blocks in the temporary file. Each block stores the number of the block of its bucket written before it. */
+#define    DIST_PREV_BLOCK_OFFSET     BLOCK_ID_OFFSET
+
+/**
+@brief		Bucket of records stored in the temporary file.
+*/
+typedef struct {
+	int32_t 	lastBlock;			/* Last block written or BLOCK_CHAIN_END */
+	uint32_t 	count;				/* Records in bucket */
+	int16_t 	pageCount;			/* Records in bucket's buffer block */
+	uint8_t 	numSamples;			/* Records in sample of bucket */
+	int8_t 		equal;				/* All records equal a repeated splitter */
+} dist_bucket_t;
+
+/**
+@brief		Buckets of one distribution step.
+*/
+typedef struct {
+	dist_bucket_t *buckets;
+	char 		*samples;			/* Records sampled from each bucket */
+	char 		*splitters;
+	int8_t 		*equalBucket;		/* Bucket of records equal to each splitter if the splitter is repeated, otherwise -1 */
+	int16_t 	numSplitters;
+	int16_t 	numBuckets;
+} dist_level_t;
+
+/**
+@brief		Sorting state shared by all distribution steps.
+*/
+typedef struct {
+	ION_FILE 	*file;
+	ION_FILE 	*tempFile;
+	external_sort_t *es;
+	external_sort_t tempEs;			/* Block layout of temporary file (not cached) */
+	metrics_t 	*metric;
+	int8_t 		(*compareFn)(void *a, void *b);
+	char 		*buffer;
+	char 		*staging;			/* Last block of buffer used to read and write blocks */
+	int 		bufferSizeInBlocks;
+	uint32_t 	memCapacity;		/* Records that fit in all blocks except the staging block */
+	int16_t 	tempPerPage;
+	int16_t 	outPerPage;
+	uint8_t 	maxSamples;			/* Records sampled from each bucket (one less than the buckets of later steps) */
+	int32_t 	nextTempBlock;
+	uint32_t 	pending;			/* Records of partial output block at start of buffer */
+	int8_t 		pendingSaved;		/* Partial output block is in the file instead of the buffer */
+	int32_t 	outputBlocks;
+} dist_sort_t;
+
+/**
+@brief     	Writes a bucket's buffer block to the end of the temporary file.
+*/
+static int dist_write_bucket(dist_sort_t *ctx, dist_bucket_t *bucket, char *page)
+{
+	*((int32_t*) (page+DIST_PREV_BLOCK_OFFSET)) = bucket->lastBlock;
+	*((int16_t*) (page+BLOCK_COUNT_OFFSET)) = bucket->pageCount;
+	if (0 != extern_sort_write_page(ctx->tempFile, (long) ctx->nextTempBlock * ctx->es->page_size, page, &ctx->tempEs, ctx->metric))
+		return 9;
+	bucket->lastBlock = ctx->nextTempBlock++;
+	bucket->pageCount = 0;
+	return 0;
+}
+
+/**
+@brief     	Adds a record to the sample of a bucket (reservoir sampling).
+*/
+static void dist_sample(dist_sort_t *ctx, dist_level_t *level, int16_t b, char *record)
+{
+	dist_bucket_t 	*bucket = &level->buckets[b];
+	uint16_t 		size = ctx->es->record_size;
+	uint32_t 		slot;
+
+	if (bucket->numSamples < ctx->maxSamples)
+		slot = bucket->numSamples++;
+	else if ((slot = (uint32_t) rand() % bucket->count) >= ctx->maxSamples)
+		return;
+	memcpy(level->samples + (b * ctx->maxSamples + slot) * size, record, size);
+}
+
+/**
+@brief     	Returns the bucket of a record.
+*/
+static int16_t dist_find_bucket(dist_sort_t *ctx, dist_level_t *level, char *record)
+{
+	uint16_t 	size = ctx->es->record_size;
+	int16_t 	first = 0, last = level->numSplitters, mid;
+
+	/* Find first splitter greater than record */
+	while (first < last)
+	{
+		mid = (first + last) / 2;
+		ctx->metric->num_compar++;
+		if (ctx->compareFn(level->splitters + mid * size, record) <= 0)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	/* Records equal to a repeated splitter go to the bucket after its first occurrence */
+	if (first > 0 && level->equalBucket[first-1] >= 0)
+	{
+		ctx->metric->num_compar++;
+		if (0 == ctx->compareFn(level->splitters + (first-1) * size, record))
+			return level->equalBucket[first-1];
+	}
+	return first;
+}
+
+/**
+@brief     	Returns the number of buckets for a distribution step. Fewer buckets are
+			used when they will still fit in memory with room for uneven splits, as
+			each bucket adds a partially filled block.
+*/
+static int16_t dist_num_buckets(dist_sort_t *ctx, uint32_t numRecords, int16_t maxBuckets)
+{
+	uint32_t 	bucketRecords = (ctx->memCapacity - ctx->outPerPage) / 2;
+	uint32_t 	numBuckets = (numRecords + bucketRecords - 1) / bucketRecords;
+
+	if (numRecords == 0 || numBuckets >= (uint32_t) maxBuckets)
+		return maxBuckets;
+	return numBuckets < 2 ? 2 : (int16_t) numBuckets;
+}
+
+/**
+@brief     	Creates the buckets of a distribution step for sorted splitters.
+*/
+static int dist_level_init(dist_sort_t *ctx, dist_level_t *level, char *splitters, int16_t numSplitters)
+{
+	uint16_t 	size = ctx->es->record_size;
+	int16_t 	i, j;
+
+	level->splitters = splitters;
+	level->numSplitters = numSplitters;
+	level->numBuckets = numSplitters + 1;
+	level->buckets = (dist_bucket_t*) malloc(sizeof(dist_bucket_t) * level->numBuckets);
+	level->samples = (char*) malloc((size_t) level->numBuckets * ctx->maxSamples * size);
+	level->equalBucket = (int8_t*) malloc(sizeof(int8_t) * (numSplitters + 1));
+	if (NULL == level->buckets || NULL == level->samples || NULL == level->equalBucket)
+		return 8;
+
+	for (i=0; i < level->numBuckets; i++)
+	{
+		level->buckets[i].lastBlock = BLOCK_CHAIN_END;
+		level->buckets[i].count = 0;
+		level->buckets[i].pageCount = 0;
+		level->buckets[i].numSamples = 0;
+		level->buckets[i].equal = 0;
+	}
+
+	/* Bucket between two equal splitters would be empty so it holds records equal to them */
+	for (i=0; i < numSplitters; i = j)
+	{
+		for (j=i+1; j < numSplitters && 0 == ctx->compareFn(splitters + i * size, splitters + j * size); j++);
+		int8_t equal = (j - i > 1) ? (int8_t) (i + 1) : -1;
+		if (equal >= 0)
+			level->buckets[equal].equal = 1;
+		for ( ; i < j; i++)
+			level->equalBucket[i] = equal;
+	}
+	return 0;
+}
+
+/**
+@brief     	Frees the buckets of a distribution step.
+*/
+static void dist_level_free(dist_level_t *level)
+{
+	free(level->equalBucket);
+	free(level->samples);
+	free(level->buckets);
+}
+
+/**
+@brief     	Adds a record to its bucket's buffer block, writing the block when full.
+*/
+static int dist_add(dist_sort_t *ctx, dist_level_t *level, char *record)
+{
+	int16_t 		b = dist_find_bucket(ctx, level, record);
+	dist_bucket_t 	*bucket = &level->buckets[b];
+	char 			*page = ctx->buffer + b * ctx->es->page_size;
+
+	memcpy(page + BLOCK_HEADER_SIZE + bucket->pageCount * ctx->es->record_size, record, ctx->es->record_size);
+	ctx->metric->num_memcpys++;
+	bucket->count++;
+	dist_sample(ctx, level, b, record);
+	if (++bucket->pageCount < ctx->tempPerPage)
+		return 0;
+	return dist_write_bucket(ctx, bucket, page);
+}
+
+/**
+@brief     	Writes partially filled bucket blocks.
+*/
+static int dist_level_finish(dist_sort_t *ctx, dist_level_t *level)
+{
+	int16_t i;
+
+	for (i=0; i < level->numBuckets; i++)
+	{
+		if (level->buckets[i].pageCount > 0 && 0 != dist_write_bucket(ctx, &level->buckets[i], ctx->buffer + i * ctx->es->page_size))
+			return 9;
+	}
+	return 0;
+}
+
+/**
+@brief     	Writes the first n sorted records in the buffer as output blocks. Records
+			that do not fill a block are moved to the start of the buffer unless final.
+*/
+static int dist_emit(dist_sort_t *ctx, uint32_t n, int8_t final)
+{
+	external_sort_t *es = ctx->es;
+	uint32_t 		pos = 0;
+	int16_t 		count;
+
+	while (n - pos >= (uint32_t) ctx->outPerPage || (final && pos < n))
+	{
+		count = (n - pos) < (uint32_t) ctx->outPerPage ? (int16_t) (n - pos) : ctx->outPerPage;
+		memcpy(ctx->staging + es->headerSize, ctx->buffer + pos * es->record_size, count * es->record_size);
+		*((int32_t*) ctx->staging) = ctx->outputBlocks;									/* Block index */
+		*((int16_t*) (ctx->staging+BLOCK_COUNT_OFFSET)) = count;						/* Block record count */
+		if (0 != extern_sort_write_page(ctx->file, (long) ctx->outputBlocks * es->page_size, ctx->staging, es, ctx->metric))
+			return 9;
+		ctx->outputBlocks++;
+		pos += count;
+	}
+	memmove(ctx->buffer, ctx->buffer + pos * es->record_size, (n - pos) * es->record_size);
+	ctx->pending = n - pos;
+	return 0;
+}
+
+/**
+@brief     	Writes the partial output block to the file so the buffer can be used to distribute a bucket.
+*/
+static int dist_save_pending(dist_sort_t *ctx)
+{
+	if (ctx->pending == 0 || ctx->pendingSaved)
+		return 0;
+	memcpy(ctx->staging + ctx->es->headerSize, ctx->buffer, ctx->pending * ctx->es->record_size);
+	*((int32_t*) ctx->staging) = ctx->outputBlocks;
+	*((int16_t*) (ctx->staging+BLOCK_COUNT_OFFSET)) = (int16_t) ctx->pending;
+	if (0 != extern_sort_write_page(ctx->file, (long) ctx->outputBlocks * ctx->es->page_size, ctx->staging, ctx->es, ctx->metric))
+		return 9;
+	ctx->pendingSaved = 1;
+	return 0;
+}
+
+/**
+@brief     	Reads the partial output block back to the start of the buffer.
+*/
+static int dist_restore_pending(dist_sort_t *ctx)
+{
+	if (!ctx->pendingSaved)
+		return 0;
+	if (0 != extern_sort_read_page(ctx->file, (long) ctx->outputBlocks * ctx->es->page_size, ctx->staging, ctx->es, ctx->metric))
+		return 10;
+	memcpy(ctx->buffer, ctx->staging + ctx->es->headerSize, ctx->pending * ctx->es->record_size);
+	ctx->pendingSaved = 0;
+	return 0;
+}
+
+/**
+@brief     	Reads a bucket block into the staging block and returns the number of the previous block of the bucket.
+*/
+static int dist_read_block(dist_sort_t *ctx, int32_t block, int32_t *prevBlock, int16_t *count)
+{
+	if (0 != extern_sort_read_page(ctx->tempFile, (long) block * ctx->es->page_size, ctx->staging, &ctx->tempEs, ctx->metric))
+		return 10;
+	*prevBlock = *((int32_t*) (ctx->staging+DIST_PREV_BLOCK_OFFSET));
+	*count = *((int16_t*) (ctx->staging+BLOCK_COUNT_OFFSET));
+	return 0;
+}
+
+static int dist_process_level(dist_sort_t *ctx, dist_level_t *level);
+
+/**
+@brief     	Writes a bucket to the output in sorted order.
+*/
+static int dist_process_bucket(dist_sort_t *ctx, dist_level_t *level, int16_t b)
+{
+	dist_bucket_t 	*bucket = &level->buckets[b];
+	uint16_t 		size = ctx->es->record_size;
+	int32_t 		block, prev;
+	int16_t 		count;
+	int 			err;
+
+	if (bucket->count == 0)
+		return 0;
+
+	if (ctx->pending + bucket->count <= ctx->memCapacity || bucket->equal)
+	{
+		/* Bucket is read after the partial output block. Records that are all equal are written as the buffer fills. */
+		if (0 != dist_restore_pending(ctx))
+			return 10;
+		uint32_t n = ctx->pending;
+		for (block = bucket->lastBlock; block != BLOCK_CHAIN_END; block = prev)
+		{
+			if (bucket->equal && n + ctx->tempPerPage > ctx->memCapacity)
+			{
+				err = dist_emit(ctx, n, 0);
+				if (err)
+					return err;
+				n = ctx->pending;
+			}
+			if (0 != dist_read_block(ctx, block, &prev, &count))
+				return 10;
+			memcpy(ctx->buffer + n * size, ctx->staging + BLOCK_HEADER_SIZE, count * size);
+			n += count;
+		}
+		if (!bucket->equal && bucket->count > 1)
+			in_memory_sort(ctx->buffer + ctx->pending * size, bucket->count, size, ctx->compareFn, 1);
+		return dist_emit(ctx, n, 0);
+	}
+
+	/* Distribute bucket again using its sample as splitters */
+	#if defined(DEBUG)
+		printf("Distributing bucket of %lu records\n", (unsigned long) bucket->count);
+	#endif
+	dist_level_t 	child;
+	char 			*splitters = level->samples + b * ctx->maxSamples * size;
+
+	if (0 != dist_save_pending(ctx))
+		return 9;
+	in_memory_sort(splitters, bucket->numSamples, size, ctx->compareFn, 1);
+
+	/* Use evenly spaced samples if fewer buckets are needed */
+	int16_t numSplitters = dist_num_buckets(ctx, bucket->count, bucket->numSamples + 1) - 1;
+	int16_t i;
+	for (i=0; i < numSplitters; i++)
+		memmove(splitters + i * size, splitters + ((i + 1) * bucket->numSamples / (numSplitters + 1)) * size, size);
+	err = dist_level_init(ctx, &child, splitters, numSplitters);
+	for (block = bucket->lastBlock; err == 0 && block != BLOCK_CHAIN_END; block = prev)
+	{
+		err = dist_read_block(ctx, block, &prev, &count);
+		for (i=0; err == 0 && i < count; i++)
+			err = dist_add(ctx, &child, ctx->staging + BLOCK_HEADER_SIZE + i * size);
+	}
+	if (err == 0)
+		err = dist_level_finish(ctx, &child);
+	if (err == 0)
+		err = dist_process_level(ctx, &child);
+	dist_level_free(&child);
+	return err;
+}
+
+/**
+@brief     	Writes all buckets of a distribution step to the output in order.
+*/
+static int dist_process_level(dist_sort_t *ctx, dist_level_t *level)
+{
+	int16_t i;
+	int 	err;
+
+	for (i=0; i < level->numBuckets; i++)
+	{
+		err = dist_process_bucket(ctx, level, i);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/**
+@brief     	External distribution sort with input iterator. Splitters are picked
+			from the first buffer of input and the records are scattered into
+			buckets stored in tempFile with one block of buffer for each bucket.
+			Buckets that fit in memory are sorted in memory and written to the
+			output in order. Larger buckets are distributed again using splitters
+			sampled from the bucket. Buckets of records that all equal a repeated
+			splitter are written without sorting.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Buffer of es->record_size bytes used to read input records
+@param      file
+                Already opened file to store sorting output
+@param      tempFile
+                Already opened file to store buckets
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 4)
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error.
+*/
+int extern_distribution_sort_iterator_block(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	ION_FILE *tempFile,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	printf("External distribution sort iterator version.\n");
+
+	dist_sort_t 	ctx;
+	dist_level_t 	level;
+	uint16_t 		size = es->record_size;
+	uint32_t 		n = 0, numRecords, i;
+	int16_t 		numBuckets, current = -1, b;
+	char 			*splitters = NULL;
+	int8_t 			more;
+	int 			err = 0;
+
+	if (bufferSizeInBlocks < 4)
+		return 8;
+
+	ctx.file = file;
+	ctx.tempFile = tempFile;
+	ctx.es = es;
+	ctx.tempEs = *es;
+	ctx.tempEs.cache = NULL;
+	ctx.metric = metric;
+	ctx.compareFn = compareFn;
+	ctx.buffer = buffer;
+	ctx.staging = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+	ctx.bufferSizeInBlocks = bufferSizeInBlocks;
+	ctx.memCapacity = (uint32_t) (bufferSizeInBlocks - 1) * es->page_size / size;
+	ctx.tempPerPage = (es->page_size - BLOCK_HEADER_SIZE) / size;
+	ctx.outPerPage = (es->page_size - es->headerSize) / size;
+	ctx.maxSamples = (bufferSizeInBlocks - 2) < DIST_MAX_SAMPLES ? (uint8_t) (bufferSizeInBlocks - 2) : DIST_MAX_SAMPLES;
+	ctx.nextTempBlock = 0;
+	ctx.pending = 0;
+	ctx.pendingSaved = 0;
+	ctx.outputBlocks = 0;
+	*resultFilePtr = 0;
+	level.buckets = NULL;
+	level.samples = NULL;
+	level.equalBucket = NULL;
+
+	/* Read first buffer of input */
+	while (n < ctx.memCapacity && iterator(iteratorState, buffer + n * size))
+		n++;
+	more = (n == ctx.memCapacity) && iterator(iteratorState, tupleBuffer);
+	numRecords = n + more;
+	if (n > 1)
+		in_memory_sort(buffer, n, size, compareFn, 1);
+
+	if (!more)
+	{
+		/* Input fits in memory */
+		err = dist_emit(&ctx, n, 1);
+		goto done;
+	}
+
+	/* Splitters divide the first buffer into equal parts. The first step may use every block as a bucket buffer. */
+	numBuckets = dist_num_buckets(&ctx, es->num_pages * ctx.outPerPage, bufferSizeInBlocks);
+	splitters = (char*) malloc((size_t) (numBuckets - 1) * size);
+	if (NULL == splitters)
+	{
+		err = 8;
+		goto cleanup;
+	}
+	for (i=0; i < (uint32_t) numBuckets - 1; i++)
+		memcpy(splitters + i * size, buffer + ((i + 1) * n / numBuckets) * size, size);
+	err = dist_level_init(&ctx, &level, splitters, numBuckets - 1);
+	if (err)
+		goto cleanup;
+
+	/* Records of first buffer are sorted so each bucket's records are packed together into the staging block */
+	for (i=0; i < n; i++)
+	{
+		char *record = buffer + i * size;
+		b = dist_find_bucket(&ctx, &level, record);
+		if (b != current && current >= 0 && level.buckets[current].pageCount > 0)
+		{
+			err = dist_write_bucket(&ctx, &level.buckets[current], ctx.staging);
+			if (err)
+				goto cleanup;
+		}
+		current = b;
+		memcpy(ctx.staging + BLOCK_HEADER_SIZE + level.buckets[b].pageCount * size, record, size);
+		level.buckets[b].count++;
+		dist_sample(&ctx, &level, b, record);
+		if (++level.buckets[b].pageCount == ctx.tempPerPage)
+		{
+			err = dist_write_bucket(&ctx, &level.buckets[b], ctx.staging);
+			if (err)
+				goto cleanup;
+		}
+	}
+	if (current >= 0 && level.buckets[current].pageCount > 0)
+	{
+		err = dist_write_bucket(&ctx, &level.buckets[current], ctx.staging);
+		if (err)
+			goto cleanup;
+	}
+
+	/* Scatter rest of input */
+	while (more)
+	{
+		err = dist_add(&ctx, &level, tupleBuffer);
+		if (err)
+			goto cleanup;
+		more = iterator(iteratorState, tupleBuffer);
+		numRecords += more;
+	}
+
+	err = dist_level_finish(&ctx, &level);
+	if (err)
+		goto cleanup;
+	err = dist_process_level(&ctx, &level);
+	if (err)
+		goto cleanup;
+
+	/* Write last partial output block (it may already be in the file) */
+	if (ctx.pendingSaved)
+		ctx.outputBlocks++;
+	else
+		err = dist_emit(&ctx, ctx.pending, 1);
+
+done:
+	metric->num_reads += (numRecords + ctx.outPerPage - 1) / ctx.outPerPage;
+	es->num_pages = ctx.outputBlocks;
+	if (err == 0)
+		err = extern_sort_flush_pages(es, metric);
+
+	#if defined(DEBUG)
+		printf("Output blocks: %d  Temporary blocks: %d\n", ctx.outputBlocks, ctx.nextTempBlock);
+	#endif
+
+cleanup:
+	dist_level_free(&level);
+	free(splitters);
+	return err;
+}
+
+/**
+@brief     	Chooses between external merge sort and distribution sort for
+			es->num_pages blocks of input. The method with fewer expected block
+			writes is chosen. Distribution sort writes a partially filled block for
+			each bucket. On equal writes the method with fewer comparisons per
+			record is chosen: merge sort compares with every run being merged for
+			each record while distribution sort binary searches the splitters.
+			Distribution sort assumes keys are not skewed.
+@param      es
+                Sorting state info (block size, record size, number of input pages)
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      mergeWrites
+                Set to expected block writes of merge sort (may be NULL)
+@param      distributionWrites
+                Set to expected block writes of distribution sort (may be NULL)
+@return		EXTERNAL_SORT_METHOD_MERGE or EXTERNAL_SORT_METHOD_DISTRIBUTION
+*/
+int8_t extern_sort_choose_method(
+	external_sort_t *es,
+	int 	bufferSizeInBlocks,
+	int32_t *mergeWrites,
+	int32_t *distributionWrites)
+{
+	int32_t 	pages = es->num_pages;
+	int32_t 	runs = (pages + bufferSizeInBlocks - 1) / bufferSizeInBlocks;
+	int32_t 	bucketPages = pages, numBuckets = 1;
+	int32_t 	fanOut = bufferSizeInBlocks;
+	int32_t 	bucketCapacity = (bufferSizeInBlocks - 1) / 2;
+	int32_t 	mergeBlocks = pages, distributionBlocks = pages;
+	int32_t 	mergeCompares = 0, distributionCompares = 0, bits;
+
+	/* Merge sort writes runs then all records each merge pass */
+	while (runs > 1)
+	{
+		runs = (runs + bufferSizeInBlocks - 2) / (bufferSizeInBlocks - 1);
+		mergeBlocks += pages;
+		mergeCompares += bufferSizeInBlocks - 2;
+	}
+	if (NULL != mergeWrites)
+		*mergeWrites = mergeBlocks;
+
+	if (bufferSizeInBlocks < 4)
+	{
+		if (NULL != distributionWrites)
+			*distributionWrites = INT32_MAX;
+		return EXTERNAL_SORT_METHOD_MERGE;
+	}
+
+	/* Distribution sort writes all records and a partial block per bucket each step until buckets fit in memory */
+	while (bucketPages > bufferSizeInBlocks - 1)
+	{
+		if ((bucketPages + bucketCapacity - 1) / bucketCapacity < fanOut)
+			fanOut = (bucketPages + bucketCapacity - 1) / bucketCapacity;
+		if (fanOut < 2)
+			fanOut = 2;
+		bucketPages = (bucketPages + fanOut - 1) / fanOut;
+		numBuckets *= fanOut;
+		distributionBlocks += pages + numBuckets;
+		for (bits = 0; (1 << bits) < fanOut; bits++);
+		distributionCompares += bits;
+		fanOut = (bufferSizeInBlocks - 1) < DIST_MAX_SAMPLES + 1 ? (bufferSizeInBlocks - 1) : DIST_MAX_SAMPLES + 1;
+	}
+	if (NULL != distributionWrites)
+		*distributionWrites = distributionBlocks;
+
+	if (distributionBlocks != mergeBlocks)
+		return (distributionBlocks < mergeBlocks) ? EXTERNAL_SORT_METHOD_DISTRIBUTION : EXTERNAL_SORT_METHOD_MERGE;
+	return (distributionCompares < mergeCompares) ? EXTERNAL_SORT_METHOD_DISTRIBUTION : EXTERNAL_SORT_METHOD_MERGE;
+}
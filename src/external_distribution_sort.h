@@ -0,0 +1,131 @@
+/******************************************************************************/
+/**
+@file		external_distribution_sort.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		This file contains declarations for external distribution sort and
+			choosing between distribution and merge sort.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/* Sort methods chosen by extern_sort_choose_method() */
+#define    EXTERNAL_SORT_METHOD_MERGE           0
+#define    EXTERNAL_SORT_METHOD_DISTRIBUTION    1
+
+/* Maximum number of records sampled from each bucket to pick splitters when the bucket is distributed again */
+#define    DIST_MAX_SAMPLES                     16
+
+/**
+@brief     	External distribution sort with input iterator. Splitters are picked
+			from the first buffer of input and the records are scattered into
+			buckets stored in tempFile with one block of buffer for each bucket.
+			Buckets that fit in memory are sorted in memory and written to the
+			output in order. Larger buckets are distributed again using splitters
+			sampled from the bucket. Buckets of records that all equal a repeated
+			splitter are written without sorting.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Buffer of es->record_size bytes used to read input records
+@param      file
+                Already opened file to store sorting output
+@param      tempFile
+                Already opened file to store buckets
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 4)
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error.
+*/
+int extern_distribution_sort_iterator_block(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	ION_FILE *tempFile,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+/**
+@brief     	Chooses between external merge sort and distribution sort for
+			es->num_pages blocks of input. The method with fewer expected block
+			writes is chosen. Distribution sort writes a partially filled block for
+			each bucket. On equal writes the method with fewer comparisons per
+			record is chosen: merge sort compares with every run being merged for
+			each record while distribution sort binary searches the splitters.
+			Distribution sort assumes keys are not skewed.
+@param      es
+                Sorting state info (block size, record size, number of input pages)
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      mergeWrites
+                Set to expected block writes of merge sort (may be NULL)
+@param      distributionWrites
+                Set to expected block writes of distribution sort (may be NULL)
+@return		EXTERNAL_SORT_METHOD_MERGE or EXTERNAL_SORT_METHOD_DISTRIBUTION
+*/
+int8_t extern_sort_choose_method(
+	external_sort_t *es,
+	int 	bufferSizeInBlocks,
+	int32_t *mergeWrites,
+	int32_t *distributionWrites);
+
+#if defined(__cplusplus)
+}
+#endif
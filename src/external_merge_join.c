@@ -0,0 +1,287 @@
+/******************************************************************************/
+/**
+@file		external_merge_join.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		Sort-merge join (inner, left outer and semi) of two sorted block files.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_join.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief		Position of a reader in a sorted input.
+*/
+typedef struct {
+	merge_join_input_t *input;
+	char 		*page;				/* Current block in memory */
+	uint32_t 	pageNum;			/* Number of current block */
+	int16_t 	slot;				/* Current record in block */
+	int16_t 	count;				/* Records in current block */
+} merge_join_cursor_t;
+
+/**
+@brief     	Reads a block of the input into the cursor's page and positions the cursor at slot.
+*/
+static int join_read_page(merge_join_cursor_t *cursor, uint32_t pageNum, int16_t slot, metrics_t *metric)
+{
+	external_sort_t *es = cursor->input->es;
+
+	cursor->pageNum = pageNum;
+	cursor->slot = slot;
+	cursor->count = 0;
+	if (pageNum >= cursor->input->num_pages)
+		return 0;
+	if (0 != extern_sort_read_page(cursor->input->file, cursor->input->offset + (long) pageNum * es->page_size, cursor->page, es, metric))
+		return 10;
+	cursor->count = *((int16_t*) (cursor->page+BLOCK_COUNT_OFFSET));
+	return 0;
+}
+
+/**
+@brief     	Moves the cursor past the end of empty or used blocks.
+*/
+static int join_skip_pages(merge_join_cursor_t *cursor, metrics_t *metric)
+{
+	while (cursor->slot >= cursor->count && cursor->pageNum + 1 < cursor->input->num_pages)
+	{
+		if (0 != join_read_page(cursor, cursor->pageNum + 1, 0, metric))
+			return 10;
+	}
+	return 0;
+}
+
+/**
+@brief     	Returns the current record of the cursor or NULL at the end of the input.
+*/
+static char* join_record(merge_join_cursor_t *cursor)
+{
+	if (cursor->slot >= cursor->count)
+		return NULL;
+	return cursor->page + cursor->input->es->headerSize + cursor->slot * cursor->input->es->record_size;
+}
+
+/**
+@brief     	Moves the cursor to the next record.
+*/
+static int join_advance(merge_join_cursor_t *cursor, metrics_t *metric)
+{
+	cursor->slot++;
+	return join_skip_pages(cursor, metric);
+}
+
+/**
+@brief     	Joins two sorted inputs on their keys. Right records with the same key
+			are buffered in memory while the left records with that key are joined
+			with them. If they do not fit, the rest are read again from the file for
+			each left record.
+@param      left
+                Left (outer) input
+@param      right
+                Right (inner) input
+@param      joinType
+                MERGE_JOIN_INNER, MERGE_JOIN_LEFT_OUTER or MERGE_JOIN_SEMI
+@param      buffer
+                Pre-allocated space used by algorithm during the join
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 3). One block for each input and the rest buffer right records.
+@param      output
+                Called for each result with the left record and the right record (NULL for semi join and left records without a match)
+@param      outputState
+                Passed to output
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons)
+@param      compareFn
+                Compares key of a left record with key of a right record
+@return		0 on success, 8 if buffer is too small, 10 on read error.
+*/
+int extern_merge_join(
+	merge_join_input_t *left,
+	merge_join_input_t *right,
+	int8_t 	joinType,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	void (*output)(void *state, void *leftRecord, void *rightRecord),
+	void	*outputState,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	merge_join_cursor_t lcur, rcur, spill;
+	uint16_t 	rightSize = right->es->record_size;
+	char 		*dupBuffer = buffer + 2 * left->es->page_size;
+	int32_t 	dupCapacity, numBuffered, groupCount, i;
+	uint32_t 	spillPage = 0;
+	int16_t 	spillSlot = 0;
+	char 		*groupKey = NULL;
+	char 		*l, *r;
+	int8_t 		cmp;
+	int 		err = 0;
+
+	if (bufferSizeInBlocks < 3 || left->es->page_size != right->es->page_size)
+		return 8;
+	dupCapacity = (bufferSizeInBlocks - 2) * right->es->page_size / rightSize;
+
+	/* First right record of current group is kept to compare with following left records */
+	groupKey = (char*) malloc(rightSize);
+	if (NULL == groupKey)
+		return 8;
+
+	lcur.input = left;
+	lcur.page = buffer;
+	rcur.input = right;
+	rcur.page = buffer + left->es->page_size;
+	if (0 != join_read_page(&lcur, 0, 0, metric) || 0 != join_skip_pages(&lcur, metric)
+		|| 0 != join_read_page(&rcur, 0, 0, metric) || 0 != join_skip_pages(&rcur, metric))
+	{
+		err = 10;
+		goto cleanup;
+	}
+
+	l = join_record(&lcur);
+	while (l != NULL)
+	{
+		/* Skip right records smaller than left record */
+		cmp = -1;
+		while ((r = join_record(&rcur)) != NULL)
+		{
+			metric->num_compar++;
+			cmp = compareFn(l, r);
+			if (cmp <= 0)
+				break;
+			if (0 != join_advance(&rcur, metric))
+			{
+				err = 10;
+				goto cleanup;
+			}
+			cmp = -1;
+		}
+
+		if (cmp < 0 || joinType == MERGE_JOIN_SEMI)
+		{
+			/* Semi join only needs to know if there is a match so right input is not advanced */
+			if ((cmp < 0 && joinType == MERGE_JOIN_LEFT_OUTER) || (cmp == 0 && joinType == MERGE_JOIN_SEMI))
+				output(outputState, l, NULL);
+			if (0 != join_advance(&lcur, metric))
+			{
+				err = 10;
+				goto cleanup;
+			}
+			l = join_record(&lcur);
+			continue;
+		}
+
+		/* Buffer right records with the same key. Remember where records that do not fit start. */
+		memcpy(groupKey, r, rightSize);
+		numBuffered = 0;
+		groupCount = 0;
+		do
+		{
+			if (numBuffered < dupCapacity)
+			{
+				memcpy(dupBuffer + numBuffered * rightSize, r, rightSize);
+				numBuffered++;
+			}
+			else if (groupCount == numBuffered)
+			{
+				spillPage = rcur.pageNum;
+				spillSlot = rcur.slot;
+			}
+			groupCount++;
+			if (0 != join_advance(&rcur, metric))
+			{
+				err = 10;
+				goto cleanup;
+			}
+			if ((r = join_record(&rcur)) == NULL)
+				break;
+			metric->num_compar++;
+		} while (compareFn(l, r) == 0);
+
+		#if defined(DEBUG)
+			printf("Group of %d right records (%d buffered)\n", groupCount, numBuffered);
+		#endif
+
+		/* Join all left records with this key with the group */
+		do
+		{
+			for (i=0; i < numBuffered; i++)
+				output(outputState, l, dupBuffer + i * rightSize);
+
+			if (groupCount > numBuffered)
+			{
+				/* Read rest of group again using the right input's block then restore its position */
+				spill.input = right;
+				spill.page = rcur.page;
+				if (0 != join_read_page(&spill, spillPage, spillSlot, metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+				for (i=numBuffered; i < groupCount; i++)
+				{
+					if (0 != join_skip_pages(&spill, metric))
+					{
+						err = 10;
+						goto cleanup;
+					}
+					output(outputState, l, join_record(&spill));
+					spill.slot++;
+				}
+				if (0 != join_read_page(&rcur, rcur.pageNum, rcur.slot, metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+			}
+
+			if (0 != join_advance(&lcur, metric))
+			{
+				err = 10;
+				goto cleanup;
+			}
+			if ((l = join_record(&lcur)) == NULL)
+				break;
+			metric->num_compar++;
+		} while (compareFn(l, groupKey) == 0);
+	}
+
+cleanup:
+	free(groupKey);
+	return err;
+}
@@ -0,0 +1,107 @@
+/******************************************************************************/
+/**
+@file		external_merge_join.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		This file contains declarations for a sort-merge join of two sorted
+			block files.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/* Join types */
+#define    MERGE_JOIN_INNER         0       /* Pairs of matching records */
+#define    MERGE_JOIN_LEFT_OUTER    1       /* Pairs of matching records and left records without a match */
+#define    MERGE_JOIN_SEMI          2       /* Left records with a match (once each) */
+
+/**
+@brief		Sorted input of a join. Blocks are stored one after another as written
+			by extern_merge_sort_iterator_block() (file, resultFilePtr and es->num_pages).
+*/
+typedef struct {
+	ION_FILE 	*file;
+	long 		offset;				/* Offset of first block */
+	uint32_t 	num_pages;			/* Number of blocks */
+	external_sort_t *es;			/* Block layout (block, header and record size) */
+} merge_join_input_t;
+
+/**
+@brief     	Joins two sorted inputs on their keys. Right records with the same key
+			are buffered in memory while the left records with that key are joined
+			with them. If they do not fit, the rest are read again from the file for
+			each left record.
+@param      left
+                Left (outer) input
+@param      right
+                Right (inner) input
+@param      joinType
+                MERGE_JOIN_INNER, MERGE_JOIN_LEFT_OUTER or MERGE_JOIN_SEMI
+@param      buffer
+                Pre-allocated space used by algorithm during the join
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 3). One block for each input and the rest buffer right records.
+@param      output
+                Called for each result with the left record and the right record (NULL for semi join and left records without a match)
+@param      outputState
+                Passed to output
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons)
+@param      compareFn
+                Compares key of a left record with key of a right record
+@return		0 on success, 8 if buffer is too small, 10 on read error.
+*/
+int extern_merge_join(
+	merge_join_input_t *left,
+	merge_join_input_t *right,
+	int8_t 	joinType,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	void (*output)(void *state, void *leftRecord, void *rightRecord),
+	void	*outputState,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,381 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_adaptive.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		External merge sort that sizes its buffer from a memory broker between steps.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_adaptive.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief     	Asks the memory broker how many blocks may be used and resizes the buffer.
+			The buffer is kept if it cannot be grown.
+*/
+static int adaptive_resize(
+	int16_t (*memoryBroker)(void *brokerState, int16_t blocksInUse),
+	void	*brokerState,
+	char 	**buffer,
+	int16_t *bufferSizeInBlocks,
+	external_sort_t *es)
+{
+	int16_t blocks = memoryBroker(brokerState, *bufferSizeInBlocks);
+
+	if (blocks < ADAPTIVE_MIN_BLOCKS)
+		blocks = ADAPTIVE_MIN_BLOCKS;
+	if (blocks == *bufferSizeInBlocks)
+		return 0;
+
+	char *resized = (char*) realloc(*buffer, (size_t) blocks * es->page_size);
+	if (NULL == resized)
+		return (NULL == *buffer) ? 8 : 0;
+
+	#if defined(DEBUG)
+		printf("Buffer resized from %d to %d blocks\n", *bufferSizeInBlocks, blocks);
+	#endif
+	*buffer = resized;
+	*bufferSizeInBlocks = blocks;
+	return 0;
+}
+
+/**
+@brief     	External merge sort with input iterator that asks a memory broker for its
+			buffer size.
+@details	The sort allocates its own buffer. Before creating each run and before
+			each merge step the memory broker is called with the number of blocks in
+			use and returns the number of blocks the sort may use (at least
+			ADAPTIVE_MIN_BLOCKS are used). The buffer is then grown or shrunk so
+			memory can be given back to other users between steps. A merge step
+			merges as many runs as the buffer allows (spread evenly over the rest
+			of the pass). Blocks not needed for fan-in read ahead several blocks
+			of each run at a time. Each pass writes its output after the input
+			(alternating between two regions of the file) so the file is about
+			twice the size of the input.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      memoryBroker
+                Called with brokerState and the number of blocks in use (0 at start). Returns number of blocks sort may use.
+@param      brokerState
+                Passed to memoryBroker
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error.
+*/
+int extern_merge_sort_adaptive(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	int16_t (*memoryBroker)(void *brokerState, int16_t blocksInUse),
+	void	*brokerState,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	printf("External merge sort iterator version with memory broker.\n");
+
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int16_t 	bufferSizeInBlocks = 0;
+	int32_t 	numRecordsRead, numRuns = 0, capacity = 8;
+	long 		writePos = 0;
+	int 		i, status = 1, err = 0;
+	char 		*buffer = NULL, *addr;
+
+	/* Run directory (offset, number of blocks). Output runs of a pass overwrite entries of consumed input runs. */
+	long 		*runOffset = (long*) malloc(sizeof(long) * capacity);
+	int32_t 	*runCount = (int32_t*) malloc(sizeof(int32_t) * capacity);
+	int32_t 	*sublsTuplePos = NULL;		/* Current tuple of block being read */
+	int32_t 	*mergeBlock = NULL;			/* Current block of run in buffer */
+	int32_t 	*mergeAhead = NULL;			/* Blocks of run in buffer */
+
+	if (NULL == runOffset || NULL == runCount)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	/* Create initial sorted sublists with size of buffer at time of creation */
+	while (status == 1)
+	{
+		if (0 != adaptive_resize(memoryBroker, brokerState, &buffer, &bufferSizeInBlocks, es))
+		{
+			err = 8;
+			goto cleanup;
+		}
+
+		numRecordsRead = 0;
+		/* Fill up buffer with input records from iterator */
+		addr = buffer+es->headerSize;
+		while (numRecordsRead < bufferSizeInBlocks * tuplesPerPage)
+		{
+			status = iterator(iteratorState, addr);
+			if (status == 0)
+				break;
+
+			numRecordsRead++;
+			addr += es->record_size;					/* Read a record. Advance to next record location in buffer. */
+		}
+		if (numRecordsRead == 0)
+			break;
+
+		int pageio = (numRecordsRead + tuplesPerPage - 1) / tuplesPerPage;
+		metric->num_reads += pageio;
+
+		in_memory_sort(buffer+es->headerSize, (uint32_t)numRecordsRead, es->record_size, compareFn, 1);
+
+		if (numRuns == capacity)
+		{
+			capacity *= 2;
+			long *offsets = (long*) realloc(runOffset, sizeof(long) * capacity);
+			if (NULL != offsets)
+				runOffset = offsets;
+			int32_t *counts = (int32_t*) realloc(runCount, sizeof(int32_t) * capacity);
+			if (NULL != counts)
+				runCount = counts;
+			if (NULL == offsets || NULL == counts)
+			{
+				err = 8;
+				goto cleanup;
+			}
+		}
+		runOffset[numRuns] = writePos;
+		runCount[numRuns] = pageio;
+		numRuns++;
+
+		for (i=0; i < pageio; i++)
+		{
+			/* Header of block overwrites tail of previous block which has already been written */
+			addr = buffer + i * es->record_size * tuplesPerPage;
+			*((int32_t*) addr) = i;																		/* Block index */
+			*((int16_t*) (addr+BLOCK_COUNT_OFFSET)) = (i < pageio-1) ? tuplesPerPage : numRecordsRead - tuplesPerPage * i;	/* Block record count */
+
+			if (0 != extern_sort_write_page(file, writePos, addr, es, metric))
+			{
+				err = 9;
+				goto cleanup;
+			}
+			writePos += es->page_size;
+		}
+	}
+
+	*resultFilePtr = 0;
+	if (numRuns <= 1)
+		goto cleanup;			/* No merge phase necessary */
+
+	long 		regionSize = writePos, inputBase = 0;
+	void		*tuple, *value;
+	char 		*outputBuffer;
+	int32_t 	lowId, numblocks, outRuns, run, subListsInRun, steps, arrays = 0;
+	int16_t 	blocksPerRun;
+	size_t 		bufferOutputPos;
+
+	while (numRuns > 1)
+	{
+		/* Output of a pass is written to the region the input of the previous pass was in */
+		writePos = (inputBase == 0) ? regionSize : 0;
+		inputBase = writePos;
+		outRuns = 0;
+		for (run = 0; run < numRuns; run += subListsInRun)
+		{
+			if (0 != adaptive_resize(memoryBroker, brokerState, &buffer, &bufferSizeInBlocks, es))
+			{
+				err = 8;
+				goto cleanup;
+			}
+
+			/* Spread the runs left in the pass evenly over the fewest merge steps */
+			steps = (numRuns - run + bufferSizeInBlocks - 2) / (bufferSizeInBlocks - 1);
+			subListsInRun = (numRuns - run + steps - 1) / steps;
+			blocksPerRun = (bufferSizeInBlocks - 1) / subListsInRun;
+			if (subListsInRun > arrays)
+			{
+				free(mergeAhead);
+				free(mergeBlock);
+				free(sublsTuplePos);
+				arrays = subListsInRun;
+				sublsTuplePos = (int32_t*) malloc(sizeof(int32_t) * arrays);
+				mergeBlock = (int32_t*) malloc(sizeof(int32_t) * arrays);
+				mergeAhead = (int32_t*) malloc(sizeof(int32_t) * arrays);
+				if (NULL == sublsTuplePos || NULL == mergeBlock || NULL == mergeAhead)
+				{
+					err = 8;
+					goto cleanup;
+				}
+			}
+
+			#if defined(DEBUG)
+				printf("Merging %d runs starting at run %d with %d blocks each to offset %li\n", subListsInRun, run, blocksPerRun, writePos);
+			#endif
+
+			/* Fill the buffers with the first blocks of each run being merged */
+			for (i=0; i < subListsInRun; i++)
+			{
+				mergeBlock[i] = 0;
+				mergeAhead[i] = 0;
+				sublsTuplePos[i] = 0;
+			}
+			for (i=0; i < subListsInRun; i++)
+			{
+				mergeAhead[i] = (runCount[run+i] < blocksPerRun) ? runCount[run+i] : blocksPerRun;
+				for (int b=0; b < mergeAhead[i]; b++)
+				{
+					if (0 != extern_sort_read_page(file, runOffset[run+i] + (long) b * es->page_size, buffer + (i * blocksPerRun + b) * es->page_size, es, metric))
+					{
+						err = 10;
+						goto cleanup;
+					}
+				}
+			}
+
+			/* Continually find lowest tuple in the runs and write to output buffer */
+			outputBuffer = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+			numblocks = 0;
+			bufferOutputPos = es->headerSize;
+			while (1)
+			{
+				/* Find smallest record */
+				lowId = -1;
+				tuple = NULL;
+				for (i=0; i < subListsInRun; i++)
+				{
+					if (mergeBlock[i] >= runCount[run+i])
+						continue;			/* Run has been completely used */
+
+					value = buffer + es->headerSize + (i * blocksPerRun + mergeBlock[i] % blocksPerRun) * es->page_size + sublsTuplePos[i] * es->record_size;
+					if (NULL != tuple)
+					{
+						metric->num_compar++;
+						if (0 >= compareFn(tuple, value))
+							continue;
+					}
+					lowId = i;
+					tuple = value;
+				}
+				if (lowId < 0)
+					break;					/* Processed all input */
+
+				/* Add tuple to buffer */
+				metric->num_memcpys++;
+				memcpy(outputBuffer + bufferOutputPos, tuple, es->record_size);
+				bufferOutputPos += es->record_size;
+
+				/* If the buffer is full write it out */
+				if (bufferOutputPos + es->record_size > es->page_size)
+				{
+					*((int32_t*) outputBuffer) = numblocks++;											/* Block index */
+					*((int16_t*) (outputBuffer+BLOCK_COUNT_OFFSET)) = (bufferOutputPos - es->headerSize) / es->record_size;	/* Block record count */
+					if (0 != extern_sort_write_page(file, writePos + (long) (numblocks - 1) * es->page_size, outputBuffer, es, metric))
+					{
+						err = 9;
+						goto cleanup;
+					}
+					bufferOutputPos = es->headerSize;
+				}
+
+				/* Move to next block of run. Read ahead the next blocks when all blocks in buffer are used. */
+				sublsTuplePos[lowId]++;
+				addr = buffer + (lowId * blocksPerRun + mergeBlock[lowId] % blocksPerRun) * es->page_size;
+				if (sublsTuplePos[lowId] >= *((int16_t*) (addr+BLOCK_COUNT_OFFSET)))
+				{
+					mergeBlock[lowId]++;
+					sublsTuplePos[lowId] = 0;
+					if (mergeBlock[lowId] == mergeAhead[lowId] && mergeAhead[lowId] < runCount[run+lowId])
+					{
+						int32_t first = mergeAhead[lowId];
+						mergeAhead[lowId] = (runCount[run+lowId] - first < blocksPerRun) ? runCount[run+lowId] : first + blocksPerRun;
+						for (int b=first; b < mergeAhead[lowId]; b++)
+						{
+							if (0 != extern_sort_read_page(file, runOffset[run+lowId] + (long) b * es->page_size, buffer + (lowId * blocksPerRun + b % blocksPerRun) * es->page_size, es, metric))
+							{
+								err = 10;
+								goto cleanup;
+							}
+						}
+					}
+				}
+			}
+
+			/* Write out output buffer if partially full */
+			if (bufferOutputPos > es->headerSize)
+			{
+				*((int32_t*) outputBuffer) = numblocks++;												/* Block index */
+				*((int16_t*) (outputBuffer+BLOCK_COUNT_OFFSET)) = (bufferOutputPos - es->headerSize) / es->record_size;		/* Block record count */
+				if (0 != extern_sort_write_page(file, writePos + (long) (numblocks - 1) * es->page_size, outputBuffer, es, metric))
+				{
+					err = 9;
+					goto cleanup;
+				}
+			}
+			runOffset[outRuns] = writePos;
+			runCount[outRuns] = numblocks;
+			outRuns++;
+			writePos += (long) numblocks * es->page_size;
+		}
+		numRuns = outRuns;
+	} /* End of merge */
+
+	/* Return pointer to sorted output */
+	*resultFilePtr = runOffset[0];
+
+cleanup:
+	if (0 == err && 0 != extern_sort_flush_pages(es, metric))
+		err = 9;
+	free(mergeAhead);
+	free(mergeBlock);
+	free(sublsTuplePos);
+	free(runCount);
+	free(runOffset);
+	free(buffer);
+	return err;
+}
@@ -0,0 +1,104 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_adaptive.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		External merge sort that sizes its buffer from a memory broker between steps.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/* Fewest blocks the sort uses (two input blocks and an output block) */
+#define ADAPTIVE_MIN_BLOCKS 3
+
+/**
+@brief     	External merge sort with input iterator that asks a memory broker for its
+			buffer size.
+@details	The sort allocates its own buffer. Before creating each run and before
+			each merge step the memory broker is called with the number of blocks in
+			use and returns the number of blocks the sort may use (at least
+			ADAPTIVE_MIN_BLOCKS are used). The buffer is then grown or shrunk so
+			memory can be given back to other users between steps. A merge step
+			merges as many runs as the buffer allows (spread evenly over the rest
+			of the pass). Blocks not needed for fan-in read ahead several blocks
+			of each run at a time. Each pass writes its output after the input
+			(alternating between two regions of the file) so the file is about
+			twice the size of the input.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      memoryBroker
+                Called with brokerState and the number of blocks in use (0 at start). Returns number of blocks sort may use.
+@param      brokerState
+                Passed to memoryBroker
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error.
+*/
+int extern_merge_sort_adaptive(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	int16_t (*memoryBroker)(void *brokerState, int16_t blocksInUse),
+	void	*brokerState,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+#if defined(__cplusplus)
+}
+#endif
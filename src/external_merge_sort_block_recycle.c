@@ -0,0 +1,359 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_block_recycle.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		File-based external merge sort that stores runs as chains of blocks
+			and reuses blocks of consumed runs for merge output.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_block_recycle.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief		Free list of blocks in the file that can be reused for output.
+*/
+typedef struct {
+	int32_t 	*blocks;		/**< Stack of free block numbers */
+	int32_t 	count;			/**< Number of blocks on the stack */
+	int32_t 	capacity;		/**< Maximum number of blocks on the stack */
+	int32_t 	numBlocks;		/**< Number of blocks in the file (high water mark) */
+} block_free_list_t;
+
+/**
+@brief     	Returns a free block, extending the file only if no block is free.
+*/
+static int32_t block_alloc(block_free_list_t *freeList)
+{
+	if (freeList->count > 0)
+		return freeList->blocks[--freeList->count];
+	return freeList->numBlocks++;
+}
+
+/**
+@brief     	Adds a block whose contents have been consumed to the free list.
+*/
+static void block_free(block_free_list_t *freeList, int32_t block)
+{
+	/* Capacity covers all blocks that can be free at once so a block is never lost */
+	if (freeList->count < freeList->capacity)
+		freeList->blocks[freeList->count++] = block;
+}
+
+/**
+@brief     	Sets the header of a block in a chain and writes it to its location in the file.
+*/
+static int write_chain_block(
+	ION_FILE *file,
+	char 	*addr,
+	int32_t block,
+	int32_t blockIndex,
+	int16_t count,
+	int32_t next,
+	external_sort_t *es,
+	metrics_t *metric)
+{
+	*((int32_t*) addr) = blockIndex;								/* Block index */
+	*((int16_t*) (addr+BLOCK_COUNT_OFFSET)) = count;				/* Block record count */
+	*((int32_t*) (addr+BLOCK_NEXT_OFFSET)) = next;					/* Next block in run */
+
+	if (0 != extern_sort_write_page(file, (long) block * es->page_size, addr, es, metric))
+		return 9;
+
+	#if defined(DEBUG)
+		printf("OUTPUT Block: %d Index: %d  Records: %d  Next: %d\n", block, blockIndex, count, next);
+	#endif
+	return 0;
+}
+
+/**
+@brief     	Reads a block of a run into a page of the buffer and frees its space in the file.
+*/
+static int read_chain_block(
+	ION_FILE *file,
+	char 	*addr,
+	int32_t block,
+	block_free_list_t *freeList,
+	external_sort_t *es,
+	metrics_t *metric)
+{
+	if (0 != extern_sort_read_page(file, (long) block * es->page_size, addr, es, metric))
+		return 10;
+
+	/* Block contents are in memory so the merge output may overwrite it */
+	block_free(freeList, block);
+	return 0;
+}
+
+/**
+@brief     	External merge sort with input iterator that recycles blocks between merge passes.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+*/
+int extern_merge_sort_iterator_block_recycle(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	printf("External merge sort iterator version with blocks and block recycling.\n");
+
+	if (es->headerSize < (int8_t) (BLOCK_CHAIN_HEADER_SIZE))
+		return 11;
+
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int32_t 	maxRecordsRead = bufferSizeInBlocks * tuplesPerPage;
+	int32_t 	numRecordsRead = 0, lastRunRecords = 0;
+	int32_t 	numSublist = 0;
+	int 		i, status, err;
+	char 		*addr;
+	int32_t 	block, next;
+	block_free_list_t freeList = {NULL, 0, 0, 0};
+
+	/* Create initial sorted sublists (size of M). Free list is empty so each run is written to consecutive blocks. */
+	do
+	{
+		numRecordsRead = 0;
+		/* Fill up buffer with input records from iterator */
+		addr = buffer+es->headerSize;
+		while (numRecordsRead < maxRecordsRead)
+		{
+			status = iterator(iteratorState, addr);
+			if (status == 0)
+				break;
+
+			numRecordsRead++;
+			addr += es->record_size;					/* Read a record. Advance to next record location in buffer. */
+		}
+		if (numRecordsRead == 0)
+			break;
+
+		int pageio = (numRecordsRead + tuplesPerPage - 1) / tuplesPerPage;
+		metric->num_reads += pageio;
+
+		/* Sort in memory and write run to output file as a chain of blocks */
+		in_memory_sort(buffer+es->headerSize, (uint32_t)numRecordsRead, es->record_size, compareFn, 1);
+
+		block = block_alloc(&freeList);
+		for (i=0; i < pageio; i++)
+		{
+			/* Header of block overwrites tail of previous block which has already been written */
+			addr = buffer + i * es->record_size * tuplesPerPage;
+			next = (i < pageio-1) ? block_alloc(&freeList) : BLOCK_CHAIN_END;
+			err = write_chain_block(file, addr, block, i, (i < pageio-1) ? tuplesPerPage : numRecordsRead - tuplesPerPage * i, next, es, metric);
+			if (err)
+				return err;
+			block = next;
+		}
+		lastRunRecords = numRecordsRead;
+		numSublist++;
+	} while (status == 1);
+
+	*resultFilePtr = 0;
+	if (numSublist <= 1)
+	{	/* No merge phase necessary */
+		return extern_sort_flush_pages(es, metric);
+	}
+
+	/* Merge phase: repeatedly combine the M-1 oldest runs in the run directory */
+	int8_t 		maxSublistsInRun = bufferSizeInBlocks - 1;
+	int8_t 		subListsInRun;
+	int32_t 	numRuns = numSublist;
+	int32_t 	front = 0;
+
+	/* Run directory is a queue of (first block, record count). Runs from run generation are stored consecutively. */
+	int32_t 	*runHead = (int32_t*) malloc(sizeof(int32_t) * numSublist);
+	int32_t 	*runRecords = (int32_t*) malloc(sizeof(int32_t) * numSublist);
+	int32_t 	*runNext = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);				/* Next block to read in run */
+	int32_t 	*runRemaining = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);			/* Records left in run */
+	int32_t 	*sublsTuplePos = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);			/* Current tuple of block being read */
+
+	/* Blocks only become free by being consumed, and at most one per run can be saved by merging partial blocks */
+	freeList.capacity = numSublist + bufferSizeInBlocks;
+	freeList.blocks = (int32_t*) malloc(sizeof(int32_t) * freeList.capacity);
+
+	if (NULL == runHead || NULL == runRecords || NULL == runNext || NULL == runRemaining || NULL == sublsTuplePos || NULL == freeList.blocks)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	for (i=0; i < numSublist; i++)
+	{
+		runHead[i] = i * bufferSizeInBlocks;
+		runRecords[i] = maxRecordsRead;
+	}
+	runRecords[numSublist-1] = lastRunRecords;
+
+	char		*outputBuffer = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+	void		*tuple, *value;
+	int32_t 	lowId, numblocks, outHead, totalRecords, recordsOut;
+	size_t 		bufferOutputPos;
+	err = 0;
+
+	while (numRuns > 1)
+	{
+		/* Remove runs from front of directory and read their first blocks */
+		subListsInRun = numRuns < maxSublistsInRun ? numRuns : maxSublistsInRun;
+		totalRecords = 0;
+		for (i=0; i < subListsInRun; i++)
+		{
+			runRemaining[i] = runRecords[front];
+			totalRecords += runRemaining[i];
+			err = read_chain_block(file, buffer + i * es->page_size, runHead[front], &freeList, es, metric);
+			if (err)
+				goto cleanup;
+			runNext[i] = *((int32_t*) (buffer + i * es->page_size + BLOCK_NEXT_OFFSET));
+			sublsTuplePos[i] = 0;
+			front = (front + 1) % numSublist;
+			numRuns--;
+		}
+
+		#if defined(DEBUG)
+			printf("Merging %d runs with %d records. Free blocks: %d  File blocks: %d\n", subListsInRun, totalRecords, freeList.count, freeList.numBlocks);
+		#endif
+
+		/* Continually find lowest tuple in the runs and write to output buffer */
+		outHead = block_alloc(&freeList);
+		block = outHead;
+		numblocks = 0;
+		recordsOut = 0;
+		bufferOutputPos = es->headerSize;
+		while (recordsOut < totalRecords)
+		{
+			/* Find smallest record */
+			i = 0;
+			while (runRemaining[i] == 0)
+				i++;
+			lowId = i;
+			tuple = buffer + es->headerSize + i * es->page_size + sublsTuplePos[i] * es->record_size;
+			for (i++; i < subListsInRun; i++)
+			{
+				if (0 == runRemaining[i])
+					continue;			/* Run has been completely used */
+
+				value = buffer + es->headerSize + i * es->page_size + sublsTuplePos[i] * es->record_size;
+				metric->num_compar++;
+
+				if (0 < compareFn(tuple, value))
+				{
+					lowId = i;
+					tuple = value;
+				}
+			}
+
+			/* Add tuple to buffer */
+			metric->num_memcpys++;
+			memcpy(outputBuffer + bufferOutputPos, tuple, es->record_size);
+			bufferOutputPos += es->record_size;
+			recordsOut++;
+
+			/* If the buffer is full or the run is complete write it out to a free block */
+			if (bufferOutputPos + es->record_size > es->page_size || recordsOut == totalRecords)
+			{
+				next = (recordsOut == totalRecords) ? BLOCK_CHAIN_END : block_alloc(&freeList);
+				err = write_chain_block(file, outputBuffer, block, numblocks++, (bufferOutputPos - es->headerSize) / es->record_size, next, es, metric);
+				if (err)
+					goto cleanup;
+				block = next;
+				bufferOutputPos = es->headerSize;
+			}
+
+			/* Increment to next tuple of block */
+			sublsTuplePos[lowId]++;
+			runRemaining[lowId]--;
+
+			/* Read next block of run if current block is used and run has more records */
+			addr = buffer + lowId * es->page_size;
+			if (runRemaining[lowId] > 0 && sublsTuplePos[lowId] >= *((int16_t*) (addr+BLOCK_COUNT_OFFSET)))
+			{
+				err = read_chain_block(file, addr, runNext[lowId], &freeList, es, metric);
+				if (err)
+					goto cleanup;
+				runNext[lowId] = *((int32_t*) (addr+BLOCK_NEXT_OFFSET));
+				sublsTuplePos[lowId] = 0;
+			}
+		}
+
+		/* Add output run to back of directory */
+		runHead[(front + numRuns) % numSublist] = outHead;
+		runRecords[(front + numRuns) % numSublist] = totalRecords;
+		numRuns++;
+	} /* End of merge */
+
+	printf("Blocks used in file: %d\n", freeList.numBlocks);
+
+	/* Return pointer to sorted output */
+	*resultFilePtr = (long) runHead[front] * es->page_size;
+	err = extern_sort_flush_pages(es, metric);
+
+cleanup:
+	free(freeList.blocks);
+	free(sublsTuplePos);
+	free(runRemaining);
+	free(runNext);
+	free(runRecords);
+	free(runHead);
+	return err;
+}
@@ -0,0 +1,99 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_block_recycle.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		This file contains declarations for external merge sort with block
+			recycling.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/**
+@brief     	External merge sort with input iterator that recycles blocks between merge passes.
+@details	Runs are stored as chains of blocks linked by a next block pointer in the
+			block header (es->headerSize must be at least BLOCK_CHAIN_HEADER_SIZE).
+			A block of an input run is placed on a free list as soon as the merge has
+			read it, and output blocks are written into free blocks before the file is
+			extended. Peak temporary space is the input size plus a few blocks.
+			The sorted output is a chain of blocks starting at resultFilePtr. Follow the
+			next pointer at BLOCK_NEXT_OFFSET until it is BLOCK_CHAIN_END.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error,
+			11 if the block header is too small to hold the next block pointer.
+*/
+int extern_merge_sort_iterator_block_recycle(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+#if defined(__cplusplus)
+}
+#endif
@@ -48,8 +48,644 @@
 #define DEBUG  1
 */
 
+/**
+@brief     	Updates metrics with the file I/O and hits of the page cache since a prior count.
+*/
+static void cache_metrics(
+	ion_file_cache_t *cache,
+	metrics_t *metric,
+	uint32_t reads,
+	uint32_t writes,
+	uint32_t hits,
+	uint32_t misses)
+{
+	metric->num_reads += cache->num_reads - reads;
+	metric->num_writes += cache->num_writes - writes;
+	metric->num_cache_hits += cache->num_hits - hits;
+	metric->num_cache_misses += cache->num_misses - misses;
+}
+
+/**
+@brief     	Reads a page of the sort file into the buffer.
+@param      file
+                Sort file
+@param      offset
+                Offset of page in file
+@param      addr
+                Location in buffer to read page into
+@param      es
+                Sorting state info (block size, cache)
+@param      metric
+                Tracks algorithm metrics (I/Os, seeks, cache hits and misses)
+@return		0 on success, 10 on read error.
+*/
+int extern_sort_read_page(
+	ION_FILE *file,
+	long 	offset,
+	char 	*addr,
+	external_sort_t *es,
+	metrics_t *metric)
+{
+	ion_file_cache_t *cache = es->cache;
+
+	if (NULL != cache)
+	{
+		uint32_t reads = cache->num_reads, writes = cache->num_writes, hits = cache->num_hits, misses = cache->num_misses;
+		ion_err_t error = ion_fcache_read_at(cache, offset, es->page_size, (ion_byte_t*) addr);
+		cache_metrics(cache, metric, reads, writes, hits, misses);
+		return (err_ok == error) ? 0 : 10;
+	}
+
+	if (ftell(file) != offset)
+		metric->num_seeks += 1;
+	fseek(file, offset, SEEK_SET);
+	if (0 == fread(addr, es->page_size, 1, file))
+		return 10;
+	metric->num_reads += 1;
+	return 0;
+}
+
+/**
+@brief     	Writes a page from the buffer to the sort file.
+@param      file
+                Sort file
+@param      offset
+                Offset of page in file
+@param      addr
+                Location in buffer of page to write
+@param      es
+                Sorting state info (block size, cache)
+@param      metric
+                Tracks algorithm metrics (I/Os, seeks, cache hits and misses)
+@return		0 on success, 9 on write error.
+*/
+int extern_sort_write_page(
+	ION_FILE *file,
+	long 	offset,
+	char 	*addr,
+	external_sort_t *es,
+	metrics_t *metric)
+{
+	ion_file_cache_t *cache = es->cache;
+
+	if (NULL != cache)
+	{
+		uint32_t reads = cache->num_reads, writes = cache->num_writes, hits = cache->num_hits, misses = cache->num_misses;
+		ion_err_t error = ion_fcache_write_at(cache, offset, es->page_size, (ion_byte_t*) addr);
+		cache_metrics(cache, metric, reads, writes, hits, misses);
+		return (err_ok == error) ? 0 : 9;
+	}
+
+	if (ftell(file) != offset)
+		metric->num_seeks += 1;
+	fseek(file, offset, SEEK_SET);
+	if (0 == fwrite(addr, es->page_size, 1, file))
+		return 9;
+	metric->num_writes += 1;
+	return 0;
+}
+
+/**
+@brief     	Writes all modified pages in es->cache to the sort file.
+@param      es
+                Sorting state info (cache)
+@param      metric
+                Tracks algorithm metrics (I/Os)
+@return		0 on success, 9 on write error.
+*/
+int extern_sort_flush_pages(
+	external_sort_t *es,
+	metrics_t *metric)
+{
+	ion_file_cache_t *cache = es->cache;
+
+	if (NULL == cache)
+		return 0;
+
+	uint32_t writes = cache->num_writes;
+	ion_err_t error = ion_fcache_flush(cache);
+	metric->num_writes += cache->num_writes - writes;
+	return (err_ok == error) ? 0 : 9;
+}
+
+/**
+@brief     	Starts a new run of blocks of fixed size entries.
+@param      writer
+                Block writer (page and writePos are kept)
+@param      entrySize
+                Bytes per entry
+@param      es
+                Sorting state info (block size, header size)
+*/
+void extern_sort_writer_init(
+	sort_page_writer_t *writer,
+	uint16_t entrySize,
+	external_sort_t *es)
+{
+	writer->entrySize = entrySize;
+	writer->capacity = (es->page_size - es->headerSize) / entrySize;
+	writer->count = 0;
+	writer->numblocks = 0;
+}
+
+/**
+@brief     	Writes the block being filled to the end of the current run.
+@param      file
+                Sort file
+@param      writer
+                Block writer
+@param      es
+                Sorting state info (block size, cache)
+@param      metric
+                Tracks algorithm metrics (I/Os)
+@return		0 on success, 9 on write error.
+*/
+int extern_sort_writer_flush(
+	ION_FILE *file,
+	sort_page_writer_t *writer,
+	external_sort_t *es,
+	metrics_t *metric)
+{
+	*((int32_t*) writer->page) = writer->numblocks++;								/* Block index */
+	*((int16_t*) (writer->page+BLOCK_COUNT_OFFSET)) = writer->count;				/* Block entry count */
+	if (0 != extern_sort_write_page(file, writer->writePos, writer->page, es, metric))
+		return 9;
+
+	#if defined(DEBUG)
+		printf("OUTPUT Block Offset: %li  Entries: %d  Entry size: %d\n", writer->writePos, writer->count, writer->entrySize);
+	#endif
+	writer->writePos += es->page_size;
+	writer->count = 0;
+	return 0;
+}
+
+/**
+@brief     	Returns space for the next entry of the block, writing the block out first if it is full.
+@param      file
+                Sort file
+@param      writer
+                Block writer
+@param      es
+                Sorting state info (block size, cache)
+@param      metric
+                Tracks algorithm metrics (I/Os)
+@return		Pointer to entry in block or NULL on write error.
+*/
+char* extern_sort_writer_next(
+	ION_FILE *file,
+	sort_page_writer_t *writer,
+	external_sort_t *es,
+	metrics_t *metric)
+{
+	if (writer->count == writer->capacity && 0 != extern_sort_writer_flush(file, writer, es, metric))
+		return NULL;
+	return writer->page + es->headerSize + writer->count++ * writer->entrySize;
+}
+
+/**
+@brief     	Adds a run to the run directory, growing the directory if it is full.
+@param      runOffset
+                Offset of first block of each run (reallocated when grown)
+@param      runCount
+                Number of blocks of each run (reallocated when grown)
+@param      capacity
+                Number of runs the directory has space for
+@param      run
+                Index of run to set
+@param      offset
+                Offset of first block of run
+@param      count
+                Number of blocks of run
+@return		0 on success, 8 if out of memory.
+*/
+int extern_sort_add_run(
+	long 	**runOffset,
+	int32_t **runCount,
+	int32_t *capacity,
+	int32_t run,
+	long 	offset,
+	int32_t count)
+{
+	if (run >= *capacity)
+	{
+		int32_t newCapacity = (*capacity == 0) ? 8 : *capacity * 2;
+		long *newOffset = (long*) realloc(*runOffset, sizeof(long) * newCapacity);
+		if (NULL == newOffset)
+			return 8;
+		*runOffset = newOffset;
+		int32_t *newCount = (int32_t*) realloc(*runCount, sizeof(int32_t) * newCapacity);
+		if (NULL == newCount)
+			return 8;
+		*runCount = newCount;
+		*capacity = newCapacity;
+	}
+	(*runOffset)[run] = offset;
+	(*runCount)[run] = count;
+	return 0;
+}
+
+/**
+@brief     	Returns the offset to write the output runs of a merge pass.
+@param      runOffset
+                Offset of first block of each run being merged
+@param      runCount
+                Number of blocks of each run being merged
+@param      numRuns
+                Number of runs being merged
+@param      outputBlocks
+                Upper bound on the number of blocks written by the pass
+@param      es
+                Sorting state info (block size)
+@return		Offset of start of file if the output fits before the first run, otherwise offset after the last run.
+*/
+long extern_sort_run_write_pos(
+	long 	*runOffset,
+	int32_t *runCount,
+	int32_t numRuns,
+	int32_t outputBlocks,
+	external_sort_t *es)
+{
+	long 	first = runOffset[0], end = 0;
+	int32_t i;
+
+	for (i=0; i < numRuns; i++)
+	{
+		if (runOffset[i] < first)
+			first = runOffset[i];
+		if (runOffset[i] + (long) runCount[i] * es->page_size > end)
+			end = runOffset[i] + (long) runCount[i] * es->page_size;
+	}
+	return ((long) outputBlocks * es->page_size <= first) ? 0 : end;
+}
+
+/**
+@brief     	Merges sorted runs of blocks stored one after another in a file into one
+			run written at writePos.
+@param      file
+                Sort file
+@param      runOffset
+                Offset of first block of each run (advanced as blocks are used)
+@param      runCount
+                Number of blocks of each run (reduced to 0 as blocks are used)
+@param      runPos
+                Space for the current record of each run
+@param      numRuns
+                Number of runs to merge
+@param      runBuffer
+                Buffer of one block for each run
+@param      outputBlock
+                Buffer of one block to fill with output
+@param      writePos
+                Offset to write next output block (advanced as blocks are written)
+@param      numBlocks
+                Set to the number of output blocks written
+@param      es
+                Sorting state info (block size, record size, cache)
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 9 on write error, 10 on read error.
+*/
+int extern_sort_merge_runs(
+	ION_FILE *file,
+	long 	*runOffset,
+	int32_t *runCount,
+	int32_t *runPos,
+	int32_t numRuns,
+	char 	*runBuffer,
+	char 	*outputBlock,
+	long 	*writePos,
+	int32_t *numBlocks,
+	external_sort_t *es,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	test_record_t *tuple, *value, *second;
+	char 		*addr;
+	int32_t 	i, lowId, lastLowId, wins, span, room, probe, step, low, high;
+	size_t 		bufferOutputPos;
+
+	/* Fill the buffers with one block from each run being merged */
+	for (i=0; i < numRuns; i++)
+	{
+		runPos[i] = 0;
+		if (0 != extern_sort_read_page(file, runOffset[i], &runBuffer[i * es->page_size], es, metric))		
+			return 10;
+		
+		#if defined(DEBUG)
+			addr = &(runBuffer[i * es->page_size]);
+			printf("  FIRST MERGE Offset: %li # blocks: %d Block header: %d  Records: %d  First record: %p  Record key: %d\n",runOffset[i],runCount[i],*((int32_t*) addr), *((int16_t*) (addr+4)), (addr+6), ((test_record_t*) (addr+6))->key);
+		#endif
+	}
+
+	/* Continually find lowest tuple in the run and write to output buffer */
+	*numBlocks = 0;
+	lastLowId = -1;
+	wins = 0;
+	bufferOutputPos = es->headerSize;  /* points to next empty tuple position in buffer block */ // Start after header - not at 0	
+	while (1)
+	{					
+		/* Find smallest record */
+		i = 0;
+		while (runCount[i] == 0 && i < numRuns)
+			i++;
+		if (i == numRuns)
+			break;					/* Processed all input */
+		lowId = i;			
+		tuple = (test_record_t*) (runBuffer + es->headerSize  + i * es->page_size + runPos[i] * es->record_size);
+		i++;
+		for ( ; i < numRuns; i++)
+		{
+			if (0 == runCount[i])				
+				continue; 			/* Run has been completely used */
+
+			value = (test_record_t*) (runBuffer + es->headerSize  + i * es->page_size + runPos[i] * es->record_size);
+			metric->num_compar++;
+
+			if (0 < compareFn(tuple, value))
+			{
+				lowId = i;
+				tuple = value;
+			}
+		}			
+			
+		/* Records that fit in output block before it is written */
+		room = (es->page_size - es->record_size - bufferOutputPos + es->record_size - 1) / es->record_size;
+		if (room < 1)
+			room = 1;
+		span = 1;
+		wins = (lowId == lastLowId) ? wins + 1 : 1;
+		lastLowId = lowId;
+		addr = &(runBuffer[lowId * es->page_size]);
+		if (EXTERNAL_SORT_GALLOP_WINS > 0 && wins >= EXTERNAL_SORT_GALLOP_WINS)
+		{
+			/* Gallop: find smallest record of the other runs */
+			second = NULL;
+			for (i=0; i < numRuns; i++)
+			{
+				if (i == lowId || 0 == runCount[i])
+					continue;
+
+				value = (test_record_t*) (runBuffer + es->headerSize  + i * es->page_size + runPos[i] * es->record_size);
+				if (NULL != second)
+				{
+					metric->num_compar++;
+					if (0 >= compareFn(second, value))
+						continue;
+				}
+				second = value;
+			}
+
+			/* Count records of block of winning run not larger than it with an exponential then binary search */
+			span = *((int16_t*) (addr+BLOCK_COUNT_OFFSET)) - runPos[lowId];
+			if (span > room)
+				span = room;
+			if (NULL != second)
+			{
+				low = 1;
+				high = span + 1;
+				for (step = 1; low < span; step *= 2)
+				{
+					probe = (low + step < span) ? low + step : span;
+					metric->num_compar++;
+					if (0 < compareFn((void*) tuple + (probe - 1) * es->record_size, second))
+					{
+						high = probe;
+						break;
+					}
+					low = probe;
+				}
+				while (high - low > 1)
+				{
+					probe = (low + high) / 2;
+					metric->num_compar++;
+					if (0 < compareFn((void*) tuple + (probe - 1) * es->record_size, second))
+						high = probe;
+					else
+						low = probe;
+				}
+				span = low;
+			}
+			if (span < EXTERNAL_SORT_GALLOP_WINS)
+				wins = 0;			/* Stop galloping until run wins again */
+		}
+
+		if (span == room && bufferOutputPos == (size_t) es->headerSize && runPos[lowId] == 0 && span == *((int16_t*) (addr+BLOCK_COUNT_OFFSET)))
+		{
+			/* Whole input block is the next output block: write it without copying records */
+			*((int32_t*) addr) = (*numBlocks)++;																/* Block index */
+			if (0 != extern_sort_write_page(file, *writePos, addr, es, metric))
+				return 9;
+			*writePos += es->page_size;
+		}
+		else
+		{
+			/* Add tuples to buffer */
+			metric->num_memcpys++;
+			memcpy((outputBlock + bufferOutputPos), (void*) tuple, (size_t) span * es->record_size);
+			bufferOutputPos += (size_t) span * es->record_size;
+		}
+
+		/* if the buffer is full write it out */
+		if (bufferOutputPos >= es->page_size - es->record_size)
+		{
+			/* Output the block */
+			*((int32_t*) outputBlock) = (*numBlocks)++;							/* Block index */
+			*((int16_t*) (outputBlock+4)) = bufferOutputPos/es->record_size;	/* Block record count */
+			if (0 != extern_sort_write_page(file, *writePos, outputBlock, es, metric))							 
+				return 9;
+			
+			/* Used to check output buffer is correct when writing */
+			addr = outputBlock;
+			#if defined(DEBUG)
+				printf("OUTPUT Block Offset: %li Block header: %d  Records: %d  First record: %p  Record key: %d\n",*writePos,*((int32_t*) addr), *((int16_t*) (addr+4)), (addr+6), ((test_record_t*) (addr+6))->key);
+			#endif
+			#if defined(DEBUG)
+			/* 
+				for (int a=0; a < *((int16_t*) (addr+4)); a++)
+				{	test_record_t* tmptuple = addr+a*es->record_size+6;
+					printf("Key: %d  Address: %d\n", tmptuple->key, tmptuple);
+				}
+			*/
+			#endif	
+			*writePos += es->page_size; 
+			bufferOutputPos = es->headerSize;
+		}
+		
+		/* Increment to next tuple of block */
+		runPos[lowId] += span;
+
+		/* Check if have more tuples */
+		addr = &(runBuffer[lowId * es->page_size]);
+		if (runPos[lowId] >= *((int16_t*) (addr+4)))
+		{
+			/* Increment to next block */
+			runOffset[lowId] += es->page_size;
+			runCount[lowId]--;
+			runPos[lowId] = 0;
+
+			/* Check if we are finished with that sublist */
+			if (runCount[lowId] > 0)
+			{
+				/* Read in next block */
+				if (0 != extern_sort_read_page(file, runOffset[lowId], &runBuffer[lowId * es->page_size], es, metric))					
+					return 10;
+			}
+		}			
+	}
+
+	/* Write out output buffer if partially full */
+	if (bufferOutputPos > es->headerSize)
+	{
+		/* Output the block */
+		*((int32_t*) outputBlock) = (*numBlocks)++;							/* Block index */
+		*((int16_t*) (outputBlock+4)) = bufferOutputPos/es->record_size;	/* Block record count */
+		if (0 != extern_sort_write_page(file, *writePos, outputBlock, es, metric))							 
+			return 9;
+		
+		/* Used to check output buffer is correct when writing */
+		addr = outputBlock;
+		#if defined(DEBUG)
+			printf("OUTPUT (partial) Block Offset: %li Block header: %d  Records: %d  First record: %p  Record key: %d\n",*writePos,*((int32_t*) addr), *((int16_t*) (addr+4)), (addr+6), ((test_record_t*) (addr+6))->key);
+		#endif					
+					
+		*writePos += es->page_size; 
+		bufferOutputPos = es->headerSize;
+	}
+	return 0;
+}
+
+/**
+@brief     	Batch iterator adapter that reads records from a record-at-a-time iterator.
+@param      state
+                Adapter state (record_batch_iterator_state_t) with the record iterator and its state
+@param      dst
+                Location to store records
+@param      max_records
+                Maximum number of records to return
+@return		Number of records stored in dst. 0 if no more records.
+*/
+size_t recordBatchIterator(void *state, void *dst, size_t max_records)
+{
+	record_batch_iterator_state_t *batchState = (record_batch_iterator_state_t*) state;
+	char 	*addr = (char*) dst;
+	size_t 	count = 0;
+
+	while (count < max_records && 0 != batchState->iterator(batchState->iteratorState, addr))
+	{
+		count++;
+		addr += batchState->recordSize;
+	}
+	return count;
+}
+
+/**
+@brief     	Record iterator adapter that applies a filter predicate and a projection
+			to records of another iterator before they are sorted.
+@details	Records the predicate rejects are skipped and the projection copies the
+			fields to sort into the smaller record returned. Without a projection
+			input records are read directly into buffer. Counts removed records and
+			bytes not stored in the metrics.
+@param      state
+                Adapter state (filter_iterator_state_t) with the input iterator and callbacks
+@param      buffer
+                Location to store next record (recordSize bytes)
+@return		1 if a record was stored in buffer. 0 if no more records.
+*/
+int filterRecordIterator(void *state, void *buffer)
+{
+	filter_iterator_state_t *filterState = (filter_iterator_state_t*) state;
+	void 	*record = (NULL == filterState->projection) ? buffer : filterState->inputRecord;
+
+	while (0 != filterState->iterator(filterState->iteratorState, record))
+	{
+		if (NULL != filterState->predicate && 0 == filterState->predicate(filterState->callbackState, record))
+		{
+			filterState->metric->num_filtered++;
+			filterState->metric->bytes_saved += filterState->inputRecordSize;
+			continue;
+		}
+		if (NULL != filterState->projection)
+		{
+			filterState->projection(filterState->callbackState, record, buffer);
+			filterState->metric->bytes_saved += filterState->inputRecordSize - filterState->recordSize;
+		}
+		filterState->recordsOut++;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+@brief     	External merge sort with input iterator that applies an optional filter
+			predicate and projection to input records before they are stored.
+			Runs hold projected records of es->record_size bytes, so records and
+			fields not needed after the sort are not written in any pass.
+			es->num_pages is set to the number of sorted output blocks.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      predicate
+                Returns 1 to sort an input record and 0 to remove it (NULL keeps all records)
+@param      projection
+                Copies the fields to sort from an input record to a record of es->record_size bytes (NULL if input records are not projected)
+@param      callbackState
+                State passed to predicate and projection
+@param      inputRecordSize
+                Size of input records (es->record_size if there is no projection)
+@param      tupleBuffer
+                Pre-allocated space to store one input row (inputRecordSize bytes)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, projected record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps, records filtered, bytes saved)
+@param      compareFn
+                Record comparison function for ordering projected records
+*/
+int extern_merge_sort_iterator_block_filtered(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	int8_t (*predicate)(void *state, void *record),
+	void (*projection)(void *state, void *record, void *dst),
+	void	*callbackState,
+	uint16_t inputRecordSize,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	filter_iterator_state_t filterState;
+	filterState.iterator = iterator;
+	filterState.iteratorState = iteratorState;
+	filterState.predicate = predicate;
+	filterState.projection = projection;
+	filterState.callbackState = callbackState;
+	filterState.inputRecord = tupleBuffer;
+	filterState.inputRecordSize = (NULL == projection) ? es->record_size : inputRecordSize;
+	filterState.recordSize = es->record_size;
+	filterState.recordsOut = 0;
+	filterState.metric = metric;
+
+	return extern_merge_sort_iterator_block(&filterRecordIterator, &filterState, tupleBuffer, file, buffer, bufferSizeInBlocks, es, resultFilePtr, metric, compareFn);
+}
+
 /**
 @brief     	External merge sort with input iterator and supporting variable number of records per block.
+			es->num_pages is set to the number of sorted output blocks.
 @param      iterator
                 Row iterator for reading input rows
 @param      iteratorState
@@ -82,6 +718,47 @@ int extern_merge_sort_iterator_block(
 	long 	*resultFilePtr,
 	metrics_t *metric,
 	int8_t (*compareFn)(void *a, void *b))
+{
+	record_batch_iterator_state_t batchState;
+	batchState.iterator = iterator;
+	batchState.iteratorState = iteratorState;
+	batchState.recordSize = es->record_size;
+
+	return extern_merge_sort_batch_iterator_block(&recordBatchIterator, &batchState, file, buffer, bufferSizeInBlocks, es, resultFilePtr, metric, compareFn);
+}
+
+/**
+@brief     	External merge sort with batch input iterator and supporting variable number of records per block.
+			es->num_pages is set to the number of sorted output blocks.
+@param      next_batch
+                Batch iterator that stores up to max_records input rows in dst and returns the number stored (0 when done)
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+*/
+int extern_merge_sort_batch_iterator_block(
+	size_t (*next_batch)(void *state, void *dst, size_t max_records),
+	void	*iteratorState,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
 {
 	printf("External merge sort iterator version with blocks and file overwrite.\n");
 
@@ -91,30 +768,31 @@ int extern_merge_sort_iterator_block(
 	/* create initial sorted sublists (size of M) */
 	long 		lastWritePos = 0;
 	int32_t 	numRecordsRead = bufferSizeInBlocks * tuplesPerPage;
-	int 		i=0, status;
+	int 		i=0, done=0;
+	size_t 		numBatch;
 	int32_t 	numSublist=0;
 	int8_t 		passNumber = 1;
 
-	test_record_t *tuple, *value;
 	void *		addr;
-	int32_t 	lowId;
 	int32_t 	numblocks = 0;
-	size_t 		bufferOutputPos; /* points to next empty tuple position in buffer block */ // Start after header - not at 0
+	int 		err;
 	
 	do
 	{		
 		i = 0;
-		/* Fill up buffer with input records from iterator */
+		/* Fill up buffer with batches of input records from iterator */
 		addr = buffer+es->headerSize;
 		while (i < numRecordsRead)
 		{		
-			status=iterator(iteratorState, addr);
-			if (status == 0)			
+			numBatch = next_batch(iteratorState, addr, numRecordsRead - i);
+			if (numBatch == 0)
+			{
+				done = 1;
 				break;
+			}
 			
-			i++;
-			addr += es->record_size;                    /* Read a record. Advance to next record location in buffer. */
-			
+			i += numBatch;
+			addr += numBatch * es->record_size;         /* Read a batch. Advance to next record location in buffer. */
 		}
 		if (i == 0)
 			break;
@@ -127,7 +805,6 @@ int extern_merge_sort_iterator_block(
 		in_memory_sort(buffer+es->headerSize, (uint32_t)numRecordsRead, es->record_size, compareFn, 1);			
 
 		/* Write to output file */
-		fseek(file, lastWritePos, SEEK_SET);	
 		int lastOffset = 0;	
 		for (i=0; i < pageio-1; i++)
 		{
@@ -136,9 +813,10 @@ int extern_merge_sort_iterator_block(
 			*((int32_t*) addr) = i;		                                                        /* Block index */
 			*((int16_t*) (addr+BLOCK_COUNT_OFFSET)) = tuplesPerPage;		                    /* Block record count */
 
-			if (0 == fwrite(addr, es->page_size, 1, file))
+			if (0 != extern_sort_write_page(file, lastWritePos, addr, es, metric))
 				return 9;			
                  
+			lastWritePos += es->page_size;
 			lastOffset += es->record_size * tuplesPerPage;
 		}
 		/* Write last page */
@@ -146,25 +824,26 @@ int extern_merge_sort_iterator_block(
 		*((int32_t*) addr) = i;		                                                            /* Block index */
 		*((int16_t*) (addr+BLOCK_COUNT_OFFSET)) = numRecordsRead - tuplesPerPage * i;		    /* Block record count */
 
-		if (0 == fwrite(addr, es->page_size, 1, file))	 
+		if (0 != extern_sort_write_page(file, lastWritePos, addr, es, metric))	 
 			return 9;	
 		
-		lastWritePos = ftell(file);
-		metric->num_writes += pageio;	
+		lastWritePos += es->page_size;
+		numblocks = pageio;
 		numSublist++;
-	} while (status == 1);
+	} while (!done);
 	
 	if (numSublist == 1)
 	{	/* No merge phase necessary */
 		*resultFilePtr = 0;
-		return 0;
+		es->num_pages = numblocks;
+		return extern_sort_flush_pages(es, metric);
 	}
 
 	/* Merge phase: recursively combine M-1 sublists */
 	int8_t maxSublistsInRun = bufferSizeInBlocks - 1;
 
 	/* Allocate file position arrays */
-	int32_t 	*runOffset = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);   	/* Offset of run in file/memory */
+	long 		*runOffset = (long*) malloc(sizeof(long) * maxSublistsInRun);   		/* Offset of run in file/memory */
 	int32_t 	*runCount = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun); 	 	/* Number of blocks in run  */
 	long 		ptrLastBlock=lastWritePos-es->page_size, ptrFirstBlock=0, ptrNextFirst=lastWritePos;
 	int32_t 	blockIndex;
@@ -216,11 +895,8 @@ int extern_merge_sort_iterator_block(
 			}
 
 			/* Read page at last write position and calculate start of run based on block index */
-			fseek(file, ptrLastBlock, SEEK_SET);
-
-			if (0 == fread(&buffer[0], es->page_size, 1, file))		
+			if (0 != extern_sort_read_page(file, ptrLastBlock, &buffer[0], es, metric))		
 				return 10;
-			metric->num_reads += 1;
 
 			/* Retrieve block index */
 			blockIndex = *((int32_t*) buffer);		
@@ -230,7 +906,7 @@ int extern_merge_sort_iterator_block(
 			sublsTuplePos[i] = 0;
 		
 			#if defined(DEBUG)
-				printf("MERGE Count: %d Offset: %d Block header: %d  Records: %d  First record: %p  Record key: %d\n",runCount[i], runOffset[i], *((int32_t*) buffer), *((int16_t*) (buffer+4)), (buffer+6), ((test_record_t*) (buffer+6))->key);
+				printf("MERGE Count: %d Offset: %li Block header: %d  Records: %d  First record: %p  Record key: %d\n",runCount[i], runOffset[i], *((int32_t*) buffer), *((int16_t*) (buffer+4)), (buffer+6), ((test_record_t*) (buffer+6))->key);
 			#endif
 
 			/* Adjust last block pointer to last block in next sublist */
@@ -248,137 +924,87 @@ int extern_merge_sort_iterator_block(
 			newPass = 0;
 		}
 
-		/* Fill the buffers with one block from each run being merged */
-		for (i=0; i < subListsInRun; i++)
-		{
-			fseek(file, runOffset[i], SEEK_SET);
-			metric->num_reads += 1;
-			if (0 == fread(&buffer[i * es->page_size], es->page_size, 1, file))		
-				return 10;
-			
-			#if defined(DEBUG)
-				addr = &(buffer[i * es->page_size]);
-				printf("  FIRST MERGE Offset: %d # blocks: %d Block header: %d  Records: %d  First record: %p  Record key: %d\n",runOffset[i],runCount[i],*((int32_t*) addr), *((int16_t*) (addr+4)), (addr+6), ((test_record_t*) (addr+6))->key);
-			#endif
-		}
+		/* Merge the runs into one output run */
+		err = extern_sort_merge_runs(file, runOffset, runCount, sublsTuplePos, subListsInRun, buffer, buffer + (bufferSizeInBlocks - 1) * es->page_size, &lastWritePos, &numblocks, es, metric, compareFn);
+		if (0 != err)
+			return err;
+		numSublist = numSublist - subListsInRun + 1;
+	} /* End of merge */
 
-		/* Continually find lowest tuple in the run and write to output buffer */
-		numblocks = 0;
-		bufferOutputPos = es->headerSize;  /* points to next empty tuple position in buffer block */ // Start after header - not at 0	
-		while (1)
-		{					
-			/* Find smallest record */
-			i = 0;
-			while (runCount[i] == 0 && i < subListsInRun)
-				i++;
-			if (i == subListsInRun)
-				break;					/* Processed all input */
-			lowId = i;			
-			tuple = (test_record_t*) (buffer + es->headerSize  + i * es->page_size + sublsTuplePos[i] * es->record_size);
-			i++;
-			for ( ; i < subListsInRun; i++)
-			{
-				if (0 == runCount[i])				
-					continue; 			/* Run has been completely used */
+	/* Return pointer to sorted output and its number of blocks */
+	*resultFilePtr = ptrNextFirst;
+	es->num_pages = (numSublist == 0) ? 0 : numblocks;
 
-				value = (test_record_t*) (buffer + es->headerSize  + i * es->page_size + sublsTuplePos[i] * es->record_size);
-				metric->num_compar++;
+	// Cleanup
+	free(sublsTuplePos);
+	free(runOffset);
+	free(runCount);
+	return extern_sort_flush_pages(es, metric);
+}
 
-				if (0 < compareFn(tuple, value))
-				{
-					lowId = i;
-					tuple = value;
-				}
-			}			
-				
-			/* Add tuple to buffer */
-			metric->num_memcpys++;			
-			memcpy((buffer + (bufferSizeInBlocks - 1) * es->page_size + bufferOutputPos), (void*) tuple, es->record_size);
-			bufferOutputPos += es->record_size;
+/**
+@brief     	Plans the peak temporary file space used by the sort.
+@param      es
+                Sorting state info (block size, record size, number of input pages)
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@return		Upper bound on the number of pages of file space used by the sort.
+*/
+int32_t extern_merge_sort_temp_pages(
+	external_sort_t *es,
+	int 	bufferSizeInBlocks)
+{
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int32_t 	numRecords = es->num_pages * tuplesPerPage;
+	int32_t 	numSublist = (es->num_pages + bufferSizeInBlocks - 1) / bufferSizeInBlocks;
+	int32_t 	lastWritePos, peak;
+	int8_t 		passNumber = 0;
 
-			/* if the buffer is full write it out */
-			if (bufferOutputPos >= es->page_size - es->record_size)
-			{
-				fseek(file, lastWritePos, SEEK_SET);
-				/* Output the block */
-				*((int32_t*) &buffer[(bufferSizeInBlocks - 1) * es->page_size]) = numblocks++;							/* Block index */
-				*((int16_t*) (&buffer[(bufferSizeInBlocks - 1) * es->page_size]+4)) = bufferOutputPos/es->record_size;	/* Block record count */
-				if (0 == fwrite(&buffer[(bufferSizeInBlocks - 1) * es->page_size], es->page_size, 1, file))							 
-					return 9;
-				
-				/* Used to check output buffer is correct when writing */
-				addr = &buffer[(bufferSizeInBlocks - 1) * es->page_size];
-				#if defined(DEBUG)
-					printf("OUTPUT Block Offset: %d Block header: %d  Records: %d  First record: %p  Record key: %d\n",last_writePos,*((int32_t*) addr), *((int16_t*) (addr+4)), (addr+6), ((test_record_t*) (addr+6))->key);
-				#endif
-				#if defined(DEBUG)
-				/* 
-					for (int a=0; a < *((int16_t*) (addr+4)); a++)
-					{	test_record_t* tmptuple = addr+a*es->record_size+6;
-						printf("Key: %d  Address: %d\n", tmptuple->key, tmptuple);
-					}
-				*/
-				#endif	
-				lastWritePos = ftell(file); 
-				bufferOutputPos = es->headerSize;
-				metric->num_writes += 1;
-			}
-			
-			/* Increment to next tuple of block */
-			sublsTuplePos[lowId]++;
+	/* Merge output flushes a page when less than one record of space remains */
+	int32_t 	outputPerPage = (es->page_size - es->headerSize - 1) / es->record_size;
+	if (outputPerPage < 1)
+		outputPerPage = 1;
 
-			/* Check if have more tuples */
-			addr = &(buffer[lowId * es->page_size]);
-			if (sublsTuplePos[lowId] >= *((int16_t*) (addr+4)))
-			{
-				/* Increment to next block */
-				runOffset[lowId] += es->page_size;
-				runCount[lowId]--;
-				sublsTuplePos[lowId] = 0;
+	/* Run generation writes the input once */
+	lastWritePos = es->num_pages;
+	peak = lastWritePos;
 
-				/* Check if we are finished with that sublist */
-				if (runCount[lowId] > 0)
-				{
-					/* Read in next block */
-					fseek(file, runOffset[lowId], SEEK_SET);
+	while (numSublist > 1)
+	{
+		numSublist = (numSublist + bufferSizeInBlocks - 2) / (bufferSizeInBlocks - 1);
+		passNumber++;
 
-					if (0 == fread(&buffer[lowId * es->page_size], es->page_size, 1, file))					
-						return 10;
-					
-					metric->num_reads += 1;					
-				}
-			}			
-		}
+		/* Starting writing at the beginning of the file/memory again every 3rd pass */
+		if (passNumber % 3 == 0)
+			lastWritePos = 0;
 
-		/* Write out output buffer if partially full */
-		if (bufferOutputPos > es->headerSize)
-		{
-			fseek(file, lastWritePos, SEEK_SET);
-			/* Output the block */
-			*((int32_t*) &buffer[(bufferSizeInBlocks - 1) * es->page_size]) = numblocks++;							/* Block index */
-			*((int16_t*) (&buffer[(bufferSizeInBlocks - 1) * es->page_size]+4)) = bufferOutputPos/es->record_size;	/* Block record count */
-			if (0 == fwrite(&buffer[(bufferSizeInBlocks - 1) * es->page_size], es->page_size, 1, file))							 
-				return 9;
-			
-			/* Used to check output buffer is correct when writing */
-			addr = &buffer[(bufferSizeInBlocks - 1) * es->page_size];
-			#if defined(DEBUG)
-				printf("OUTPUT (partial) Block Offset: %d Block header: %d  Records: %d  First record: %p  Record key: %d\n",last_writePos,*((int32_t*) addr), *((int16_t*) (addr+4)), (addr+6), ((test_record_t*) (addr+6))->key);
-			#endif					
-						
-			lastWritePos = ftell(file); 
-			bufferOutputPos = es->headerSize;
-			metric->num_writes += 1;
-		}		
-		numSublist = numSublist - subListsInRun + 1;
-	} /* End of merge */
+		/* Each output run has at most one partially filled page. Extra run allows for a merge spanning passes. */
+		lastWritePos += (numRecords + outputPerPage - 1) / outputPerPage + numSublist + 1;
+		if (lastWritePos > peak)
+			peak = lastWritePos;
+	}
+	return peak;
+}
 
-	/* Return pointer to sorted output */
-	*resultFilePtr = ptrNextFirst;
+/**
+@brief     	Reserves the peak temporary space in the sort file before sorting.
+@param      file
+                Already opened file that will be passed to the sort
+@param      es
+                Sorting state info (block size, record size, number of input pages)
+@param      bufferSizeInBlocks
+                Size of buffer in blocks that will be passed to the sort
+@return		0 on success, 9 if the space could not be reserved.
+*/
+int extern_merge_sort_preallocate(
+	ION_FILE *file,
+	external_sort_t *es,
+	int 	bufferSizeInBlocks)
+{
+	long 	numBytes = (long) extern_merge_sort_temp_pages(es, bufferSizeInBlocks) * es->page_size;
 
-	// Cleanup
-	free(sublsTuplePos);
-	free(runOffset);
-	free(runCount);
+	printf("Preallocating temporary space: %li bytes\n", numBytes);
+	if (0 != fpreallocate(file, numBytes))
+		return 9;
 	return 0;
 }
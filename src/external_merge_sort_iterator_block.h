@@ -49,8 +49,12 @@ extern "C" {
 #include "file/sd_stdio_c_iface.h"
 #endif
 
+/* Consecutive wins by one run after which the merge copies a span of its records at once (0 disables galloping) */
+#define    EXTERNAL_SORT_GALLOP_WINS    4
+
 /**
 @brief     	External merge sort with input iterator and supporting variable number of records per block.
+			es->num_pages is set to the number of sorted output blocks.
 @param      iterator
                 Row iterator for reading input rows
 @param      iteratorState
@@ -83,7 +87,367 @@ int extern_merge_sort_iterator_block(
 	long 	*resultFilePtr,
 	metrics_t *metric,
 	int8_t (*compareFn)(void *a, void *b));
-	
+
+/**
+@brief     	External merge sort with batch input iterator and supporting variable number of records per block.
+			es->num_pages is set to the number of sorted output blocks.
+@details	Run generation fills the buffer pages with batches of records from
+			next_batch rather than one record per call.
+@param      next_batch
+                Batch iterator that stores up to max_records input rows in dst and returns the number stored (0 when done)
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+*/
+int extern_merge_sort_batch_iterator_block(
+	size_t (*next_batch)(void *state, void *dst, size_t max_records),
+	void	*iteratorState,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+/**
+@brief     	External merge sort with input iterator that applies an optional filter
+			predicate and projection to input records before they are stored.
+			Runs hold projected records of es->record_size bytes, so records and
+			fields not needed after the sort are not written in any pass.
+			es->num_pages is set to the number of sorted output blocks.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      predicate
+                Returns 1 to sort an input record and 0 to remove it (NULL keeps all records)
+@param      projection
+                Copies the fields to sort from an input record to a record of es->record_size bytes (NULL if input records are not projected)
+@param      callbackState
+                State passed to predicate and projection
+@param      inputRecordSize
+                Size of input records (es->record_size if there is no projection)
+@param      tupleBuffer
+                Pre-allocated space to store one input row (inputRecordSize bytes)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, projected record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps, records filtered, bytes saved)
+@param      compareFn
+                Record comparison function for ordering projected records
+*/
+int extern_merge_sort_iterator_block_filtered(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	int8_t (*predicate)(void *state, void *record),
+	void (*projection)(void *state, void *record, void *dst),
+	void	*callbackState,
+	uint16_t inputRecordSize,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+/**
+@brief     	Record iterator adapter that applies a filter predicate and a projection
+			to records of another iterator before they are sorted.
+@details	Allows filtering and projection with any sort taking a record iterator.
+			Records the predicate rejects are skipped and the projection copies the
+			fields to sort into the smaller record returned. Without a projection
+			input records are read directly into buffer. Counts removed records and
+			bytes not stored in the metrics.
+@param      state
+                Adapter state (filter_iterator_state_t) with the input iterator and callbacks
+@param      buffer
+                Location to store next record (recordSize bytes)
+@return		1 if a record was stored in buffer. 0 if no more records.
+*/
+int filterRecordIterator(
+	void	*state,
+	void	*buffer);
+
+/**
+@brief     	Batch iterator adapter that reads records from a record-at-a-time iterator.
+@details	Allows a record iterator to be used with extern_merge_sort_batch_iterator_block().
+@param      state
+                Adapter state (record_batch_iterator_state_t) with the record iterator and its state
+@param      dst
+                Location to store records
+@param      max_records
+                Maximum number of records to return
+@return		Number of records stored in dst. 0 if no more records.
+*/
+size_t recordBatchIterator(
+	void	*state,
+	void	*dst,
+	size_t 	max_records);
+
+/**
+@brief     	Reads a page of the sort file into the buffer.
+@details	Goes through es->cache when set. Only reads that miss the cache are
+			counted as reads in the metrics.
+@param      file
+                Sort file
+@param      offset
+                Offset of page in file
+@param      addr
+                Location in buffer to read page into
+@param      es
+                Sorting state info (block size, cache)
+@param      metric
+                Tracks algorithm metrics (I/Os, seeks, cache hits and misses)
+@return		0 on success, 10 on read error.
+*/
+int extern_sort_read_page(
+	ION_FILE *file,
+	long 	offset,
+	char 	*addr,
+	external_sort_t *es,
+	metrics_t *metric);
+
+/**
+@brief     	Writes a page from the buffer to the sort file.
+@details	Goes through es->cache when set. Writes to the file happen when the
+			cache writes back a modified page and only those are counted as writes.
+@param      file
+                Sort file
+@param      offset
+                Offset of page in file
+@param      addr
+                Location in buffer of page to write
+@param      es
+                Sorting state info (block size, cache)
+@param      metric
+                Tracks algorithm metrics (I/Os, seeks, cache hits and misses)
+@return		0 on success, 9 on write error.
+*/
+int extern_sort_write_page(
+	ION_FILE *file,
+	long 	offset,
+	char 	*addr,
+	external_sort_t *es,
+	metrics_t *metric);
+
+/**
+@brief     	Writes all modified pages in es->cache to the sort file.
+@param      es
+                Sorting state info (cache)
+@param      metric
+                Tracks algorithm metrics (I/Os)
+@return		0 on success, 9 on write error.
+*/
+int extern_sort_flush_pages(
+	external_sort_t *es,
+	metrics_t *metric);
+
+/**
+@brief     	Starts a new run of blocks of fixed size entries.
+@param      writer
+                Block writer (page and writePos are kept)
+@param      entrySize
+                Bytes per entry
+@param      es
+                Sorting state info (block size, header size)
+*/
+void extern_sort_writer_init(
+	sort_page_writer_t *writer,
+	uint16_t entrySize,
+	external_sort_t *es);
+
+/**
+@brief     	Writes the block being filled to the end of the current run.
+@details	Sets the block index and entry count in the block header and advances
+			writer->writePos to the next block.
+@param      file
+                Sort file
+@param      writer
+                Block writer
+@param      es
+                Sorting state info (block size, cache)
+@param      metric
+                Tracks algorithm metrics (I/Os)
+@return		0 on success, 9 on write error.
+*/
+int extern_sort_writer_flush(
+	ION_FILE *file,
+	sort_page_writer_t *writer,
+	external_sort_t *es,
+	metrics_t *metric);
+
+/**
+@brief     	Returns space for the next entry of the block, writing the block out first if it is full.
+@param      file
+                Sort file
+@param      writer
+                Block writer
+@param      es
+                Sorting state info (block size, cache)
+@param      metric
+                Tracks algorithm metrics (I/Os)
+@return		Pointer to entry in block or NULL on write error.
+*/
+char* extern_sort_writer_next(
+	ION_FILE *file,
+	sort_page_writer_t *writer,
+	external_sort_t *es,
+	metrics_t *metric);
+
+/**
+@brief     	Adds a run to the run directory, growing the directory if it is full.
+@param      runOffset
+                Offset of first block of each run (reallocated when grown)
+@param      runCount
+                Number of blocks of each run (reallocated when grown)
+@param      capacity
+                Number of runs the directory has space for
+@param      run
+                Index of run to set
+@param      offset
+                Offset of first block of run
+@param      count
+                Number of blocks of run
+@return		0 on success, 8 if out of memory.
+*/
+int extern_sort_add_run(
+	long 	**runOffset,
+	int32_t **runCount,
+	int32_t *capacity,
+	int32_t run,
+	long 	offset,
+	int32_t count);
+
+/**
+@brief     	Returns the offset to write the output runs of a merge pass.
+@details	Output is written at the start of the file when it fits before the
+			first run being merged, otherwise after the last run being merged, so
+			passes alternate between the two and reuse the space of runs merged
+			two passes before instead of growing the file every pass.
+@param      runOffset
+                Offset of first block of each run being merged
+@param      runCount
+                Number of blocks of each run being merged
+@param      numRuns
+                Number of runs being merged
+@param      outputBlocks
+                Upper bound on the number of blocks written by the pass
+@param      es
+                Sorting state info (block size)
+@return		Offset of start of file if the output fits before the first run, otherwise offset after the last run.
+*/
+long extern_sort_run_write_pos(
+	long 	*runOffset,
+	int32_t *runCount,
+	int32_t numRuns,
+	int32_t outputBlocks,
+	external_sort_t *es);
+
+/**
+@brief     	Merges sorted runs of blocks stored one after another in a file into one
+			run written at writePos.
+@details	Output blocks are numbered from 0 and written when there is no room for
+			one more record. A run that wins repeatedly is galloped: the records of
+			its block not larger than the smallest record of the other runs are
+			copied together, and a whole input block that is the next output block
+			is written without copying.
+@param      file
+                Sort file
+@param      runOffset
+                Offset of first block of each run (advanced as blocks are used)
+@param      runCount
+                Number of blocks of each run (reduced to 0 as blocks are used)
+@param      runPos
+                Space for the current record of each run
+@param      numRuns
+                Number of runs to merge
+@param      runBuffer
+                Buffer of one block for each run
+@param      outputBlock
+                Buffer of one block to fill with output
+@param      writePos
+                Offset to write next output block (advanced as blocks are written)
+@param      numBlocks
+                Set to the number of output blocks written
+@param      es
+                Sorting state info (block size, record size, cache)
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 9 on write error, 10 on read error.
+*/
+int extern_sort_merge_runs(
+	ION_FILE *file,
+	long 	*runOffset,
+	int32_t *runCount,
+	int32_t *runPos,
+	int32_t numRuns,
+	char 	*runBuffer,
+	char 	*outputBlock,
+	long 	*writePos,
+	int32_t *numBlocks,
+	external_sort_t *es,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+/**
+@brief     	Plans the peak temporary file space used by the sort.
+@details	Uses the input size (es->num_pages) and the merge schedule (runs of
+			bufferSizeInBlocks pages merged bufferSizeInBlocks-1 at a time, with
+			output wrapping to the start of the file every third pass) to compute
+			an upper bound on the file size reached during sorting.
+@param      es
+                Sorting state info (block size, record size, number of input pages)
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@return		Upper bound on the number of pages of file space used by the sort.
+*/
+int32_t extern_merge_sort_temp_pages(
+	external_sort_t *es,
+	int 	bufferSizeInBlocks);
+
+/**
+@brief     	Reserves the peak temporary space in the sort file before sorting.
+@details	Call before extern_merge_sort_iterator_block() so that file growth
+			does not occur on the write path during the sort.
+@param      file
+                Already opened file that will be passed to the sort
+@param      es
+                Sorting state info (block size, record size, number of input pages)
+@param      bufferSizeInBlocks
+                Size of buffer in blocks that will be passed to the sort
+@return		0 on success, 9 if the space could not be reserved.
+*/
+int extern_merge_sort_preallocate(
+	ION_FILE *file,
+	external_sort_t *es,
+	int 	bufferSizeInBlocks);
+
 #if defined(__cplusplus)
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,234 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_kv_separated.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		External merge sort that writes records once to a value log, sorts
+			(key, log offset) pairs and gathers full records in key order.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_kv_separated.h"
+
+/**
+@brief		State of batch iterator that appends records to the value log and returns pairs.
+*/
+typedef struct {
+	int 		(*iterator)(void *state, void* buffer);
+	void		*iteratorState;
+	char		*tupleBuffer;
+	ION_FILE	*valueLog;
+	external_sort_t *es;
+	uint32_t	numRecords;		/* Records appended to value log */
+	int 		err;
+} kv_log_iterator_state_t;
+
+/**
+@brief     	Batch iterator that reads input records, appends them to the value log and returns (key, offset) pairs.
+*/
+static size_t kvLogIterator(void *state, void *dst, size_t max_records)
+{
+	kv_log_iterator_state_t *logState = (kv_log_iterator_state_t*) state;
+	external_sort_t *es = logState->es;
+	char 	*addr = (char*) dst;
+	size_t 	count = 0;
+
+	while (count < max_records && 0 != logState->iterator(logState->iteratorState, logState->tupleBuffer))
+	{
+		/* Value log is written sequentially so record offset is its position in the log */
+		if (0 == fwrite(logState->tupleBuffer, es->record_size, 1, logState->valueLog))
+		{
+			logState->err = 9;
+			return 0;
+		}
+
+		memcpy(addr, logState->tupleBuffer, es->key_size);
+		KV_PAIR_LOG_OFFSET(es, addr) = logState->numRecords * es->record_size;
+		logState->numRecords++;
+		count++;
+		addr += KV_PAIR_SIZE(es);
+	}
+	return count;
+}
+
+/**
+@brief     	Reads the pairs sorted starting at resultFilePtr and writes the full records from the value log in that order.
+*/
+static int kv_gather(
+	ION_FILE *valueLog,
+	ION_FILE *file,
+	ION_FILE *outputFile,
+	char 	*buffer,
+	external_sort_t *es,
+	external_sort_t *pairEs,
+	long 	pairFilePtr,
+	uint32_t numRecords,
+	metrics_t *metric)
+{
+	char 		*pairPage = buffer;
+	char 		*logPage = buffer + es->page_size;
+	char 		*outputPage = buffer + 2 * es->page_size;
+	long 		logStart = 0, logLength = 0, writePos = 0;
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int16_t 	pairCount = 0, pairPos = 0, outputCount = 0;
+	int32_t 	numblocks = 0;
+	uint32_t 	i, offset;
+	char 		*pair;
+
+	for (i = 0; i < numRecords; i++)
+	{
+		if (pairPos >= pairCount)
+		{	/* Read next block of sorted pairs */
+			if (0 != extern_sort_read_page(file, pairFilePtr, pairPage, pairEs, metric))
+				return 10;
+			pairFilePtr += es->page_size;
+			pairCount = *((int16_t*) (pairPage+BLOCK_COUNT_OFFSET));
+			pairPos = 0;
+		}
+		pair = pairPage + pairEs->headerSize + pairPos * pairEs->record_size;
+		pairPos++;
+
+		/* Read page of value log containing record unless already in memory */
+		offset = KV_PAIR_LOG_OFFSET(es, pair);
+		if (offset < logStart || offset + es->record_size > logStart + logLength)
+		{
+			logStart = offset - offset % es->page_size;
+			if (offset + es->record_size > logStart + es->page_size)
+				logStart = offset;				/* Record spans pages */
+			fseek(valueLog, logStart, SEEK_SET);
+			logLength = fread(logPage, 1, es->page_size, valueLog);
+			if (logLength < es->record_size)
+				return 10;
+			metric->num_reads += 1;
+		}
+
+		metric->num_memcpys++;
+		memcpy(outputPage + es->headerSize + outputCount * es->record_size, logPage + (offset - logStart), es->record_size);
+		outputCount++;
+
+		/* If the output block is full or all records gathered write it out */
+		if (outputCount == tuplesPerPage || i == numRecords - 1)
+		{
+			*((int32_t*) outputPage) = numblocks++;										/* Block index */
+			*((int16_t*) (outputPage+BLOCK_COUNT_OFFSET)) = outputCount;				/* Block record count */
+			fseek(outputFile, writePos, SEEK_SET);
+			if (0 == fwrite(outputPage, es->page_size, 1, outputFile))
+				return 9;
+			metric->num_writes += 1;
+			writePos += es->page_size;
+			outputCount = 0;
+		}
+	}
+	return 0;
+}
+
+/**
+@brief     	External merge sort that sorts keys only and materializes full records in a final gather.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      valueLog
+                Already opened file to store full input records
+@param      file
+                Already opened file to store sorted pairs (and in-progress temporary results)
+@param      outputFile
+                Already opened file to store sorted full records, or NULL to only sort pairs
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, key size etc.) for full records
+@param      resultFilePtr
+                Offset of first sorted block in outputFile, or in file if outputFile is NULL
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering (on key only)
+*/
+int extern_merge_sort_kv_separated(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *valueLog,
+	ION_FILE *file,
+	ION_FILE *outputFile,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	printf("External merge sort with key/value separation.\n");
+
+	/* Sort pairs of key and value log offset */
+	external_sort_t pairEs = *es;
+	pairEs.value_size = sizeof(uint32_t);
+	pairEs.record_size = KV_PAIR_SIZE(es);
+	int16_t pairsPerPage = (pairEs.page_size - pairEs.headerSize) / pairEs.record_size;
+	int16_t tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	pairEs.num_pages = (es->num_pages * tuplesPerPage + pairsPerPage - 1) / pairsPerPage;
+
+	kv_log_iterator_state_t logState;
+	logState.iterator = iterator;
+	logState.iteratorState = iteratorState;
+	logState.tupleBuffer = (char*) tupleBuffer;
+	logState.valueLog = valueLog;
+	logState.es = es;
+	logState.numRecords = 0;
+	logState.err = 0;
+
+	fseek(valueLog, 0, SEEK_SET);
+	int err = extern_merge_sort_batch_iterator_block(&kvLogIterator, &logState, file, buffer, bufferSizeInBlocks, &pairEs, resultFilePtr, metric, compareFn);
+	if (0 != logState.err)
+		return logState.err;
+	if (0 != err)
+		return err;
+
+	/* Value log is written sequentially once */
+	metric->num_writes += (logState.numRecords * es->record_size + es->page_size - 1) / es->page_size;
+	fflush(valueLog);
+
+	if (NULL == outputFile || 0 == logState.numRecords)
+		return 0;
+
+	err = kv_gather(valueLog, file, outputFile, buffer, es, &pairEs, *resultFilePtr, logState.numRecords, metric);
+	*resultFilePtr = 0;
+	return err;
+}
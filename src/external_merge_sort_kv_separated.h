@@ -0,0 +1,108 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_kv_separated.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		This file contains declarations for external merge sort with
+			key/value separation.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/* Sorted pair is the key followed by the offset of the full record in the value log */
+#define    KV_PAIR_SIZE(es)            ((es)->key_size + sizeof(uint32_t))
+#define    KV_PAIR_LOG_OFFSET(es, p)   (*((uint32_t*) ((char*) (p) + (es)->key_size)))
+
+/**
+@brief     	External merge sort that sorts keys only and materializes full records in a final gather.
+@details	Each input record is appended once to the value log and only (key,
+			value log offset) pairs are sorted, so merge passes move key-width rather
+			than record-width data. The key must be the first es->key_size bytes of a
+			record and compareFn must only compare those bytes. If outputFile is NULL,
+			the sorted pairs (in the block format with records of KV_PAIR_SIZE bytes) are
+			the output. Otherwise, a gather pass reads the full records from the value
+			log in key order and writes them in the block format to outputFile.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      valueLog
+                Already opened file to store full input records
+@param      file
+                Already opened file to store sorted pairs (and in-progress temporary results)
+@param      outputFile
+                Already opened file to store sorted full records, or NULL to only sort pairs
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, key size etc.) for full records
+@param      resultFilePtr
+                Offset of first sorted block in outputFile, or in file if outputFile is NULL
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering (on key only)
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error.
+*/
+int extern_merge_sort_kv_separated(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *valueLog,
+	ION_FILE *file,
+	ION_FILE *outputFile,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+#if defined(__cplusplus)
+}
+#endif
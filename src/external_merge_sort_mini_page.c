@@ -0,0 +1,425 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_mini_page.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		External merge sort merging runs through sub-block mini pages for a higher fan-in.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_mini_page.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief     	Reads part of a block of the sort file.
+*/
+static int mini_page_read(ION_FILE *file, long offset, char *addr, size_t size, metrics_t *metric)
+{
+	if (ftell(file) != offset)
+		metric->num_seeks += 1;
+	fseek(file, offset, SEEK_SET);
+	if (0 == fread(addr, size, 1, file))
+		return 10;
+	metric->num_reads += 1;
+	return 0;
+}
+
+/**
+@brief     	Returns the number of merge passes to merge runs with a fan-in.
+*/
+static int16_t mini_page_passes(int32_t numRuns, int32_t fanIn)
+{
+	int16_t passes = 0;
+
+	while (numRuns > 1)
+	{
+		numRuns = (numRuns + fanIn - 1) / fanIn;
+		passes++;
+	}
+	return passes;
+}
+
+/**
+@brief     	Chooses the number of records in a mini page (the part of a block read
+			at a time for an input run) for merging es->num_pages blocks of input.
+			Smaller mini pages raise the merge fan-in so fewer passes are needed
+			but each pass does more reads. The cost of a read is seekCost plus
+			the part of pageTransferCost for the bytes read. Each pass writes full
+			blocks costing seekCost plus pageTransferCost.
+@param      es
+                Sorting state info (block size, record size, number of input pages)
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 2)
+@param      seekCost
+                Fixed cost of a read or write (command and positioning)
+@param      pageTransferCost
+                Cost of transferring a block
+@return		Number of records in a mini page. A block of records if mini pages do not lower the cost.
+*/
+int16_t extern_sort_mini_page_records(
+	external_sort_t *es,
+	int 	bufferSizeInBlocks,
+	uint32_t seekCost,
+	uint32_t pageTransferCost)
+{
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int32_t 	numRuns = (es->num_pages + bufferSizeInBlocks - 1) / bufferSizeInBlocks;
+	int32_t 	mergeBytes = (int32_t) (bufferSizeInBlocks - 1) * es->page_size;
+	double 		numRecords = (double) es->num_pages * tuplesPerPage;
+	double 		cost, bestCost = -1;
+	int16_t 	records, bestRecords = tuplesPerPage;
+
+	for (records = tuplesPerPage; records >= 1; records /= 2)
+	{
+		int32_t fanIn = mergeBytes / (records * es->record_size);
+		if (fanIn < 2)
+			continue;
+
+		/* Each pass reads every record in mini pages and writes every block */
+		cost = ((numRecords + records - 1) / records) * (seekCost + (double) pageTransferCost * records / tuplesPerPage)
+				+ (double) es->num_pages * (seekCost + pageTransferCost);
+		cost *= mini_page_passes(numRuns, fanIn);
+
+		#if defined(DEBUG)
+			printf("Mini page records: %d Fan-in: %d Cost: %.0f\n", records, fanIn, cost);
+		#endif
+
+		if (bestCost < 0 || cost < bestCost)
+		{
+			bestCost = cost;
+			bestRecords = records;
+		}
+	}
+	return bestRecords;
+}
+
+/**
+@brief     	External merge sort with input iterator that merges runs using mini pages.
+@details	Run generation is the same as extern_merge_sort_iterator_block(). When
+			merging, the output block is full size and the rest of the buffer is
+			split into mini pages of recordsPerMiniPage records, one for each input
+			run, that are filled with partial block reads. The fan-in is the number
+			of mini pages that fit rather than bufferSizeInBlocks-1. Runs are full
+			blocks except their last block so the location of a record in a run is
+			computed from its position. Each pass writes its output after the input
+			(alternating between two regions of the file) so the file is about twice
+			the size of the input. The page cache (es->cache) is not used.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 2)
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      recordsPerMiniPage
+                Number of records in a mini page. 0 to choose with extern_sort_mini_page_records().
+@param      seekCost
+                Fixed cost of a read or write if recordsPerMiniPage is 0
+@param      pageTransferCost
+                Cost of transferring a block if recordsPerMiniPage is 0
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, seeks, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory or buffer too small, 9 on write error, 10 on read error.
+*/
+int extern_merge_sort_mini_page(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	int16_t recordsPerMiniPage,
+	uint32_t seekCost,
+	uint32_t pageTransferCost,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	if (bufferSizeInBlocks < 2)
+		return 8;
+
+	printf("External merge sort iterator version with mini pages.\n");
+
+	/* Mini pages do not map to cached pages so I/O is done directly */
+	external_sort_t sortState = *es;
+	sortState.cache = NULL;
+	es = &sortState;
+
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int32_t 	maxRecordsRead = bufferSizeInBlocks * tuplesPerPage;
+	int32_t 	numRecordsRead, numRuns = 0, capacity = 8;
+	long 		writePos = 0;
+	int 		i, status, err = 0;
+	char 		*addr;
+
+	/* Run directory (offset, number of records). Output runs of a pass overwrite entries of consumed input runs. */
+	long 		*runOffset = (long*) malloc(sizeof(long) * capacity);
+	int32_t 	*runRecords = (int32_t*) malloc(sizeof(int32_t) * capacity);
+	int32_t 	*readPos = NULL;			/* Next record of run to read into mini page */
+	int16_t 	*miniSlot = NULL;			/* Current record in mini page */
+	int16_t 	*miniCount = NULL;			/* Records in mini page */
+
+	if (NULL == runOffset || NULL == runRecords)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	/* Create initial sorted sublists (size of M) stored one after another */
+	do
+	{
+		numRecordsRead = 0;
+		/* Fill up buffer with input records from iterator */
+		addr = buffer+es->headerSize;
+		while (numRecordsRead < maxRecordsRead)
+		{
+			status = iterator(iteratorState, addr);
+			if (status == 0)
+				break;
+
+			numRecordsRead++;
+			addr += es->record_size;					/* Read a record. Advance to next record location in buffer. */
+		}
+		if (numRecordsRead == 0)
+			break;
+
+		int pageio = (numRecordsRead + tuplesPerPage - 1) / tuplesPerPage;
+		metric->num_reads += pageio;
+
+		in_memory_sort(buffer+es->headerSize, (uint32_t)numRecordsRead, es->record_size, compareFn, 1);
+
+		if (numRuns == capacity)
+		{
+			capacity *= 2;
+			long *offsets = (long*) realloc(runOffset, sizeof(long) * capacity);
+			if (NULL != offsets)
+				runOffset = offsets;
+			int32_t *records = (int32_t*) realloc(runRecords, sizeof(int32_t) * capacity);
+			if (NULL != records)
+				runRecords = records;
+			if (NULL == offsets || NULL == records)
+			{
+				err = 8;
+				goto cleanup;
+			}
+		}
+		runOffset[numRuns] = writePos;
+		runRecords[numRuns] = numRecordsRead;
+		numRuns++;
+
+		for (i=0; i < pageio; i++)
+		{
+			/* Header of block overwrites tail of previous block which has already been written */
+			addr = buffer + i * es->record_size * tuplesPerPage;
+			*((int32_t*) addr) = i;																		/* Block index */
+			*((int16_t*) (addr+BLOCK_COUNT_OFFSET)) = (i < pageio-1) ? tuplesPerPage : numRecordsRead - tuplesPerPage * i;	/* Block record count */
+
+			if (0 != extern_sort_write_page(file, writePos, addr, es, metric))
+			{
+				err = 9;
+				goto cleanup;
+			}
+			writePos += es->page_size;
+		}
+	} while (status == 1);
+
+	*resultFilePtr = 0;
+	if (numRuns <= 1)
+		goto cleanup;			/* No merge phase necessary */
+
+	/* Split all but the output block into mini pages */
+	if (0 == recordsPerMiniPage)
+	{
+		es->num_pages = writePos / es->page_size;
+		recordsPerMiniPage = extern_sort_mini_page_records(es, bufferSizeInBlocks, seekCost, pageTransferCost);
+	}
+	if (recordsPerMiniPage > tuplesPerPage)
+		recordsPerMiniPage = tuplesPerPage;
+	int32_t 	miniPageSize = recordsPerMiniPage * es->record_size;
+	int32_t 	fanIn = (recordsPerMiniPage > 0) ? (int32_t) (bufferSizeInBlocks - 1) * es->page_size / miniPageSize : 0;
+	if (fanIn < 2)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	readPos = (int32_t*) malloc(sizeof(int32_t) * fanIn);
+	miniSlot = (int16_t*) malloc(sizeof(int16_t) * fanIn);
+	miniCount = (int16_t*) malloc(sizeof(int16_t) * fanIn);
+	if (NULL == readPos || NULL == miniSlot || NULL == miniCount)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	#if defined(DEBUG)
+		printf("Mini page records: %d Fan-in: %d Runs: %d\n", recordsPerMiniPage, fanIn, numRuns);
+	#endif
+
+	char		*outputBuffer = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+	long 		regionSize = writePos, inputBase = 0;
+	void		*tuple, *value;
+	int32_t 	lowId, numblocks, outRecords, outRuns, run, subListsInRun;
+	size_t 		bufferOutputPos;
+
+	while (numRuns > 1)
+	{
+		/* Output of a pass is written to the region the input of the previous pass was in */
+		writePos = (inputBase == 0) ? regionSize : 0;
+		inputBase = writePos;
+		outRuns = 0;
+		for (run = 0; run < numRuns; run += subListsInRun)
+		{
+			subListsInRun = (numRuns - run) < fanIn ? (numRuns - run) : fanIn;
+			for (i=0; i < subListsInRun; i++)
+			{
+				readPos[i] = 0;
+				miniSlot[i] = 0;
+				miniCount[i] = 0;
+			}
+
+			numblocks = 0;
+			outRecords = 0;
+			bufferOutputPos = es->headerSize;
+			while (1)
+			{
+				/* Fill empty mini pages from their run. A mini page does not cross a block. */
+				lowId = -1;
+				tuple = NULL;
+				for (i=0; i < subListsInRun; i++)
+				{
+					if (miniSlot[i] >= miniCount[i])
+					{
+						int32_t pos = readPos[i], n;
+						miniSlot[i] = 0;
+						miniCount[i] = 0;
+						if (pos >= runRecords[run+i])
+							continue;			/* Run has been completely used */
+						n = tuplesPerPage - pos % tuplesPerPage;
+						if (n > recordsPerMiniPage)
+							n = recordsPerMiniPage;
+						if (n > runRecords[run+i] - pos)
+							n = runRecords[run+i] - pos;
+						if (0 != mini_page_read(file, runOffset[run+i] + (long) (pos / tuplesPerPage) * es->page_size + es->headerSize + (long) (pos % tuplesPerPage) * es->record_size,
+								buffer + i * miniPageSize, (size_t) n * es->record_size, metric))
+						{
+							err = 10;
+							goto cleanup;
+						}
+						readPos[i] += n;
+						miniCount[i] = n;
+					}
+
+					/* Find smallest record */
+					value = buffer + i * miniPageSize + miniSlot[i] * es->record_size;
+					if (NULL != tuple)
+					{
+						metric->num_compar++;
+						if (0 >= compareFn(tuple, value))
+							continue;
+					}
+					lowId = i;
+					tuple = value;
+				}
+				if (lowId < 0)
+					break;					/* Processed all input */
+
+				/* Add tuple to buffer */
+				metric->num_memcpys++;
+				memcpy(outputBuffer + bufferOutputPos, tuple, es->record_size);
+				bufferOutputPos += es->record_size;
+				outRecords++;
+				miniSlot[lowId]++;
+
+				/* If the buffer is full write it out */
+				if (bufferOutputPos + es->record_size > es->page_size)
+				{
+					*((int32_t*) outputBuffer) = numblocks++;											/* Block index */
+					*((int16_t*) (outputBuffer+BLOCK_COUNT_OFFSET)) = (bufferOutputPos - es->headerSize) / es->record_size;	/* Block record count */
+					if (0 != extern_sort_write_page(file, writePos + (long) (numblocks - 1) * es->page_size, outputBuffer, es, metric))
+					{
+						err = 9;
+						goto cleanup;
+					}
+					bufferOutputPos = es->headerSize;
+				}
+			}
+
+			/* Write out output buffer if partially full */
+			if (bufferOutputPos > es->headerSize)
+			{
+				*((int32_t*) outputBuffer) = numblocks++;												/* Block index */
+				*((int16_t*) (outputBuffer+BLOCK_COUNT_OFFSET)) = (bufferOutputPos - es->headerSize) / es->record_size;		/* Block record count */
+				if (0 != extern_sort_write_page(file, writePos + (long) (numblocks - 1) * es->page_size, outputBuffer, es, metric))
+				{
+					err = 9;
+					goto cleanup;
+				}
+			}
+			runOffset[outRuns] = writePos;
+			runRecords[outRuns] = outRecords;
+			outRuns++;
+			writePos += (long) numblocks * es->page_size;
+		}
+		numRuns = outRuns;
+	} /* End of merge */
+
+	/* Return pointer to sorted output */
+	*resultFilePtr = runOffset[0];
+
+cleanup:
+	free(miniCount);
+	free(miniSlot);
+	free(readPos);
+	free(runRecords);
+	free(runOffset);
+	return err;
+}
@@ -0,0 +1,131 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_mini_page.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		External merge sort merging runs through sub-block mini pages for a higher fan-in.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/**
+@brief     	Chooses the number of records in a mini page (the part of a block read
+			at a time for an input run) for merging es->num_pages blocks of input.
+			Smaller mini pages raise the merge fan-in so fewer passes are needed
+			but each pass does more reads. The cost of a read is seekCost plus
+			the part of pageTransferCost for the bytes read. Each pass writes full
+			blocks costing seekCost plus pageTransferCost.
+@param      es
+                Sorting state info (block size, record size, number of input pages)
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 2)
+@param      seekCost
+                Fixed cost of a read or write (command and positioning)
+@param      pageTransferCost
+                Cost of transferring a block
+@return		Number of records in a mini page. A block of records if mini pages do not lower the cost.
+*/
+int16_t extern_sort_mini_page_records(
+	external_sort_t *es,
+	int 	bufferSizeInBlocks,
+	uint32_t seekCost,
+	uint32_t pageTransferCost);
+
+/**
+@brief     	External merge sort with input iterator that merges runs using mini pages.
+@details	Run generation is the same as extern_merge_sort_iterator_block(). When
+			merging, the output block is full size and the rest of the buffer is
+			split into mini pages of recordsPerMiniPage records, one for each input
+			run, that are filled with partial block reads. The fan-in is the number
+			of mini pages that fit rather than bufferSizeInBlocks-1. Runs are full
+			blocks except their last block so the location of a record in a run is
+			computed from its position. Each pass writes its output after the input
+			(alternating between two regions of the file) so the file is about twice
+			the size of the input. The page cache (es->cache) is not used.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 2)
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      recordsPerMiniPage
+                Number of records in a mini page. 0 to choose with extern_sort_mini_page_records().
+@param      seekCost
+                Fixed cost of a read or write if recordsPerMiniPage is 0
+@param      pageTransferCost
+                Cost of transferring a block if recordsPerMiniPage is 0
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, seeks, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory or buffer too small, 9 on write error, 10 on read error.
+*/
+int extern_merge_sort_mini_page(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	int16_t recordsPerMiniPage,
+	uint32_t seekCost,
+	uint32_t pageTransferCost,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+#if defined(__cplusplus)
+}
+#endif
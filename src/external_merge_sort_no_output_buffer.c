@@ -0,0 +1,411 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_no_output_buffer.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		External merge sort that merges without an output buffer for a fan-in of M.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_no_output_buffer.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief     	Writes bytes at an offset of the sort file.
+*/
+static int no_output_write(ION_FILE *file, long offset, char *addr, size_t size, metrics_t *metric)
+{
+	if (ftell(file) != offset)
+		metric->num_seeks += 1;
+	fseek(file, offset, SEEK_SET);
+	if (0 == fwrite(addr, size, 1, file))
+		return 9;
+	metric->num_writes += 1;
+	return 0;
+}
+
+/**
+@brief     	Writes output records stored at the start of a page to their place in the
+			output run. A piece starting a block is written with the block header,
+			which is stored in the bytes before the piece. Those bytes are the page
+			header or records that were already written.
+@param      page
+                Page with output records in its first count record slots
+@param      count
+                Number of output records in page
+@param      first
+                Position in output run of first record in page
+@param      runRecords
+                Number of records in output run
+@param      runOffset
+                Offset of output run in file
+*/
+static int no_output_flush(ION_FILE *file, char *page, int32_t count, int32_t first, int32_t runRecords, long runOffset, external_sort_t *es, metrics_t *metric)
+{
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int32_t 	i = 0, n, pos;
+	char 		*addr;
+	long 		offset;
+
+	while (i < count)
+	{
+		pos = first + i;
+		n = tuplesPerPage - pos % tuplesPerPage;
+		if (n > count - i)
+			n = count - i;
+		addr = page + es->headerSize + i * es->record_size;
+		offset = runOffset + (long) (pos / tuplesPerPage) * es->page_size + es->headerSize + (long) (pos % tuplesPerPage) * es->record_size;
+		if (0 == pos % tuplesPerPage)
+		{
+			addr -= es->headerSize;
+			offset -= es->headerSize;
+			*((int32_t*) addr) = pos / tuplesPerPage;																			/* Block index */
+			*((int16_t*) (addr+BLOCK_COUNT_OFFSET)) = (runRecords - pos < tuplesPerPage) ? runRecords - pos : tuplesPerPage;		/* Block record count */
+			if (0 != no_output_write(file, offset, addr, n * es->record_size + es->headerSize, metric))
+				return 9;
+		}
+		else if (0 != no_output_write(file, offset, addr, n * es->record_size, metric))
+			return 9;
+		i += n;
+	}
+	return 0;
+}
+
+/**
+@brief     	External merge sort with input iterator that merges without an output buffer.
+@details	Run generation is the same as extern_merge_sort_iterator_block(). When
+			merging, every block of the buffer holds a block of an input run so the
+			fan-in is bufferSizeInBlocks. Output records are copied into the record
+			slots at the start of a block that have already been merged. When the
+			output reaches the first unmerged record of that block, or the block is
+			needed for the next block of its run, the output records are written to
+			their place in the output run and the block with the most merged records
+			is used next. Input blocks are only read after their records are merged
+			and written, so the output is written in pieces of less than a block.
+			Runs are full blocks except their last block so the place of a record is
+			computed from its position. Each pass writes its output after the input
+			(alternating between two regions of the file) so the file is about twice
+			the size of the input. The page cache (es->cache) is not used.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 2)
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, seeks, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory or buffer too small, 9 on write error, 10 on read error.
+*/
+int extern_merge_sort_no_output_buffer(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	if (bufferSizeInBlocks < 2)
+		return 8;
+
+	printf("External merge sort iterator version without output buffer.\n");
+
+	/* Output is written in pieces that do not map to cached pages so I/O is done directly */
+	external_sort_t sortState = *es;
+	sortState.cache = NULL;
+	es = &sortState;
+
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int32_t 	maxRecordsRead = bufferSizeInBlocks * tuplesPerPage;
+	int32_t 	numRecordsRead, numRuns = 0, capacity = 8;
+	long 		writePos = 0;
+	int 		i, status, err = 0;
+	char 		*addr;
+
+	/* Run directory (offset, number of records). Output runs of a pass overwrite entries of consumed input runs. */
+	long 		*runOffset = (long*) malloc(sizeof(long) * capacity);
+	int32_t 	*runRecords = (int32_t*) malloc(sizeof(int32_t) * capacity);
+	int32_t 	*readBlock = NULL;			/* Block of run in buffer */
+	int16_t 	*tuplePos = NULL;			/* Current record of block in buffer */
+	int16_t 	*tupleCount = NULL;			/* Records in block in buffer */
+
+	if (NULL == runOffset || NULL == runRecords)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	/* Create initial sorted sublists (size of M) stored one after another */
+	do
+	{
+		numRecordsRead = 0;
+		/* Fill up buffer with input records from iterator */
+		addr = buffer+es->headerSize;
+		while (numRecordsRead < maxRecordsRead)
+		{
+			status = iterator(iteratorState, addr);
+			if (status == 0)
+				break;
+
+			numRecordsRead++;
+			addr += es->record_size;					/* Read a record. Advance to next record location in buffer. */
+		}
+		if (numRecordsRead == 0)
+			break;
+
+		int pageio = (numRecordsRead + tuplesPerPage - 1) / tuplesPerPage;
+		metric->num_reads += pageio;
+
+		in_memory_sort(buffer+es->headerSize, (uint32_t)numRecordsRead, es->record_size, compareFn, 1);
+
+		if (numRuns == capacity)
+		{
+			capacity *= 2;
+			long *offsets = (long*) realloc(runOffset, sizeof(long) * capacity);
+			if (NULL != offsets)
+				runOffset = offsets;
+			int32_t *records = (int32_t*) realloc(runRecords, sizeof(int32_t) * capacity);
+			if (NULL != records)
+				runRecords = records;
+			if (NULL == offsets || NULL == records)
+			{
+				err = 8;
+				goto cleanup;
+			}
+		}
+		runOffset[numRuns] = writePos;
+		runRecords[numRuns] = numRecordsRead;
+		numRuns++;
+
+		for (i=0; i < pageio; i++)
+		{
+			/* Header of block overwrites tail of previous block which has already been written */
+			addr = buffer + i * es->record_size * tuplesPerPage;
+			*((int32_t*) addr) = i;																		/* Block index */
+			*((int16_t*) (addr+BLOCK_COUNT_OFFSET)) = (i < pageio-1) ? tuplesPerPage : numRecordsRead - tuplesPerPage * i;	/* Block record count */
+
+			if (0 != extern_sort_write_page(file, writePos, addr, es, metric))
+			{
+				err = 9;
+				goto cleanup;
+			}
+			writePos += es->page_size;
+		}
+	} while (status == 1);
+
+	*resultFilePtr = 0;
+	if (numRuns <= 1)
+		goto cleanup;			/* No merge phase necessary */
+
+	int32_t 	fanIn = bufferSizeInBlocks;
+	readBlock = (int32_t*) malloc(sizeof(int32_t) * fanIn);
+	tuplePos = (int16_t*) malloc(sizeof(int16_t) * fanIn);
+	tupleCount = (int16_t*) malloc(sizeof(int16_t) * fanIn);
+	if (NULL == readBlock || NULL == tuplePos || NULL == tupleCount)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	long 		regionSize = writePos, inputBase = 0;
+	void		*tuple, *value;
+	int32_t 	lowId, outPage, outCount, outFirst, outRecords, outRuns, run, subListsInRun, totalRecords;
+	char 		*page;
+
+	while (numRuns > 1)
+	{
+		/* Output of a pass is written to the region the input of the previous pass was in */
+		writePos = (inputBase == 0) ? regionSize : 0;
+		inputBase = writePos;
+		outRuns = 0;
+		for (run = 0; run < numRuns; run += subListsInRun)
+		{
+			subListsInRun = (numRuns - run) < fanIn ? (numRuns - run) : fanIn;
+			totalRecords = 0;
+			for (i=0; i < subListsInRun; i++)
+			{
+				if (0 != extern_sort_read_page(file, runOffset[run+i], buffer + i * es->page_size, es, metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+				readBlock[i] = 0;
+				tuplePos[i] = 0;
+				tupleCount[i] = *((int16_t*) (buffer + i * es->page_size + BLOCK_COUNT_OFFSET));
+				totalRecords += runRecords[run+i];
+			}
+
+			#if defined(DEBUG)
+				printf("Merging %d runs starting at run %d to offset %li\n", subListsInRun, run, writePos);
+			#endif
+
+			outPage = -1;				/* Block storing output records */
+			outCount = 0;				/* Number of output records in block */
+			outFirst = 0;				/* Position in output run of first output record in block */
+			outRecords = 0;
+			while (1)
+			{
+				/* Find smallest record */
+				lowId = -1;
+				tuple = NULL;
+				for (i=0; i < subListsInRun; i++)
+				{
+					if (tuplePos[i] >= tupleCount[i])
+						continue;			/* Run has been completely used */
+
+					value = buffer + es->headerSize + i * es->page_size + tuplePos[i] * es->record_size;
+					if (NULL != tuple)
+					{
+						metric->num_compar++;
+						if (0 >= compareFn(tuple, value))
+							continue;
+					}
+					lowId = i;
+					tuple = value;
+				}
+				if (lowId < 0)
+					break;					/* Processed all input */
+				tuplePos[lowId]++;
+
+				/* Use block with most merged records if output has reached unmerged records */
+				if (outPage < 0 || outCount >= tuplePos[outPage])
+				{
+					if (outPage >= 0 && 0 != no_output_flush(file, buffer + outPage * es->page_size, outCount, outFirst, totalRecords, writePos, es, metric))
+					{
+						err = 9;
+						goto cleanup;
+					}
+					outPage = 0;
+					for (i=1; i < subListsInRun; i++)
+					{
+						if (tuplePos[i] > tuplePos[outPage])
+							outPage = i;
+					}
+					outFirst = outRecords;
+					outCount = 0;
+				}
+
+				/* Add tuple to output */
+				page = buffer + outPage * es->page_size;
+				addr = page + es->headerSize + outCount * es->record_size;
+				if (addr != tuple)
+				{
+					metric->num_memcpys++;
+					memcpy(addr, tuple, es->record_size);
+				}
+				outCount++;
+				outRecords++;
+
+				/* Read next block of run after writing its output records */
+				if (tuplePos[lowId] >= tupleCount[lowId])
+				{
+					readBlock[lowId]++;
+					if ((long) readBlock[lowId] * tuplesPerPage >= runRecords[run+lowId])
+						continue;			/* Run has been completely used */
+
+					if (lowId == outPage)
+					{
+						if (0 != no_output_flush(file, page, outCount, outFirst, totalRecords, writePos, es, metric))
+						{
+							err = 9;
+							goto cleanup;
+						}
+						outPage = -1;
+					}
+					page = buffer + lowId * es->page_size;
+					if (0 != extern_sort_read_page(file, runOffset[run+lowId] + (long) readBlock[lowId] * es->page_size, page, es, metric))
+					{
+						err = 10;
+						goto cleanup;
+					}
+					tuplePos[lowId] = 0;
+					tupleCount[lowId] = *((int16_t*) (page+BLOCK_COUNT_OFFSET));
+				}
+			}
+
+			/* Write remaining output records */
+			if (outPage >= 0 && 0 != no_output_flush(file, buffer + outPage * es->page_size, outCount, outFirst, totalRecords, writePos, es, metric))
+			{
+				err = 9;
+				goto cleanup;
+			}
+			/* Fill the rest of the last block so blocks can be read whole */
+			int32_t used = es->headerSize + ((totalRecords - 1) % tuplesPerPage + 1) * es->record_size;
+			if (used < es->page_size)
+			{
+				if (0 != no_output_write(file, writePos + (long) ((totalRecords - 1) / tuplesPerPage) * es->page_size + used, buffer, es->page_size - used, metric))
+				{
+					err = 9;
+					goto cleanup;
+				}
+			}
+			runOffset[outRuns] = writePos;
+			runRecords[outRuns] = totalRecords;
+			outRuns++;
+			writePos += (long) ((totalRecords + tuplesPerPage - 1) / tuplesPerPage) * es->page_size;
+		}
+		numRuns = outRuns;
+	} /* End of merge */
+
+	/* Return pointer to sorted output */
+	*resultFilePtr = runOffset[0];
+
+cleanup:
+	free(tupleCount);
+	free(tuplePos);
+	free(readBlock);
+	free(runRecords);
+	free(runOffset);
+	return err;
+}
@@ -0,0 +1,417 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_ovc.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		File-based external merge sort of records with byte ordered keys
+			using offset-value codes in runs and a tree of losers merge.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_ovc.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/* Key size used when sorting records in run generation */
+static uint16_t ovcKeySize;
+
+/**
+@brief     	Compares keys of two records as unsigned bytes.
+*/
+static int8_t ovc_key_compare(void *a, void *b)
+{
+	int result = memcmp(a, b, ovcKeySize);
+	if (result < 0) return -1;
+	if (result > 0) return 1;
+	return 0;
+}
+
+/**
+@brief     	Returns the offset-value code of key b relative to key a given that the first start bytes are equal.
+*/
+static uint32_t ovc_code(char *a, char *b, uint16_t start, uint16_t keySize)
+{
+	while (start < keySize && a[start] == b[start])
+		start++;
+	return start == keySize ? 0 : OVC_CODE(keySize, start, b[start]);
+}
+
+/**
+@brief     	Compares two keys with offset-value codes relative to the same base key.
+			Keys are only compared when the codes are equal. The code of the larger
+			key is changed to be relative to the smaller key. On a tie the code of b
+			is changed, so a is taken as the smaller key.
+@return		Negative, zero or positive as a is before, equal to or after b.
+*/
+static int8_t ovc_compare(char *a, uint32_t *codeA, char *b, uint32_t *codeB, uint16_t keySize, metrics_t *metric)
+{
+	uint16_t 	offset;
+
+	if (*codeA != *codeB)
+		return *codeA < *codeB ? -1 : 1;
+	if (0 == *codeA || OVC_END == *codeA)
+		return 0;					/* Both duplicates of the base or both runs done */
+
+	/* Same first difference from the base: compare the bytes after it */
+	metric->num_compar++;
+	offset = keySize - (uint16_t) (*codeA >> 8) + 1;
+	while (offset < keySize && a[offset] == b[offset])
+		offset++;
+	if (offset == keySize)
+	{
+		*codeB = 0;
+		return 0;
+	}
+	if ((uint8_t) a[offset] < (uint8_t) b[offset])
+	{
+		*codeB = OVC_CODE(keySize, offset, b[offset]);
+		return -1;
+	}
+	*codeA = OVC_CODE(keySize, offset, a[offset]);
+	return 1;
+}
+
+/**
+@brief     	Returns the current record of run i being merged (after its code).
+*/
+static char *ovc_head(char *buffer, int16_t *slot, int32_t i, external_sort_t *es)
+{
+	return buffer + i * es->page_size + es->headerSize + slot[i] * (es->record_size + sizeof(uint32_t)) + sizeof(uint32_t);
+}
+
+/**
+@brief     	Adds a record and its code to the block, writing the block out first if it is full.
+*/
+static int ovc_page_add(ION_FILE *file, sort_page_writer_t *writer, char *record, uint32_t code, external_sort_t *es, metrics_t *metric)
+{
+	char *entry = extern_sort_writer_next(file, writer, es, metric);
+	if (NULL == entry)
+		return 9;
+
+	/* Runs that are not the sorted output store the code in front of each record */
+	if (writer->entrySize > es->record_size)
+	{
+		*((uint32_t*) entry) = code;
+		entry += sizeof(uint32_t);
+	}
+	memcpy(entry, record, es->record_size);
+	metric->num_memcpys++;
+	return 0;
+}
+
+/**
+@brief     	External merge sort of records with byte ordered keys using offset-value
+			coding. Keys are es->key_size bytes at the start of the record ordered
+			by unsigned byte comparison, so multi-column keys must be stored in a
+			byte ordered form (e.g. unsigned big-endian integers and padded strings).
+			Run generation sorts the records that fit in the buffer and stores each
+			record in the run with its code relative to the record before it: the
+			offset of the first byte that differs and the value of that byte. Runs
+			are merged with a tree of losers. Every key in the tree has a code
+			relative to the last output key, so most matches are decided by the
+			codes alone and only keys with equal codes are compared, starting after
+			the byte their codes share. The code of each output record is the code
+			of the winner, so merged runs are coded without comparing keys again.
+			The last merge pass writes records without codes. A merge pass writes
+			its runs at the start of the file if they fit before the runs being
+			merged and otherwise after them, so file space is reused. The sorted
+			output is es->num_pages blocks (updated by the sort) at resultFilePtr. Only comparisons that read key
+			bytes are counted in the metrics.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 3)
+@param      es
+                Sorting state info (block size, key and record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@return		0 on success, 8 if out of memory or buffer is too small, 9 on write error,
+			10 on read error, 12 if a record and its code do not fit in a block.
+*/
+int extern_merge_sort_ovc(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric)
+{
+	printf("External merge sort iterator version with offset-value coding.\n");
+
+	sort_page_writer_t writer;
+	long 		*runOffset = NULL, *mergeOffset = NULL;
+	int32_t 	*runCount = NULL, *mergeCount = NULL;
+	int32_t 	*tree = NULL;
+	int16_t 	*slot = NULL;
+	uint32_t 	*codes = NULL;
+	int32_t 	capacity = 0, numSublist = 0, numRecords, i;
+	int32_t 	maxRecords = (bufferSizeInBlocks - 1) * es->page_size / es->record_size;
+	int32_t 	recordsPerPage = (es->page_size - es->headerSize) / es->record_size;
+	uint16_t 	entrySize = es->record_size + sizeof(uint32_t);
+	int 		done = 0, err = 0;
+	char 		*next = NULL;			/* Record read after a full buffer */
+	char 		*tuple, *last;
+
+	if (bufferSizeInBlocks < 3)
+		return 8;
+	if (es->headerSize + entrySize > es->page_size || es->key_size == 0 || es->key_size > es->record_size)
+		return 12;
+
+	/* Last page of buffer is used to build output blocks */
+	writer.page = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+	writer.writePos = 0;
+	ovcKeySize = es->key_size;
+
+	next = (char*) malloc(es->record_size);
+	if (NULL == next)
+		return 8;
+
+	/* Create initial sorted sublists by sorting the records that fit in the rest of the buffer */
+	do
+	{
+		numRecords = 0;
+		if (done == 0 && numSublist > 0)
+		{
+			memcpy(buffer, next, es->record_size);
+			numRecords = 1;
+		}
+		for (; numRecords < maxRecords; numRecords++)
+		{
+			if (0 == iterator(iteratorState, buffer + numRecords * es->record_size))
+			{
+				done = 1;
+				break;
+			}
+		}
+		if (numRecords == 0)
+			break;
+
+		/* Read one record past a full buffer so it is known if this is the only run before it is written */
+		if (!done && 0 == iterator(iteratorState, next))
+			done = 1;
+		metric->num_reads += (numRecords + recordsPerPage - 1) / recordsPerPage;
+
+		in_memory_sort(buffer, (uint32_t) numRecords, es->record_size, ovc_key_compare, 1);
+
+		/* Write run with the code of each record relative to the one before it. A single run is the sorted output. */
+		long runStart = writer.writePos;
+		extern_sort_writer_init(&writer, (done && numSublist == 0) ? es->record_size : entrySize, es);
+		last = NULL;
+		for (i=0; i < numRecords; i++)
+		{
+			tuple = buffer + i * es->record_size;
+			if (NULL == last)
+				err = ovc_page_add(file, &writer, tuple, OVC_CODE(es->key_size, 0, tuple[0]), es, metric);
+			else
+			{
+				metric->num_compar++;
+				err = ovc_page_add(file, &writer, tuple, ovc_code(last, tuple, 0, es->key_size), es, metric);
+			}
+			if (err)
+				goto cleanup;
+			last = tuple;
+		}
+		err = extern_sort_writer_flush(file, &writer, es, metric);
+		if (err)
+			goto cleanup;
+
+		err = extern_sort_add_run(&runOffset, &runCount, &capacity, numSublist++, runStart, writer.numblocks);
+		if (err)
+			goto cleanup;
+	} while (!done);
+
+	*resultFilePtr = 0;
+	es->num_pages = 0;
+	if (numSublist == 0)
+		goto cleanup;
+
+	/* Merge phase: combine M-1 sublists at a time */
+	int32_t 	maxSublistsInRun = bufferSizeInBlocks - 1;
+	int32_t 	subListsInRun;
+	int32_t 	numRuns, run, winner, node, other, numblocks;
+	char 		*addr;
+
+	tree = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);						/* Loser of each match with the winner in tree[0] */
+	codes = (uint32_t*) malloc(sizeof(uint32_t) * maxSublistsInRun);					/* Code of current record of runs relative to last output */
+	slot = (int16_t*) malloc(sizeof(int16_t) * maxSublistsInRun);						/* Current record in block of runs being merged */
+	mergeOffset = (long*) malloc(sizeof(long) * maxSublistsInRun);						/* Offset of current block of runs being merged */
+	mergeCount = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);				/* Blocks left in runs being merged */
+	if (NULL == tree || NULL == codes || NULL == slot || NULL == mergeOffset || NULL == mergeCount)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	while (numSublist > 1)
+	{
+		/* Coded output of a pass is no larger than the runs it merges (a last run with nothing to merge with is not written) */
+		numRuns = (numSublist % maxSublistsInRun == 1) ? numSublist - 1 : numSublist;
+		for (numblocks = 0, i = 0; i < numRuns; i++)
+			numblocks += runCount[i];
+		writer.writePos = extern_sort_run_write_pos(runOffset, runCount, numSublist, numblocks, es);
+		numRuns = 0;
+		for (run = 0; run < numSublist; run += subListsInRun)
+		{
+			subListsInRun = (numSublist - run) < maxSublistsInRun ? (numSublist - run) : maxSublistsInRun;
+			if (subListsInRun == 1)
+			{
+				/* Last run of pass has nothing to merge with and keeps its codes */
+				runOffset[numRuns] = runOffset[run];
+				runCount[numRuns] = runCount[run];
+				numRuns++;
+				continue;
+			}
+
+			long runStart = writer.writePos;
+			extern_sort_writer_init(&writer, (subListsInRun < numSublist) ? entrySize : es->record_size, es);
+
+			/* Fill the buffers with one block from each run being merged. First codes are relative to an empty key. */
+			for (i=0; i < subListsInRun; i++)
+			{
+				mergeOffset[i] = runOffset[run+i];
+				mergeCount[i] = runCount[run+i];
+				addr = buffer + i * es->page_size;
+				if (0 != extern_sort_read_page(file, mergeOffset[i], addr, es, metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+				slot[i] = 0;
+				codes[i] = *((uint32_t*) (addr + es->headerSize));
+				tree[i] = -1;
+			}
+
+			/* Build tree of losers by playing each run up until it reaches an empty match */
+			for (i=0; i < subListsInRun; i++)
+			{
+				winner = i;
+				for (node = (i + subListsInRun) / 2; node > 0 && winner >= 0; node /= 2)
+				{
+					other = tree[node];
+					if (other >= 0 && 0 >= ovc_compare(ovc_head(buffer, slot, other, es), &codes[other], ovc_head(buffer, slot, winner, es), &codes[winner], es->key_size, metric))
+					{
+						tree[node] = winner;
+						winner = other;
+					}
+					else if (other < 0)
+					{
+						tree[node] = winner;
+						winner = -1;
+					}
+				}
+				if (winner >= 0)
+					tree[0] = winner;
+			}
+
+			/* Output the winner and replay the matches on the path from its run to the root */
+			while (OVC_END != codes[tree[0]])
+			{
+				winner = tree[0];
+				err = ovc_page_add(file, &writer, ovc_head(buffer, slot, winner, es), codes[winner], es, metric);
+				if (err)
+					goto cleanup;
+
+				/* Next record of run is coded relative to the record just output */
+				addr = buffer + winner * es->page_size;
+				if (++slot[winner] >= *((int16_t*) (addr+BLOCK_COUNT_OFFSET)))
+				{
+					mergeOffset[winner] += es->page_size;
+					mergeCount[winner]--;
+					slot[winner] = 0;
+					if (mergeCount[winner] > 0 && 0 != extern_sort_read_page(file, mergeOffset[winner], addr, es, metric))
+					{
+						err = 10;
+						goto cleanup;
+					}
+				}
+				codes[winner] = (mergeCount[winner] > 0) ? *((uint32_t*) (ovc_head(buffer, slot, winner, es) - sizeof(uint32_t))) : OVC_END;
+
+				for (node = (winner + subListsInRun) / 2; node > 0; node /= 2)
+				{
+					other = tree[node];
+					if (0 >= ovc_compare(ovc_head(buffer, slot, other, es), &codes[other], ovc_head(buffer, slot, winner, es), &codes[winner], es->key_size, metric))
+					{
+						tree[node] = winner;
+						winner = other;
+					}
+				}
+				tree[0] = winner;
+			}
+
+			/* Write out partially full output block */
+			if (writer.count > 0)
+			{
+				err = extern_sort_writer_flush(file, &writer, es, metric);
+				if (err)
+					goto cleanup;
+			}
+
+			/* Output run replaces directory entry of a consumed run */
+			runOffset[numRuns] = runStart;
+			runCount[numRuns] = writer.numblocks;
+			numRuns++;
+		}
+		numSublist = numRuns;
+	} /* End of merge */
+
+	/* Return pointer to sorted output */
+	*resultFilePtr = runOffset[0];
+	es->num_pages = runCount[0];
+	err = extern_sort_flush_pages(es, metric);
+
+cleanup:
+	free(next);
+	free(mergeCount);
+	free(mergeOffset);
+	free(slot);
+	free(codes);
+	free(tree);
+	free(runCount);
+	free(runOffset);
+	return err;
+}
@@ -0,0 +1,107 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_ovc.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		This file contains declarations for external merge sort with
+			offset-value coding.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/* Offset-value code of a key relative to a smaller key: keys differing at an earlier byte have a larger code.
+   Equal keys have code 0 and a run that has been completely used has code OVC_END. */
+#define    OVC_CODE(keySize, offset, value)    ((((uint32_t) ((keySize) - (offset))) << 8) | (uint8_t) (value))
+#define    OVC_END                             UINT32_MAX
+
+/**
+@brief     	External merge sort of records with byte ordered keys using offset-value
+			coding. Keys are es->key_size bytes at the start of the record ordered
+			by unsigned byte comparison, so multi-column keys must be stored in a
+			byte ordered form (e.g. unsigned big-endian integers and padded strings).
+			Run generation sorts the records that fit in the buffer and stores each
+			record in the run with its code relative to the record before it: the
+			offset of the first byte that differs and the value of that byte. Runs
+			are merged with a tree of losers. Every key in the tree has a code
+			relative to the last output key, so most matches are decided by the
+			codes alone and only keys with equal codes are compared, starting after
+			the byte their codes share. The code of each output record is the code
+			of the winner, so merged runs are coded without comparing keys again.
+			The last merge pass writes records without codes. A merge pass writes
+			its runs at the start of the file if they fit before the runs being
+			merged and otherwise after them, so file space is reused. The sorted
+			output is es->num_pages blocks (updated by the sort) at resultFilePtr. Only comparisons that read key
+			bytes are counted in the metrics.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 3)
+@param      es
+                Sorting state info (block size, key and record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@return		0 on success, 8 if out of memory or buffer is too small, 9 on write error,
+			10 on read error, 12 if a record and its code do not fit in a block.
+*/
+int extern_merge_sort_ovc(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric);
+
+#if defined(__cplusplus)
+}
+#endif
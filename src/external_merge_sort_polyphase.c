@@ -0,0 +1,407 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_polyphase.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		External merge sort with a polyphase merge over sequential streams.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_polyphase.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief		State of a sequential stream. Runs are stored one after another from
+			the start of the stream and a run starts with a block with index 0.
+*/
+typedef struct {
+	long 		readPos;			/* Offset of next block to read */
+	long 		endPos;				/* Offset after last block written */
+	int32_t 	runs;				/* Number of runs in stream */
+	int32_t 	dummies;			/* Number of dummy (empty) runs before the runs */
+	int16_t 	slot;				/* Current record in block */
+	int8_t 		loaded;				/* First block of next run has already been read */
+	int8_t 		merging;			/* Stream has records left in run being merged */
+} polyphase_stream_t;
+
+/**
+@brief     	Moves a stream to the next record of its current run. Reading the
+			first block of the next run ends the current run. The block is kept
+			in the buffer for the next merge.
+*/
+static int polyphase_next(polyphase_stream_t *stream, ION_FILE *file, char *page, external_sort_t *es, metrics_t *metric)
+{
+	stream->slot++;
+	if (stream->slot < *((int16_t*) (page+BLOCK_COUNT_OFFSET)))
+		return 0;
+
+	stream->merging = 0;
+	if (stream->readPos >= stream->endPos)
+		return 0;
+	if (0 != extern_sort_read_page(file, stream->readPos, page, es, metric))
+		return 10;
+	stream->readPos += es->page_size;
+	stream->slot = 0;
+	if (0 == *((int32_t*) page))
+		stream->loaded = 1;			/* Block starts the next run */
+	else
+		stream->merging = 1;
+	return 0;
+}
+
+/**
+@brief     	External merge sort with input iterator using a polyphase merge over
+			sequential streams.
+@details	Runs are distributed over numFiles-1 streams in a generalized Fibonacci
+			distribution, padded with dummy (empty) runs. Each merge phase merges
+			one run from each input stream into the remaining output stream until an
+			input stream is empty. That stream is the output of the next phase and
+			the previous output is read from its start. Every stream is only read
+			or written in order so each file is accessed sequentially except
+			when it is rewound. Only the number of runs is kept in memory for each
+			stream. The page cache (es->cache) covers a single file and is not used.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      files
+                Already opened files used as streams (ideally on different devices or an append-only log each)
+@param      numFiles
+                Number of files (at least 3). At most bufferSizeInBlocks are used.
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFile
+                Index in files of file containing sorted output
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error.
+*/
+int extern_merge_sort_polyphase(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE **files,
+	int8_t 	numFiles,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	int8_t 	*resultFile,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	if (numFiles > bufferSizeInBlocks)
+		numFiles = bufferSizeInBlocks;			/* Each stream needs a block of buffer */
+	if (numFiles < 3)
+	{
+		*resultFile = 0;
+		return extern_merge_sort_iterator_block(iterator, iteratorState, tupleBuffer, files[0], buffer, bufferSizeInBlocks, es, resultFilePtr, metric, compareFn);
+	}
+
+	printf("External merge sort iterator version with polyphase merge over %d streams.\n", numFiles);
+
+	/* Page cache is for a single file so page I/O is done directly */
+	external_sort_t sortState = *es;
+	sortState.cache = NULL;
+	es = &sortState;
+
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int32_t 	maxRecordsRead = bufferSizeInBlocks * tuplesPerPage;
+	int32_t 	numRecordsRead, numSublist = 0;
+	int8_t 		numInputs = numFiles - 1;
+	int8_t 		j = 0, out = numInputs;
+	int 		i, status, err = 0;
+	char 		*addr;
+
+	polyphase_stream_t *streams = (polyphase_stream_t*) malloc(sizeof(polyphase_stream_t) * numFiles);
+	int32_t 	*target = (int32_t*) malloc(sizeof(int32_t) * (numFiles + 1));		/* Runs per stream in perfect distribution of level */
+
+	if (NULL == streams || NULL == target)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	/* Level 1 of distribution has one run in each input stream. Dummy runs count runs still missing from level. */
+	for (i=0; i < numFiles; i++)
+	{
+		streams[i].readPos = 0;
+		streams[i].endPos = 0;
+		streams[i].runs = 0;
+		streams[i].dummies = (i < numInputs) ? 1 : 0;
+		streams[i].loaded = 0;
+		streams[i].merging = 0;
+		target[i] = (i < numInputs) ? 1 : 0;
+	}
+	target[numFiles] = 0;
+
+	/* Create initial sorted sublists (size of M) distributed to input streams */
+	do
+	{
+		numRecordsRead = 0;
+		/* Fill up buffer with input records from iterator */
+		addr = buffer+es->headerSize;
+		while (numRecordsRead < maxRecordsRead)
+		{
+			status = iterator(iteratorState, addr);
+			if (status == 0)
+				break;
+
+			numRecordsRead++;
+			addr += es->record_size;					/* Read a record. Advance to next record location in buffer. */
+		}
+		if (numRecordsRead == 0)
+			break;
+
+		int pageio = (numRecordsRead + tuplesPerPage - 1) / tuplesPerPage;
+		metric->num_reads += pageio;
+
+		in_memory_sort(buffer+es->headerSize, (uint32_t)numRecordsRead, es->record_size, compareFn, 1);
+
+		/* Choose stream with most missing runs (Knuth Algorithm 5.4.2D). Go to next level when all are filled. */
+		if (numSublist > 0)
+		{
+			if (streams[j].dummies < streams[j+1].dummies)
+				j++;
+			else if (streams[j].dummies == 0)
+			{
+				int32_t first = target[0];
+				for (i=0; i < numInputs; i++)
+				{
+					streams[i].dummies = first + target[i+1] - target[i];
+					target[i] = first + target[i+1];
+				}
+				j = 0;
+			}
+			else
+				j = 0;
+		}
+
+		for (i=0; i < pageio; i++)
+		{
+			/* Header of block overwrites tail of previous block which has already been written */
+			addr = buffer + i * es->record_size * tuplesPerPage;
+			*((int32_t*) addr) = i;																		/* Block index */
+			*((int16_t*) (addr+BLOCK_COUNT_OFFSET)) = (i < pageio-1) ? tuplesPerPage : numRecordsRead - tuplesPerPage * i;	/* Block record count */
+
+			if (0 != extern_sort_write_page(files[j], streams[j].endPos, addr, es, metric))
+			{
+				err = 9;
+				goto cleanup;
+			}
+			streams[j].endPos += es->page_size;
+		}
+		streams[j].runs++;
+		streams[j].dummies--;
+		numSublist++;
+	} while (status == 1);
+
+	*resultFile = 0;
+	*resultFilePtr = 0;
+	if (numSublist <= 1)
+		goto cleanup;			/* No merge phase necessary */
+
+	#if defined(DEBUG)
+		for (i=0; i < numInputs; i++)
+			printf("Stream %d: %d runs %d dummy runs\n", i, streams[i].runs, streams[i].dummies);
+	#endif
+
+	/* Each stream reads into and writes from its own block of the buffer */
+	void		*tuple, *value;
+	int32_t 	merges, total, numblocks;
+	int8_t 		lowId, real;
+	size_t 		bufferOutputPos;
+	char 		*outputBuffer;
+
+	while (1)
+	{
+		total = 0;
+		merges = INT32_MAX;
+		for (i=0; i < numFiles; i++)
+		{
+			total += streams[i].runs + streams[i].dummies;
+			if (i != out && streams[i].runs + streams[i].dummies < merges)
+				merges = streams[i].runs + streams[i].dummies;
+		}
+		if (total <= 1)
+			break;
+
+		#if defined(DEBUG)
+			printf("Polyphase merge of %d runs into stream %d\n", merges, out);
+		#endif
+
+		/* Output stream is overwritten from its start */
+		outputBuffer = buffer + out * es->page_size;
+		streams[out].endPos = 0;
+		streams[out].readPos = 0;
+		streams[out].loaded = 0;
+
+		for (; merges > 0; merges--)
+		{
+			/* Dummy runs are merged first. A merge of only dummy runs is a dummy run. */
+			real = 0;
+			for (i=0; i < numFiles; i++)
+			{
+				streams[i].merging = 0;
+				if (i == out)
+					continue;
+				if (streams[i].dummies > 0)
+				{
+					streams[i].dummies--;
+					continue;
+				}
+				streams[i].runs--;
+				real++;
+				if (!streams[i].loaded)
+				{
+					if (0 != extern_sort_read_page(files[i], streams[i].readPos, buffer + i * es->page_size, es, metric))
+					{
+						err = 10;
+						goto cleanup;
+					}
+					streams[i].readPos += es->page_size;
+				}
+				streams[i].loaded = 0;
+				streams[i].slot = 0;
+				streams[i].merging = 1;
+			}
+			if (0 == real)
+			{
+				streams[out].dummies++;
+				continue;
+			}
+
+			/* Continually find lowest tuple in the runs and write to output buffer */
+			numblocks = 0;
+			bufferOutputPos = es->headerSize;
+			while (1)
+			{
+				/* Find smallest record */
+				lowId = -1;
+				tuple = NULL;
+				for (i=0; i < numFiles; i++)
+				{
+					if (!streams[i].merging)
+						continue;
+
+					value = buffer + es->headerSize + i * es->page_size + streams[i].slot * es->record_size;
+					if (NULL != tuple)
+					{
+						metric->num_compar++;
+						if (0 >= compareFn(tuple, value))
+							continue;
+					}
+					lowId = i;
+					tuple = value;
+				}
+				if (lowId < 0)
+					break;					/* Processed all input */
+
+				/* Add tuple to buffer */
+				metric->num_memcpys++;
+				memcpy(outputBuffer + bufferOutputPos, tuple, es->record_size);
+				bufferOutputPos += es->record_size;
+
+				/* If the buffer is full write it out */
+				if (bufferOutputPos + es->record_size > es->page_size)
+				{
+					*((int32_t*) outputBuffer) = numblocks++;											/* Block index */
+					*((int16_t*) (outputBuffer+BLOCK_COUNT_OFFSET)) = (bufferOutputPos - es->headerSize) / es->record_size;	/* Block record count */
+					if (0 != extern_sort_write_page(files[out], streams[out].endPos, outputBuffer, es, metric))
+					{
+						err = 9;
+						goto cleanup;
+					}
+					streams[out].endPos += es->page_size;
+					bufferOutputPos = es->headerSize;
+				}
+
+				if (0 != polyphase_next(&streams[lowId], files[lowId], buffer + lowId * es->page_size, es, metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+			}
+
+			/* Write out output buffer if partially full */
+			if (bufferOutputPos > es->headerSize)
+			{
+				*((int32_t*) outputBuffer) = numblocks++;												/* Block index */
+				*((int16_t*) (outputBuffer+BLOCK_COUNT_OFFSET)) = (bufferOutputPos - es->headerSize) / es->record_size;		/* Block record count */
+				if (0 != extern_sort_write_page(files[out], streams[out].endPos, outputBuffer, es, metric))
+				{
+					err = 9;
+					goto cleanup;
+				}
+				streams[out].endPos += es->page_size;
+			}
+			streams[out].runs++;
+		}
+
+		/* Emptied input stream is the next output. Previous output is read from its start. */
+		for (i=0; i < numFiles; i++)
+		{
+			if (i != out && 0 == streams[i].runs + streams[i].dummies)
+				break;
+		}
+		out = i;
+	} /* End of merge */
+
+	/* Return pointer to sorted output */
+	for (i=0; i < numFiles; i++)
+	{
+		if (streams[i].runs > 0)
+			*resultFile = i;
+	}
+
+cleanup:
+	free(target);
+	free(streams);
+	return err;
+}
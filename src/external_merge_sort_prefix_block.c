@@ -0,0 +1,525 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_prefix_block.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		File-based external merge sort of records with string keys that
+			stores keys in run blocks with their common prefix removed.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_prefix_block.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief		Prefix encoded block being filled in the buffer before it is written to the file.
+*/
+typedef struct {
+	char 		*page;
+	char 		*lastKey;			/* Key of last record added */
+	uint16_t 	pos;				/* Offset of next entry in block */
+	int16_t 	count;				/* Number of records in block */
+	int16_t 	restartInterval;	/* Records between restart points */
+	int32_t 	numblocks;			/* Blocks written to current run */
+	long 		writePos;			/* Offset in file to write next block */
+} prefix_page_writer_t;
+
+/* Key size used when sorting records in run generation (shared by all sorts, so one sort at a time) */
+static uint16_t prefixKeySize;
+
+/**
+@brief     	Compares keys of two records as unsigned bytes.
+*/
+static int8_t prefix_key_compare(void *a, void *b)
+{
+	int result = memcmp(a, b, prefixKeySize);
+	if (result < 0) return -1;
+	if (result > 0) return 1;
+	return 0;
+}
+
+/**
+@brief     	Returns the length of the common prefix of two keys given that the first start bytes are equal.
+*/
+static uint16_t prefix_common_length(char *a, char *b, uint16_t start, uint16_t keySize)
+{
+	while (start < keySize && a[start] == b[start])
+		start++;
+	return start;
+}
+
+/**
+@brief     	Returns the length of a key without its zero padding.
+*/
+static uint16_t prefix_key_length(char *key, uint16_t keySize)
+{
+	char *end = (char*) memchr(key, 0, keySize);
+	return end == NULL ? keySize : (uint16_t) (end - key);
+}
+
+/**
+@brief     	Positions a cursor before the first record of a prefix encoded block.
+@param      cursor
+                Cursor to initialize
+@param      page
+                Block in memory
+@param      es
+                Sorting state info (block size, header size)
+*/
+void extern_sort_prefix_cursor_init(prefix_cursor_t *cursor, char *page, external_sort_t *es)
+{
+	cursor->page = page;
+	cursor->pos = es->headerSize;
+	cursor->slot = 0;
+	cursor->shared = 0;
+}
+
+/**
+@brief     	Decodes the next record of a prefix encoded block. Only the suffix of
+			the key is copied, so record must hold the previously decoded record.
+@param      cursor
+                Cursor in block
+@param      record
+                Buffer of es->record_size bytes holding the previous record that is set to the next record
+@param      es
+                Sorting state info (block size, key and record size)
+@return		1 if a record was decoded, 0 if there are no more records in the block.
+*/
+int extern_sort_prefix_next(prefix_cursor_t *cursor, char *record, external_sort_t *es)
+{
+	if (cursor->slot >= *((int16_t*) (cursor->page+BLOCK_COUNT_OFFSET)))
+		return 0;
+
+	char 		*entry = cursor->page + cursor->pos;
+	uint8_t 	shared = (uint8_t) entry[0];
+	uint8_t 	suffix = (uint8_t) entry[1];
+	uint16_t 	valueSize = es->record_size - es->key_size;
+
+	memcpy(record + shared, entry + PREFIX_ENTRY_HEADER_SIZE, suffix);
+	memset(record + shared + suffix, 0, es->key_size - shared - suffix);
+	memcpy(record + es->key_size, entry + PREFIX_ENTRY_HEADER_SIZE + suffix, valueSize);
+
+	cursor->pos += PREFIX_ENTRY_HEADER_SIZE + suffix + valueSize;
+	cursor->slot++;
+	cursor->shared = shared;
+	return 1;
+}
+
+/**
+@brief     	Finds the first record in a prefix encoded block with a key greater than
+			or equal to key. Restart points are binary searched so only the records
+			after the closest restart point are decoded.
+@param      cursor
+                Cursor initialized on the block. Positioned after the record found.
+@param      record
+                Buffer of es->record_size bytes set to the record found
+@param      key
+                Search key (es->key_size bytes)
+@param      es
+                Sorting state info (block size, key and record size)
+@return		1 if a record was found, 0 if all keys in the block are smaller than key.
+*/
+int extern_sort_prefix_seek(prefix_cursor_t *cursor, char *record, void *key, external_sort_t *es)
+{
+	char 		*page = cursor->page;
+	int16_t 	count = *((int16_t*) (page+BLOCK_COUNT_OFFSET));
+	uint16_t 	interval = PREFIX_RESTART_INTERVAL(es, page);
+	int32_t 	first = 0, last, mid;
+
+	if (count <= 0)
+		return 0;
+
+	/* Find last restart point with key smaller than search key. Keys at restart points are not truncated. */
+	last = (count - 1) / interval;
+	while (first < last)
+	{
+		mid = (first + last + 1) / 2;
+		cursor->pos = PREFIX_RESTART(es, page, mid);
+		cursor->slot = mid * interval;
+		extern_sort_prefix_next(cursor, record, es);
+		if (memcmp(record, key, es->key_size) < 0)
+			first = mid;
+		else
+			last = mid - 1;
+	}
+
+	cursor->pos = PREFIX_RESTART(es, page, first);
+	cursor->slot = first * interval;
+	while (extern_sort_prefix_next(cursor, record, es))
+	{
+		if (memcmp(record, key, es->key_size) >= 0)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+@brief     	Starts a new empty prefix encoded block.
+*/
+static void prefix_page_init(prefix_page_writer_t *writer, external_sort_t *es)
+{
+	writer->pos = es->headerSize;
+	writer->count = 0;
+}
+
+/**
+@brief     	Writes the prefix encoded block to the end of the current run.
+*/
+static int prefix_page_write(ION_FILE *file, prefix_page_writer_t *writer, external_sort_t *es, metrics_t *metric)
+{
+	*((int32_t*) writer->page) = writer->numblocks++;								/* Block index */
+	*((int16_t*) (writer->page+BLOCK_COUNT_OFFSET)) = writer->count;				/* Block record count */
+	PREFIX_RESTART_INTERVAL(es, writer->page) = writer->restartInterval;
+	if (0 != extern_sort_write_page(file, writer->writePos, writer->page, es, metric))
+		return 9;
+
+	#if defined(DEBUG)
+		printf("OUTPUT Block Offset: %li  Records: %d  Bytes used: %d\n", writer->writePos, writer->count, writer->pos);
+	#endif
+	writer->writePos += es->page_size;
+	prefix_page_init(writer, es);
+	return 0;
+}
+
+/**
+@brief     	Adds a record to the prefix encoded block, writing the block out first if the record does not fit.
+			common is the length of the prefix the key shares with the last key added.
+*/
+static int prefix_page_add(ION_FILE *file, prefix_page_writer_t *writer, char *record, uint16_t common, external_sort_t *es, metrics_t *metric)
+{
+	uint16_t 	keyLength = prefix_key_length(record, es->key_size);
+	uint16_t 	valueSize = es->record_size - es->key_size;
+	uint16_t 	shared = common < keyLength ? common : keyLength;
+	uint16_t 	entrySize = PREFIX_ENTRY_HEADER_SIZE + keyLength - shared + valueSize;
+
+	/* A restart point stores the full key and adds an offset to the end of the block */
+	if (writer->count % writer->restartInterval == 0)
+		entrySize += shared;
+	if (writer->pos + entrySize + sizeof(uint16_t) * (writer->count / writer->restartInterval + 2) > es->page_size)
+	{
+		if (0 != prefix_page_write(file, writer, es, metric))
+			return 9;
+		entrySize = PREFIX_ENTRY_HEADER_SIZE + keyLength + valueSize;
+	}
+
+	char *entry = writer->page + writer->pos;
+	if (writer->count % writer->restartInterval == 0)
+	{
+		PREFIX_RESTART(es, writer->page, writer->count / writer->restartInterval) = writer->pos;
+		shared = 0;
+	}
+	entry[0] = (char) shared;
+	entry[1] = (char) (keyLength - shared);
+	memcpy(entry + PREFIX_ENTRY_HEADER_SIZE, record + shared, keyLength - shared);
+	memcpy(entry + PREFIX_ENTRY_HEADER_SIZE + keyLength - shared, record + es->key_size, valueSize);
+	memcpy(writer->lastKey, record, es->key_size);
+	writer->pos += entrySize;
+	writer->count++;
+	metric->num_memcpys++;
+	return 0;
+}
+
+/**
+@brief     	External merge sort of records with string keys that writes runs as
+			prefix encoded blocks. Each record stores the length of the key prefix
+			it shares with the previous record followed by the rest of the key and
+			the value. Every restartInterval records the full key is stored (restart
+			point) and the restart offsets are kept at the end of the block.
+			Keys are es->key_size bytes at the start of the record padded with zeros
+			and are ordered by unsigned byte comparison (as strcmp). Padding is not
+			stored. The merge tracks the prefix each run's current key shares with
+			the last output key so common prefixes are not compared again.
+			A merge pass writes its runs at the start of the file if they fit
+			before the runs being merged and otherwise after them, and the sorted
+			output is es->num_pages blocks (updated by the sort) at resultFilePtr.
+			Not reentrant as the key size is kept in a file static variable during run generation.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      restartInterval
+                Number of records between restart points in a block
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error,
+			12 if the key or record is too large to be prefix encoded.
+*/
+int extern_merge_sort_prefix_block(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	int16_t restartInterval,
+	long 	*resultFilePtr,
+	metrics_t *metric)
+{
+	printf("External merge sort iterator version with prefix encoded string keys.\n");
+
+	prefix_page_writer_t writer;
+	long 		*runOffset = NULL, *mergeOffset = NULL;
+	int32_t 	*runCount = NULL, *mergeCount = NULL;
+	uint16_t 	*common = NULL;
+	prefix_cursor_t *cursor = NULL;
+	char 		*heads = NULL;
+	int32_t 	capacity = 0, numSublist = 0, numRecords, i;
+	uint32_t 	totalRecords = 0;
+	int32_t 	maxRecords = (bufferSizeInBlocks - 1) * es->page_size / es->record_size;
+	int32_t 	recordsPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int 		done = 0, err = 0;
+	char 		*tuple;
+
+	if (es->key_size > PREFIX_MAX_KEY_SIZE || restartInterval <= 0
+		|| es->headerSize + PREFIX_ENTRY_HEADER_SIZE + es->record_size + 2 * sizeof(uint16_t) > es->page_size)
+		return 12;
+
+	/* Last page of buffer is used to build output blocks */
+	writer.page = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+	writer.lastKey = (char*) calloc(1, es->key_size);
+	writer.restartInterval = restartInterval;
+	writer.writePos = 0;
+	if (NULL == writer.lastKey)
+		return 8;
+	prefixKeySize = es->key_size;
+
+	/* Create initial sorted sublists by sorting the records that fit in the rest of the buffer */
+	do
+	{
+		for (numRecords = 0; numRecords < maxRecords; numRecords++)
+		{
+			if (0 == iterator(iteratorState, buffer + numRecords * es->record_size))
+			{
+				done = 1;
+				break;
+			}
+		}
+		if (numRecords == 0)
+			break;
+		metric->num_reads += (numRecords + recordsPerPage - 1) / recordsPerPage;
+		totalRecords += numRecords;
+
+		in_memory_sort(buffer, (uint32_t) numRecords, es->record_size, prefix_key_compare, 1);
+
+		/* Write run as prefix encoded blocks */
+		long runStart = writer.writePos;
+		writer.numblocks = 0;
+		prefix_page_init(&writer, es);
+		memset(writer.lastKey, 0, es->key_size);
+		for (i=0; i < numRecords; i++)
+		{
+			tuple = buffer + i * es->record_size;
+			err = prefix_page_add(file, &writer, tuple, prefix_common_length(tuple, writer.lastKey, 0, es->key_size), es, metric);
+			if (err)
+				goto cleanup;
+		}
+		err = prefix_page_write(file, &writer, es, metric);
+		if (err)
+			goto cleanup;
+
+		err = extern_sort_add_run(&runOffset, &runCount, &capacity, numSublist++, runStart, writer.numblocks);
+		if (err)
+			goto cleanup;
+	} while (!done);
+
+	*resultFilePtr = 0;
+	es->num_pages = 0;
+	if (numSublist == 0)
+		goto cleanup;
+
+	/* Merge phase: combine M-1 sublists at a time */
+	int8_t 		maxSublistsInRun = bufferSizeInBlocks - 1;
+	int8_t 		subListsInRun;
+	int32_t 	numRuns, run, lowId, numblocks;
+	int32_t 	minRecords = (es->page_size - es->headerSize - sizeof(uint16_t)) / (PREFIX_ENTRY_HEADER_SIZE + es->record_size + sizeof(uint16_t));
+	char 		*addr;
+	uint16_t 	length;
+
+	cursor = (prefix_cursor_t*) malloc(sizeof(prefix_cursor_t) * maxSublistsInRun);	/* Position in current block of runs being merged */
+	heads = (char*) malloc(es->record_size * maxSublistsInRun);							/* Decoded current record of runs being merged */
+	common = (uint16_t*) malloc(sizeof(uint16_t) * maxSublistsInRun);					/* Prefix current key shares with last output key */
+	mergeOffset = (long*) malloc(sizeof(long) * maxSublistsInRun);						/* Offset of current block of runs being merged */
+	mergeCount = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);				/* Blocks left in runs being merged */
+	if (NULL == cursor || NULL == heads || NULL == common || NULL == mergeOffset || NULL == mergeCount)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	while (numSublist > 1)
+	{
+		/* Every block but the last of a run holds at least minRecords records stored with full keys and a restart offset each */
+		numRuns = (numSublist + maxSublistsInRun - 1) / maxSublistsInRun;
+		numblocks = numRuns + totalRecords / minRecords;
+		writer.writePos = extern_sort_run_write_pos(runOffset, runCount, numSublist, numblocks, es);
+		numRuns = 0;
+		for (run = 0; run < numSublist; run += subListsInRun)
+		{
+			subListsInRun = (numSublist - run) < maxSublistsInRun ? (numSublist - run) : maxSublistsInRun;
+
+			long runStart = writer.writePos;
+			writer.numblocks = 0;
+			prefix_page_init(&writer, es);
+			memset(writer.lastKey, 0, es->key_size);
+
+			/* Fill the buffers with one block from each run being merged and decode first record */
+			for (i=0; i < subListsInRun; i++)
+			{
+				mergeOffset[i] = runOffset[run+i];
+				mergeCount[i] = runCount[run+i];
+				addr = buffer + i * es->page_size;
+				if (0 != extern_sort_read_page(file, mergeOffset[i], addr, es, metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+				extern_sort_prefix_cursor_init(&cursor[i], addr, es);
+				extern_sort_prefix_next(&cursor[i], heads + i * es->record_size, es);
+				common[i] = prefix_common_length(heads + i * es->record_size, writer.lastKey, 0, es->key_size);
+			}
+
+			/* Continually find lowest record in the runs and add to output block */
+			while (1)
+			{
+				i = 0;
+				while (i < subListsInRun && mergeCount[i] == 0)
+					i++;
+				if (i == subListsInRun)
+					break;					/* Processed all input */
+				lowId = i;
+				tuple = heads + i * es->record_size;
+				for (i++; i < subListsInRun; i++)
+				{
+					if (0 == mergeCount[i])
+						continue;			/* Run has been completely used */
+
+					/* All keys are at least the last output key, so the key sharing a longer prefix with it is smaller */
+					if (common[i] > common[lowId])
+					{
+						lowId = i;
+						tuple = heads + i * es->record_size;
+					}
+					else if (common[i] == common[lowId])
+					{
+						addr = heads + i * es->record_size;
+						length = prefix_common_length(addr, tuple, common[lowId], es->key_size);
+						metric->num_compar++;
+						if (length < es->key_size && (uint8_t) addr[length] < (uint8_t) tuple[length])
+						{
+							lowId = i;
+							tuple = addr;
+						}
+					}
+				}
+
+				/* Prefix shared with the new last output key only changes for keys that matched its whole shared prefix */
+				for (i=0; i < subListsInRun; i++)
+				{
+					if (i != lowId && mergeCount[i] != 0 && common[i] == common[lowId])
+						common[i] = prefix_common_length(heads + i * es->record_size, tuple, common[lowId], es->key_size);
+				}
+
+				err = prefix_page_add(file, &writer, tuple, common[lowId], es, metric);
+				if (err)
+					goto cleanup;
+
+				/* Decode next record of run. It shares at least its stored prefix with the record just output. */
+				if (0 == extern_sort_prefix_next(&cursor[lowId], tuple, es))
+				{
+					mergeOffset[lowId] += es->page_size;
+					mergeCount[lowId]--;
+
+					if (mergeCount[lowId] > 0)
+					{
+						addr = buffer + lowId * es->page_size;
+						if (0 != extern_sort_read_page(file, mergeOffset[lowId], addr, es, metric))
+						{
+							err = 10;
+							goto cleanup;
+						}
+						extern_sort_prefix_cursor_init(&cursor[lowId], addr, es);
+						extern_sort_prefix_next(&cursor[lowId], tuple, es);
+					}
+				}
+				if (mergeCount[lowId] > 0)
+					common[lowId] = prefix_common_length(tuple, writer.lastKey, cursor[lowId].shared, es->key_size);
+			}
+
+			/* Write out partially full output block */
+			if (writer.count > 0)
+			{
+				err = prefix_page_write(file, &writer, es, metric);
+				if (err)
+					goto cleanup;
+			}
+
+			/* Output run replaces directory entry of a consumed run */
+			runOffset[numRuns] = runStart;
+			runCount[numRuns] = writer.numblocks;
+			numRuns++;
+		}
+		numSublist = numRuns;
+	} /* End of merge */
+
+	/* Return pointer to sorted output */
+	*resultFilePtr = runOffset[0];
+	es->num_pages = runCount[0];
+	err = extern_sort_flush_pages(es, metric);
+
+cleanup:
+	free(mergeCount);
+	free(mergeOffset);
+	free(common);
+	free(heads);
+	free(cursor);
+	free(runCount);
+	free(runOffset);
+	free(writer.lastKey);
+	return err;
+}
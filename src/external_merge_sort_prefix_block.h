@@ -0,0 +1,160 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_prefix_block.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		This file contains declarations for external merge sort of
+			string keys with prefix encoded blocks.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/* Largest key that can be prefix encoded (shared and suffix lengths are one byte) */
+#define    PREFIX_MAX_KEY_SIZE          255
+#define    PREFIX_ENTRY_HEADER_SIZE     (2*sizeof(uint8_t))
+
+/* Restart interval is stored in the last two bytes of a block with restart offsets before it */
+#define    PREFIX_RESTART_INTERVAL(es, page)    (*((uint16_t*) ((page) + (es)->page_size - sizeof(uint16_t))))
+#define    PREFIX_RESTART(es, page, i)          (*((uint16_t*) ((page) + (es)->page_size - sizeof(uint16_t) * ((i) + 2))))
+
+/**
+@brief		Position of a reader in a prefix encoded block.
+*/
+typedef struct {
+	char 		*page;			/* Block in memory */
+	uint16_t 	pos;			/* Offset of next entry in block */
+	int16_t 	slot;			/* Number of next record in block */
+	uint8_t 	shared;			/* Key prefix length last decoded record shares with the record before it */
+} prefix_cursor_t;
+
+/**
+@brief     	Positions a cursor before the first record of a prefix encoded block.
+@param      cursor
+                Cursor to initialize
+@param      page
+                Block in memory
+@param      es
+                Sorting state info (block size, header size)
+*/
+void extern_sort_prefix_cursor_init(prefix_cursor_t *cursor, char *page, external_sort_t *es);
+
+/**
+@brief     	Decodes the next record of a prefix encoded block. Only the suffix of
+			the key is copied, so record must hold the previously decoded record.
+@param      cursor
+                Cursor in block
+@param      record
+                Buffer of es->record_size bytes holding the previous record that is set to the next record
+@param      es
+                Sorting state info (block size, key and record size)
+@return		1 if a record was decoded, 0 if there are no more records in the block.
+*/
+int extern_sort_prefix_next(prefix_cursor_t *cursor, char *record, external_sort_t *es);
+
+/**
+@brief     	Finds the first record in a prefix encoded block with a key greater than
+			or equal to key. Restart points are binary searched so only the records
+			after the closest restart point are decoded.
+@param      cursor
+                Cursor initialized on the block. Positioned after the record found.
+@param      record
+                Buffer of es->record_size bytes set to the record found
+@param      key
+                Search key (es->key_size bytes)
+@param      es
+                Sorting state info (block size, key and record size)
+@return		1 if a record was found, 0 if all keys in the block are smaller than key.
+*/
+int extern_sort_prefix_seek(prefix_cursor_t *cursor, char *record, void *key, external_sort_t *es);
+
+/**
+@brief     	External merge sort of records with string keys that writes runs as
+			prefix encoded blocks. Each record stores the length of the key prefix
+			it shares with the previous record followed by the rest of the key and
+			the value. Every restartInterval records the full key is stored (restart
+			point) and the restart offsets are kept at the end of the block.
+			Keys are es->key_size bytes at the start of the record padded with zeros
+			and are ordered by unsigned byte comparison (as strcmp). Padding is not
+			stored. The merge tracks the prefix each run's current key shares with
+			the last output key so common prefixes are not compared again.
+			A merge pass writes its runs at the start of the file if they fit
+			before the runs being merged and otherwise after them, and the sorted
+			output is es->num_pages blocks (updated by the sort) at resultFilePtr.
+			The sort is not reentrant: run generation keeps the key size in a file
+			static variable, so only one prefix encoded sort may run at a time.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      restartInterval
+                Number of records between restart points in a block
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error,
+			12 if the key or record is too large to be prefix encoded.
+*/
+int extern_merge_sort_prefix_block(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	int16_t restartInterval,
+	long 	*resultFilePtr,
+	metrics_t *metric);
+
+#if defined(__cplusplus)
+}
+#endif
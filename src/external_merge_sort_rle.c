@@ -0,0 +1,364 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_rle.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		File-based external merge sort for input with many duplicates
+			using 3-way partitioning and runs of (repeat count, record) entries.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_rle.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/* Record comparison function and record size used by rle_record_compare() */
+static int8_t (*rleCompareFn)(void *a, void *b);
+static uint16_t rleRecordSize;
+
+/**
+@brief     	Compares records by the sort key and then by all their bytes so exact
+			duplicates are next to each other in sorted order.
+*/
+static int8_t rle_record_compare(void *a, void *b)
+{
+	int8_t 	result = rleCompareFn(a, b);
+	if (result != 0)
+		return result;
+
+	int cmp = memcmp(a, b, rleRecordSize);
+	if (cmp < 0) return -1;
+	if (cmp > 0) return 1;
+	return 0;
+}
+
+/**
+@brief     	Adds repeat copies of a record. An encoded run adds them to the last entry
+			of the block if it holds the same record, or else adds one entry. A run of
+			records adds each copy, writing out blocks as they fill.
+*/
+static int rle_page_add(ION_FILE *file, sort_page_writer_t *writer, char *record, uint16_t repeat, external_sort_t *es, metrics_t *metric)
+{
+	char 	*entry;
+
+	int8_t 	encoded = writer->entrySize > es->record_size;		/* Entries are (repeat count, record) */
+
+	if (encoded && writer->count > 0)
+	{
+		entry = writer->page + es->headerSize + (writer->count - 1) * writer->entrySize;
+		if ((uint32_t) *((uint16_t*) entry) + repeat <= RLE_MAX_REPEAT
+			&& 0 == memcmp(entry + RLE_ENTRY_HEADER_SIZE, record, es->record_size))
+		{
+			*((uint16_t*) entry) += repeat;
+			return 0;
+		}
+	}
+
+	do
+	{
+		entry = extern_sort_writer_next(file, writer, es, metric);
+		if (NULL == entry)
+			return 9;
+
+		if (encoded)
+		{
+			*((uint16_t*) entry) = repeat;
+			entry += RLE_ENTRY_HEADER_SIZE;
+			repeat = 1;
+		}
+		memcpy(entry, record, es->record_size);
+		metric->num_memcpys++;
+	} while (--repeat > 0);
+	return 0;
+}
+
+/**
+@brief     	External merge sort for input with many duplicate records. Run generation
+			sorts the records that fit in the buffer with 3-way partitioning so
+			records with equal keys are partitioned once. Records with equal keys are
+			ordered by all their bytes so exact duplicates are together, and each run
+			stores one entry (repeat count, record) for every group of exact
+			duplicates. The merge compares and moves an entry once for all its
+			copies and adds the counts of equal entries from different runs. The
+			last merge pass writes each record repeat count times. A merge pass
+			writes its runs at the start of the file if they fit before the runs
+			being merged and otherwise after them, so file space is reused. The
+			sorted output is es->num_pages blocks (updated by the sort) at
+			resultFilePtr.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 3)
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory or buffer is too small, 9 on write error,
+			10 on read error, 12 if an entry does not fit in a block.
+*/
+int extern_merge_sort_rle(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	printf("External merge sort iterator version with run-length encoded duplicates.\n");
+
+	sort_page_writer_t writer;
+	long 		*runOffset = NULL, *mergeOffset = NULL;
+	int32_t 	*runCount = NULL, *mergeCount = NULL;
+	int16_t 	*slot = NULL;
+	int32_t 	capacity = 0, numSublist = 0, numRecords, i;
+	uint32_t 	totalRecords = 0;
+	int32_t 	maxRecords = (bufferSizeInBlocks - 1) * es->page_size / es->record_size;
+	int32_t 	recordsPerPage = (es->page_size - es->headerSize) / es->record_size;
+	uint16_t 	entrySize = es->record_size + RLE_ENTRY_HEADER_SIZE;
+	int 		done = 0, err = 0;
+	char 		*next = NULL;			/* Record read after a full buffer */
+	char 		*tuple;
+
+	if (bufferSizeInBlocks < 3)
+		return 8;
+	if (es->headerSize + entrySize > es->page_size)
+		return 12;
+
+	/* Last page of buffer is used to build output blocks */
+	writer.page = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+	writer.writePos = 0;
+	rleCompareFn = compareFn;
+	rleRecordSize = es->record_size;
+
+	next = (char*) malloc(es->record_size);
+	if (NULL == next)
+		return 8;
+
+	/* Create initial sorted sublists by sorting the records that fit in the rest of the buffer */
+	do
+	{
+		numRecords = 0;
+		if (done == 0 && numSublist > 0)
+		{
+			memcpy(buffer, next, es->record_size);
+			numRecords = 1;
+		}
+		for (; numRecords < maxRecords; numRecords++)
+		{
+			if (0 == iterator(iteratorState, buffer + numRecords * es->record_size))
+			{
+				done = 1;
+				break;
+			}
+		}
+		if (numRecords == 0)
+			break;
+
+		/* Read one record past a full buffer so it is known if this is the only run before it is written */
+		if (!done && 0 == iterator(iteratorState, next))
+			done = 1;
+		metric->num_reads += (numRecords + recordsPerPage - 1) / recordsPerPage;
+		totalRecords += numRecords;
+
+		if (0 != in_memory_sort(buffer, (uint32_t) numRecords, es->record_size, rle_record_compare, IN_MEMORY_QUICK_SORT_3WAY))
+		{
+			err = 8;
+			goto cleanup;
+		}
+
+		/* Write run with exact duplicates as one entry. A single run is the sorted output. */
+		long runStart = writer.writePos;
+		extern_sort_writer_init(&writer, (done && numSublist == 0) ? es->record_size : entrySize, es);
+		for (i=0; i < numRecords; i++)
+		{
+			err = rle_page_add(file, &writer, buffer + i * es->record_size, 1, es, metric);
+			if (err)
+				goto cleanup;
+		}
+		err = extern_sort_writer_flush(file, &writer, es, metric);
+		if (err)
+			goto cleanup;
+
+		err = extern_sort_add_run(&runOffset, &runCount, &capacity, numSublist++, runStart, writer.numblocks);
+		if (err)
+			goto cleanup;
+	} while (!done);
+
+	*resultFilePtr = 0;
+	es->num_pages = 0;
+	if (numSublist == 0)
+		goto cleanup;
+
+	/* Merge phase: combine M-1 sublists at a time */
+	int32_t 	maxSublistsInRun = bufferSizeInBlocks - 1;
+	int32_t 	subListsInRun;
+	int32_t 	numRuns, run, lowId, numblocks;
+	char 		*addr;
+
+	slot = (int16_t*) malloc(sizeof(int16_t) * maxSublistsInRun);						/* Current entry in block of runs being merged */
+	mergeOffset = (long*) malloc(sizeof(long) * maxSublistsInRun);						/* Offset of current block of runs being merged */
+	mergeCount = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);				/* Blocks left in runs being merged */
+	if (NULL == slot || NULL == mergeOffset || NULL == mergeCount)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	while (numSublist > 1)
+	{
+		/* Encoded output of a pass is no larger than the runs it merges (a last run with nothing to merge with is not written). The last pass writes every record. */
+		numRuns = (numSublist % maxSublistsInRun == 1) ? numSublist - 1 : numSublist;
+		if (numSublist <= maxSublistsInRun)
+			numblocks = (totalRecords + recordsPerPage - 1) / recordsPerPage;
+		else
+			for (numblocks = 0, i = 0; i < numRuns; i++)
+				numblocks += runCount[i];
+		writer.writePos = extern_sort_run_write_pos(runOffset, runCount, numSublist, numblocks, es);
+		numRuns = 0;
+		for (run = 0; run < numSublist; run += subListsInRun)
+		{
+			subListsInRun = (numSublist - run) < maxSublistsInRun ? (numSublist - run) : maxSublistsInRun;
+			if (subListsInRun == 1)
+			{
+				/* Last run of pass has nothing to merge with and stays encoded */
+				runOffset[numRuns] = runOffset[run];
+				runCount[numRuns] = runCount[run];
+				numRuns++;
+				continue;
+			}
+
+			long runStart = writer.writePos;
+			extern_sort_writer_init(&writer, (subListsInRun < numSublist) ? entrySize : es->record_size, es);
+
+			/* Fill the buffers with one block from each run being merged */
+			for (i=0; i < subListsInRun; i++)
+			{
+				mergeOffset[i] = runOffset[run+i];
+				mergeCount[i] = runCount[run+i];
+				slot[i] = 0;
+				if (0 != extern_sort_read_page(file, mergeOffset[i], buffer + i * es->page_size, es, metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+			}
+
+			/* Continually find lowest entry in the runs and add its copies to output block */
+			while (1)
+			{
+				lowId = -1;
+				for (i=0; i < subListsInRun; i++)
+				{
+					if (0 == mergeCount[i])
+						continue;			/* Run has been completely used */
+
+					addr = buffer + i * es->page_size + es->headerSize + slot[i] * entrySize + RLE_ENTRY_HEADER_SIZE;
+					if (lowId >= 0)
+					{
+						metric->num_compar++;
+						if (0 <= rle_record_compare(addr, tuple))
+							continue;
+					}
+					lowId = i;
+					tuple = addr;
+				}
+				if (lowId < 0)
+					break;					/* Processed all input */
+
+				err = rle_page_add(file, &writer, tuple, *((uint16_t*) (tuple - RLE_ENTRY_HEADER_SIZE)), es, metric);
+				if (err)
+					goto cleanup;
+
+				/* Move to next entry of run reading its next block when the block is done */
+				addr = buffer + lowId * es->page_size;
+				if (++slot[lowId] >= *((int16_t*) (addr+BLOCK_COUNT_OFFSET)))
+				{
+					mergeOffset[lowId] += es->page_size;
+					mergeCount[lowId]--;
+					slot[lowId] = 0;
+					if (mergeCount[lowId] > 0 && 0 != extern_sort_read_page(file, mergeOffset[lowId], addr, es, metric))
+					{
+						err = 10;
+						goto cleanup;
+					}
+				}
+			}
+
+			/* Write out partially full output block */
+			if (writer.count > 0)
+			{
+				err = extern_sort_writer_flush(file, &writer, es, metric);
+				if (err)
+					goto cleanup;
+			}
+
+			/* Output run replaces directory entry of a consumed run */
+			runOffset[numRuns] = runStart;
+			runCount[numRuns] = writer.numblocks;
+			numRuns++;
+		}
+		numSublist = numRuns;
+	} /* End of merge */
+
+	/* Return pointer to sorted output */
+	*resultFilePtr = runOffset[0];
+	es->num_pages = runCount[0];
+	err = extern_sort_flush_pages(es, metric);
+
+cleanup:
+	free(next);
+	free(mergeCount);
+	free(mergeOffset);
+	free(slot);
+	free(runCount);
+	free(runOffset);
+	return err;
+}
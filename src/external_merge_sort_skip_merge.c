@@ -0,0 +1,583 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_skip_merge.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		External merge sort that concatenates key-disjoint runs instead of merging them.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_skip_merge.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief		Run directory. Each run is stored in consecutive blocks and has its
+			smallest and largest record. Runs are linked into chains of key-disjoint
+			runs for each merge step.
+*/
+typedef struct {
+	long 		*offset;			/* Offset of first block of run */
+	int32_t 	*blocks;			/* Number of blocks in run (-1 if run has been merged) */
+	int32_t 	*records;			/* Number of records in run */
+	int32_t 	*next;				/* Next run in chain (-1 at end of chain) */
+	char 		*bounds;			/* Smallest and largest record of each run */
+	int32_t 	count;
+	int32_t 	capacity;
+} skip_directory_t;
+
+/**
+@brief		Block being written by a merge.
+*/
+typedef struct {
+	char 		*page;				/* Output block */
+	size_t 		pos;				/* Next record position in block */
+	long 		startPos;			/* Offset of first block of output run */
+	long 		writePos;			/* Offset of next block */
+	int32_t 	blocks;				/* Blocks written to output run */
+	int32_t 	records;			/* Records written to output run */
+} skip_output_t;
+
+/**
+@brief     	Returns the smallest record of a run.
+*/
+static char* skip_min(skip_directory_t *dir, int32_t run, external_sort_t *es)
+{
+	return dir->bounds + (size_t) run * 2 * es->record_size;
+}
+
+/**
+@brief     	Returns the largest record of a run.
+*/
+static char* skip_max(skip_directory_t *dir, int32_t run, external_sort_t *es)
+{
+	return dir->bounds + ((size_t) run * 2 + 1) * es->record_size;
+}
+
+/**
+@brief     	Adds a run to the run directory.
+@return		0 on success, 8 if out of memory.
+*/
+static int skip_add_run(skip_directory_t *dir, long offset, int32_t blocks, int32_t records, void *min, void *max, external_sort_t *es)
+{
+	if (dir->count == dir->capacity)
+	{
+		int32_t capacity = (dir->capacity == 0) ? 8 : dir->capacity * 2;
+		long *offsets = (long*) realloc(dir->offset, sizeof(long) * capacity);
+		if (NULL != offsets)
+			dir->offset = offsets;
+		int32_t *counts = (int32_t*) realloc(dir->blocks, sizeof(int32_t) * capacity);
+		if (NULL != counts)
+			dir->blocks = counts;
+		int32_t *sizes = (int32_t*) realloc(dir->records, sizeof(int32_t) * capacity);
+		if (NULL != sizes)
+			dir->records = sizes;
+		int32_t *links = (int32_t*) realloc(dir->next, sizeof(int32_t) * capacity);
+		if (NULL != links)
+			dir->next = links;
+		char *bounds = (char*) realloc(dir->bounds, (size_t) capacity * 2 * es->record_size);
+		if (NULL != bounds)
+			dir->bounds = bounds;
+		if (NULL == offsets || NULL == counts || NULL == sizes || NULL == links || NULL == bounds)
+			return 8;
+		dir->capacity = capacity;
+	}
+	dir->offset[dir->count] = offset;
+	dir->blocks[dir->count] = blocks;
+	dir->records[dir->count] = records;
+	dir->next[dir->count] = -1;
+	memcpy(skip_min(dir, dir->count, es), min, es->record_size);
+	memcpy(skip_max(dir, dir->count, es), max, es->record_size);
+	dir->count++;
+	return 0;
+}
+
+/**
+@brief     	Writes the output block if it has records.
+*/
+static int skip_flush(skip_output_t *out, ION_FILE *file, external_sort_t *es, metrics_t *metric)
+{
+	if (out->pos == (size_t) es->headerSize)
+		return 0;
+
+	*((int32_t*) out->page) = out->blocks++;												/* Block index */
+	*((int16_t*) (out->page+BLOCK_COUNT_OFFSET)) = (out->pos - es->headerSize) / es->record_size;	/* Block record count */
+	if (0 != extern_sort_write_page(file, out->writePos, out->page, es, metric))
+		return 9;
+	out->writePos += es->page_size;
+	out->pos = es->headerSize;
+	return 0;
+}
+
+/**
+@brief     	Merges chains of runs into the output. Each chain is read in order as
+			one run. When a single chain is left and the output block is empty,
+			full blocks are written as they are read without copying records.
+@param      first
+                First run of each chain
+@param      numChains
+                Number of chains (at most bufferSizeInBlocks-1)
+@return		0 on success, 9 on write error, 10 on read error.
+*/
+static int skip_merge(
+	skip_directory_t *dir,
+	int32_t *first,
+	int32_t numChains,
+	int32_t *curRun,
+	int32_t *curBlock,
+	int32_t *sublsTuplePos,
+	char 	*buffer,
+	skip_output_t *out,
+	ION_FILE *file,
+	external_sort_t *es,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int32_t 	i, lowId, active = numChains;
+	char 		*page;
+	void 		*tuple, *value;
+
+	/* Read the first block of each chain */
+	for (i=0; i < numChains; i++)
+	{
+		curRun[i] = first[i];
+		curBlock[i] = 0;
+		sublsTuplePos[i] = 0;
+		if (0 != extern_sort_read_page(file, dir->offset[first[i]], buffer + i * es->page_size, es, metric))
+			return 10;
+	}
+
+	while (active > 0)
+	{
+		/* Find smallest record */
+		lowId = -1;
+		tuple = NULL;
+		for (i=0; i < numChains; i++)
+		{
+			if (curRun[i] < 0)
+				continue;			/* Chain has been completely used */
+
+			value = buffer + es->headerSize + i * es->page_size + sublsTuplePos[i] * es->record_size;
+			if (NULL != tuple)
+			{
+				metric->num_compar++;
+				if (0 >= compareFn(tuple, value))
+					continue;
+			}
+			lowId = i;
+			tuple = value;
+		}
+
+		page = buffer + lowId * es->page_size;
+		if (active == 1 && out->pos == (size_t) es->headerSize && sublsTuplePos[lowId] == 0 && *((int16_t*) (page+BLOCK_COUNT_OFFSET)) == tuplesPerPage)
+		{
+			/* Only chain left and output is at a block boundary: write the full input block as the output block */
+			*((int32_t*) page) = out->blocks++;											/* Block index */
+			if (0 != extern_sort_write_page(file, out->writePos, page, es, metric))
+				return 9;
+			out->writePos += es->page_size;
+			out->records += tuplesPerPage;
+			sublsTuplePos[lowId] = tuplesPerPage;
+		}
+		else
+		{
+			/* Add tuple to buffer */
+			metric->num_memcpys++;
+			memcpy(out->page + out->pos, tuple, es->record_size);
+			out->pos += es->record_size;
+			out->records++;
+			if (out->pos + es->record_size > es->page_size && 0 != skip_flush(out, file, es, metric))
+				return 9;
+			sublsTuplePos[lowId]++;
+		}
+
+		/* Move to next record of chain. At the end of a run continue with next run in chain. */
+		if (sublsTuplePos[lowId] >= *((int16_t*) (page+BLOCK_COUNT_OFFSET)))
+		{
+			sublsTuplePos[lowId] = 0;
+			curBlock[lowId]++;
+			if (curBlock[lowId] >= dir->blocks[curRun[lowId]])
+			{
+				curRun[lowId] = dir->next[curRun[lowId]];
+				curBlock[lowId] = 0;
+			}
+			if (curRun[lowId] < 0)
+				active--;
+			else if (0 != extern_sort_read_page(file, dir->offset[curRun[lowId]] + (long) curBlock[lowId] * es->page_size, page, es, metric))
+				return 10;
+		}
+	}
+	return 0;
+}
+
+/**
+@brief     	External merge sort with input iterator that skips merging runs with
+			key ranges that do not overlap.
+@details	Run generation records the smallest and largest record of each run.
+			Before each merge pass the runs are ordered by smallest record and
+			split into clusters of runs with overlapping key ranges. Within a
+			cluster, runs are linked into chains of key-disjoint runs (each run
+			is added to the chain whose largest record is closest below its
+			smallest record) and a chain is read as one run. A merge step merges
+			chains, so its fan-in is the overlap depth rather than the number of
+			runs. Clusters with one chain are never merged and clusters with more
+			chains than fit in the buffer are merged in groups of chains. When
+			every cluster fits in one merge step the final pass writes the clusters
+			in order. Runs with no overlap are copied a block at a time when the
+			output is at a block boundary. If the whole input is one chain of
+			consecutive full runs (such as time-ordered data) no merge pass is done.
+			Merge output is written after the end of the used file space.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 3)
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error.
+*/
+int extern_merge_sort_skip_merge(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	printf("External merge sort iterator version with skip merge of key-disjoint runs.\n");
+
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int32_t 	numRecordsRead, numRuns, numChains, numClusters, maxChains;
+	int32_t 	i, j, c, run, best;
+	long 		fileEnd = 0;
+	int 		status = 1, err = 0;
+	char 		*addr, *clusterMax = NULL;
+	skip_directory_t dir = { NULL, NULL, NULL, NULL, NULL, 0, 0 };
+	skip_output_t 	out;
+
+	int32_t 	*order = NULL;				/* Runs ordered by smallest record */
+	int32_t 	*chainFirst = NULL;			/* First run of each chain */
+	int32_t 	*chainLast = NULL;			/* Last run of each chain */
+	int32_t 	*clusterStart = NULL;		/* First chain of each cluster */
+	int32_t 	*curRun = (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);
+	int32_t 	*curBlock = (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);
+	int32_t 	*sublsTuplePos = (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);
+
+	*resultFilePtr = 0;
+	if (NULL == curRun || NULL == curBlock || NULL == sublsTuplePos || bufferSizeInBlocks < 3)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	/* Create initial sorted sublists (size of M) and record their smallest and largest records */
+	while (status == 1)
+	{
+		numRecordsRead = 0;
+		addr = buffer+es->headerSize;
+		while (numRecordsRead < bufferSizeInBlocks * tuplesPerPage)
+		{
+			status = iterator(iteratorState, addr);
+			if (status == 0)
+				break;
+
+			numRecordsRead++;
+			addr += es->record_size;					/* Read a record. Advance to next record location in buffer. */
+		}
+		if (numRecordsRead == 0)
+			break;
+
+		int pageio = (numRecordsRead + tuplesPerPage - 1) / tuplesPerPage;
+		metric->num_reads += pageio;
+
+		in_memory_sort(buffer+es->headerSize, (uint32_t)numRecordsRead, es->record_size, compareFn, 1);
+
+		err = skip_add_run(&dir, fileEnd, pageio, numRecordsRead, buffer+es->headerSize, buffer+es->headerSize + (size_t) (numRecordsRead-1) * es->record_size, es);
+		if (0 != err)
+			goto cleanup;
+
+		for (i=0; i < pageio; i++)
+		{
+			/* Header of block overwrites tail of previous block which has already been written */
+			addr = buffer + i * es->record_size * tuplesPerPage;
+			*((int32_t*) addr) = i;																		/* Block index */
+			*((int16_t*) (addr+BLOCK_COUNT_OFFSET)) = (i < pageio-1) ? tuplesPerPage : numRecordsRead - tuplesPerPage * i;	/* Block record count */
+
+			if (0 != extern_sort_write_page(file, fileEnd, addr, es, metric))
+			{
+				err = 9;
+				goto cleanup;
+			}
+			fileEnd += es->page_size;
+		}
+	}
+	if (dir.count == 0)
+		goto cleanup;
+
+	out.page = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+	while (1)
+	{
+		numRuns = dir.count;
+		free(order);
+		free(chainFirst);
+		free(chainLast);
+		free(clusterStart);
+		order = (int32_t*) malloc(sizeof(int32_t) * numRuns);
+		chainFirst = (int32_t*) malloc(sizeof(int32_t) * numRuns);
+		chainLast = (int32_t*) malloc(sizeof(int32_t) * numRuns);
+		clusterStart = (int32_t*) malloc(sizeof(int32_t) * (numRuns + 1));
+		if (NULL == order || NULL == chainFirst || NULL == chainLast || NULL == clusterStart)
+		{
+			err = 8;
+			goto cleanup;
+		}
+
+		/* Order runs by smallest record (binary insertion sort) */
+		for (run = 0; run < numRuns; run++)
+		{
+			int32_t low = 0, high = run;
+			while (low < high)
+			{
+				int32_t mid = (low + high) / 2;
+				metric->num_compar++;
+				if (compareFn(skip_min(&dir, order[mid], es), skip_min(&dir, run, es)) <= 0)
+					low = mid + 1;
+				else
+					high = mid;
+			}
+			memmove(order + low + 1, order + low, sizeof(int32_t) * (run - low));
+			order[low] = run;
+		}
+
+		/* Split into clusters of overlapping runs and link the runs of each cluster into chains of disjoint runs */
+		numChains = 0;
+		numClusters = 0;
+		maxChains = 0;
+		for (i = 0; i < numRuns; i++)
+		{
+			run = order[i];
+			dir.next[run] = -1;
+			if (i > 0)
+				metric->num_compar++;
+			if (i == 0 || compareFn(skip_min(&dir, run, es), clusterMax) >= 0)
+			{
+				/* Run starts after all previous runs end */
+				clusterStart[numClusters++] = numChains;
+				clusterMax = skip_max(&dir, run, es);
+			}
+			else
+			{
+				metric->num_compar++;
+				if (compareFn(skip_max(&dir, run, es), clusterMax) > 0)
+					clusterMax = skip_max(&dir, run, es);
+			}
+
+			/* Find chain of cluster ending closest below start of run */
+			best = -1;
+			for (c = clusterStart[numClusters-1]; c < numChains; c++)
+			{
+				metric->num_compar++;
+				if (compareFn(skip_max(&dir, chainLast[c], es), skip_min(&dir, run, es)) > 0)
+					continue;
+				if (best >= 0)
+				{
+					metric->num_compar++;
+					if (compareFn(skip_max(&dir, chainLast[c], es), skip_max(&dir, chainLast[best], es)) <= 0)
+						continue;
+				}
+				best = c;
+			}
+			if (best < 0)
+			{
+				chainFirst[numChains] = run;
+				chainLast[numChains] = run;
+				numChains++;
+			}
+			else
+			{
+				dir.next[chainLast[best]] = run;
+				chainLast[best] = run;
+			}
+		}
+		clusterStart[numClusters] = numChains;
+		for (c = 0; c < numClusters; c++)
+		{
+			if (clusterStart[c+1] - clusterStart[c] > maxChains)
+				maxChains = clusterStart[c+1] - clusterStart[c];
+		}
+
+		#if defined(DEBUG)
+			printf("Runs: %li Clusters: %li Chains: %li Most chains in a cluster: %li\n", (long) numRuns, (long) numClusters, (long) numChains, (long) maxChains);
+		#endif
+
+		if (maxChains <= bufferSizeInBlocks - 1)
+			break;
+
+		/* Merge clusters with too many chains in groups of chains. Other clusters are kept for the final pass. */
+		for (c = 0; c < numClusters; c++)
+		{
+			int32_t chains = clusterStart[c+1] - clusterStart[c], steps, group;
+			if (chains <= bufferSizeInBlocks - 1)
+				continue;
+
+			steps = (chains + bufferSizeInBlocks - 2) / (bufferSizeInBlocks - 1);
+			for (j = clusterStart[c]; j < clusterStart[c+1]; j += group)
+			{
+				/* Spread the chains left in the cluster evenly over the fewest merge steps */
+				group = (clusterStart[c+1] - j + steps - 1) / steps;
+				steps--;
+
+				out.pos = es->headerSize;
+				out.startPos = fileEnd;
+				out.writePos = fileEnd;
+				out.blocks = 0;
+				out.records = 0;
+				err = skip_merge(&dir, chainFirst + j, group, curRun, curBlock, sublsTuplePos, buffer, &out, file, es, metric, compareFn);
+				if (0 == err && 0 != skip_flush(&out, file, es, metric))
+					err = 9;
+				if (0 != err)
+					goto cleanup;
+				fileEnd = out.writePos;
+
+				/* Output run covers the smallest and largest records of its chains */
+				char *min = skip_min(&dir, chainFirst[j], es), *max = skip_max(&dir, chainLast[j], es);
+				for (i = j; i < j + group; i++)
+				{
+					for (run = chainFirst[i]; run >= 0; run = dir.next[run])
+						dir.blocks[run] = -1;
+					metric->num_compar += 2;
+					if (compareFn(skip_min(&dir, chainFirst[i], es), min) < 0)
+						min = skip_min(&dir, chainFirst[i], es);
+					if (compareFn(skip_max(&dir, chainLast[i], es), max) > 0)
+						max = skip_max(&dir, chainLast[i], es);
+				}
+				/* Copy bounds as the directory may move when it grows. Output block has been written. */
+				memcpy(out.page, min, es->record_size);
+				memcpy(tupleBuffer, max, es->record_size);
+				err = skip_add_run(&dir, out.startPos, out.blocks, out.records, out.page, tupleBuffer, es);
+				if (0 != err)
+					goto cleanup;
+			}
+		}
+
+		/* Remove merged runs from directory */
+		for (i = 0, j = 0; i < dir.count; i++)
+		{
+			if (dir.blocks[i] < 0)
+				continue;
+			dir.offset[j] = dir.offset[i];
+			dir.blocks[j] = dir.blocks[i];
+			dir.records[j] = dir.records[i];
+			memmove(skip_min(&dir, j, es), skip_min(&dir, i, es), (size_t) 2 * es->record_size);
+			j++;
+		}
+		dir.count = j;
+	}
+
+	/* Output is already in order if every cluster is one run and the runs are consecutive with full blocks */
+	if (maxChains == 1)
+	{
+		for (i = 0; i < numRuns-1; i++)
+		{
+			if (dir.offset[order[i+1]] != dir.offset[order[i]] + (long) dir.blocks[order[i]] * es->page_size
+				|| dir.records[order[i]] != dir.blocks[order[i]] * tuplesPerPage)
+				break;
+		}
+		if (i == numRuns-1)
+		{
+			*resultFilePtr = dir.offset[order[0]];
+			goto cleanup;
+		}
+	}
+
+	/* Final pass writes the clusters in order */
+	out.pos = es->headerSize;
+	out.startPos = fileEnd;
+	out.writePos = fileEnd;
+	out.blocks = 0;
+	out.records = 0;
+	for (c = 0; c < numClusters; c++)
+	{
+		err = skip_merge(&dir, chainFirst + clusterStart[c], clusterStart[c+1] - clusterStart[c], curRun, curBlock, sublsTuplePos, buffer, &out, file, es, metric, compareFn);
+		if (0 != err)
+			goto cleanup;
+	}
+	if (0 != skip_flush(&out, file, es, metric))
+	{
+		err = 9;
+		goto cleanup;
+	}
+
+	/* Return pointer to sorted output */
+	*resultFilePtr = out.startPos;
+
+cleanup:
+	if (0 == err && 0 != extern_sort_flush_pages(es, metric))
+		err = 9;
+	free(clusterStart);
+	free(chainLast);
+	free(chainFirst);
+	free(order);
+	free(sublsTuplePos);
+	free(curBlock);
+	free(curRun);
+	free(dir.bounds);
+	free(dir.next);
+	free(dir.records);
+	free(dir.blocks);
+	free(dir.offset);
+	return err;
+}
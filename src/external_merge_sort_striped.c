@@ -0,0 +1,348 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_striped.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		File-based external merge sort that places runs round-robin across
+			multiple files and alternates input and output files between passes.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_striped.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief     	Returns the index in files of the i-th file of a group. Group 0 has even indexes and group 1 odd indexes.
+*/
+static int8_t group_file(int8_t group, int32_t i, int8_t numFiles)
+{
+	int8_t groupSize = (numFiles - group + 1) / 2;
+	return (int8_t) (group + 2 * (i % groupSize));
+}
+
+/**
+@brief     	External merge sort with input iterator that stripes runs across multiple files.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      files
+                Already opened files to store sorting output (and in-progress temporary results)
+@param      numFiles
+                Number of files
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFile
+                Index in files of file containing sorted output
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+*/
+int extern_merge_sort_iterator_block_striped(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE **files,
+	int8_t 	numFiles,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	int8_t 	*resultFile,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	if (numFiles < 2)
+	{
+		*resultFile = 0;
+		return extern_merge_sort_iterator_block(iterator, iteratorState, tupleBuffer, files[0], buffer, bufferSizeInBlocks, es, resultFilePtr, metric, compareFn);
+	}
+
+	printf("External merge sort iterator version with blocks striped over %d files.\n", numFiles);
+
+	/* Page cache is for a single file so page I/O is done directly */
+	external_sort_t sortState = *es;
+	sortState.cache = NULL;
+	es = &sortState;
+
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int32_t 	maxRecordsRead = bufferSizeInBlocks * tuplesPerPage;
+	int32_t 	numRecordsRead;
+	int32_t 	numSublist = 0, lastRunPages = 0;
+	int 		i, status, err = 0;
+	char 		*addr;
+	long 		*writePos = (long*) malloc(sizeof(long) * numFiles);		/* Next write offset in each file */
+
+	if (NULL == writePos)
+		return 8;
+	for (i=0; i < numFiles; i++)
+		writePos[i] = 0;
+
+	/* Create initial sorted sublists (size of M) placed round-robin on files of group 0 */
+	do
+	{
+		numRecordsRead = 0;
+		/* Fill up buffer with input records from iterator */
+		addr = buffer+es->headerSize;
+		while (numRecordsRead < maxRecordsRead)
+		{
+			status = iterator(iteratorState, addr);
+			if (status == 0)
+				break;
+
+			numRecordsRead++;
+			addr += es->record_size;					/* Read a record. Advance to next record location in buffer. */
+		}
+		if (numRecordsRead == 0)
+			break;
+
+		int pageio = (numRecordsRead + tuplesPerPage - 1) / tuplesPerPage;
+		metric->num_reads += pageio;
+
+		/* Sort in memory and write to next file in group */
+		in_memory_sort(buffer+es->headerSize, (uint32_t)numRecordsRead, es->record_size, compareFn, 1);
+
+		int8_t f = group_file(0, numSublist, numFiles);
+		for (i=0; i < pageio; i++)
+		{
+			/* Header of block overwrites tail of previous block which has already been written */
+			addr = buffer + i * es->record_size * tuplesPerPage;
+			*((int32_t*) addr) = i;																		/* Block index */
+			*((int16_t*) (addr+BLOCK_COUNT_OFFSET)) = (i < pageio-1) ? tuplesPerPage : numRecordsRead - tuplesPerPage * i;	/* Block record count */
+
+			if (0 != extern_sort_write_page(files[f], writePos[f], addr, es, metric))
+			{
+				free(writePos);
+				return 9;
+			}
+			writePos[f] += es->page_size;
+		}
+		lastRunPages = pageio;
+		numSublist++;
+	} while (status == 1);
+
+	*resultFile = 0;
+	*resultFilePtr = 0;
+	if (numSublist <= 1)
+	{	/* No merge phase necessary */
+		free(writePos);
+		return 0;
+	}
+
+	/* Merge phase: combine M-1 sublists at a time reading one group of files and writing the other */
+	int8_t 		maxSublistsInRun = bufferSizeInBlocks - 1;
+	int8_t 		subListsInRun;
+
+	/* Run directory (file, offset, number of blocks). Output runs of a pass overwrite entries of consumed input runs. */
+	int8_t 		*runFile = (int8_t*) malloc(sizeof(int8_t) * numSublist);
+	long 		*runOffset = (long*) malloc(sizeof(long) * numSublist);
+	int32_t 	*runCount = (int32_t*) malloc(sizeof(int32_t) * numSublist);
+	int32_t 	*sublsTuplePos = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);		/* Current tuple of block being read */
+	long 		*mergeOffset = (long*) malloc(sizeof(long) * maxSublistsInRun);				/* Offset of current block of runs being merged */
+	int32_t 	*mergeCount = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);			/* Blocks left in runs being merged */
+	int8_t 		*mergeFile = (int8_t*) malloc(sizeof(int8_t) * maxSublistsInRun);
+
+	if (NULL == runFile || NULL == runOffset || NULL == runCount || NULL == sublsTuplePos || NULL == mergeOffset || NULL == mergeCount || NULL == mergeFile)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	/* Runs of run generation are stored consecutively in each file of group 0 */
+	for (i=0; i < numSublist; i++)
+	{
+		runFile[i] = group_file(0, i, numFiles);
+		runOffset[i] = (long) (i / ((numFiles + 1) / 2)) * bufferSizeInBlocks * es->page_size;
+		runCount[i] = bufferSizeInBlocks;
+	}
+	runCount[numSublist-1] = lastRunPages;
+
+	char		*outputBuffer = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+	void		*tuple, *value;
+	int32_t 	lowId, numblocks, numRuns, run, outRun;
+	int8_t 		outGroup = 1, outFile;
+	size_t 		bufferOutputPos;
+
+	while (numSublist > 1)
+	{
+		/* Output of this pass overwrites the files of the other group from the start */
+		for (i=outGroup; i < numFiles; i+=2)
+			writePos[i] = 0;
+
+		numRuns = 0;
+		for (run = 0; run < numSublist; run += subListsInRun)
+		{
+			subListsInRun = (numSublist - run) < maxSublistsInRun ? (numSublist - run) : maxSublistsInRun;
+
+			/* Fill the buffers with one block from each run being merged */
+			for (i=0; i < subListsInRun; i++)
+			{
+				mergeFile[i] = runFile[run+i];
+				mergeOffset[i] = runOffset[run+i];
+				mergeCount[i] = runCount[run+i];
+				sublsTuplePos[i] = 0;
+				if (0 != extern_sort_read_page(files[mergeFile[i]], mergeOffset[i], buffer + i * es->page_size, es, metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+			}
+
+			outRun = numRuns++;
+			outFile = group_file(outGroup, outRun, numFiles);
+			runFile[outRun] = outFile;
+			runOffset[outRun] = writePos[outFile];
+
+			#if defined(DEBUG)
+				printf("Merging %d runs starting at run %d to file %d offset %li\n", subListsInRun, run, outFile, writePos[outFile]);
+			#endif
+
+			/* Continually find lowest tuple in the runs and write to output buffer */
+			numblocks = 0;
+			bufferOutputPos = es->headerSize;
+			while (1)
+			{
+				/* Find smallest record */
+				i = 0;
+				while (i < subListsInRun && mergeCount[i] == 0)
+					i++;
+				if (i == subListsInRun)
+					break;					/* Processed all input */
+				lowId = i;
+				tuple = buffer + es->headerSize + i * es->page_size + sublsTuplePos[i] * es->record_size;
+				for (i++; i < subListsInRun; i++)
+				{
+					if (0 == mergeCount[i])
+						continue;			/* Run has been completely used */
+
+					value = buffer + es->headerSize + i * es->page_size + sublsTuplePos[i] * es->record_size;
+					metric->num_compar++;
+
+					if (0 < compareFn(tuple, value))
+					{
+						lowId = i;
+						tuple = value;
+					}
+				}
+
+				/* Add tuple to buffer */
+				metric->num_memcpys++;
+				memcpy(outputBuffer + bufferOutputPos, tuple, es->record_size);
+				bufferOutputPos += es->record_size;
+
+				/* If the buffer is full write it out */
+				if (bufferOutputPos + es->record_size > es->page_size)
+				{
+					*((int32_t*) outputBuffer) = numblocks++;											/* Block index */
+					*((int16_t*) (outputBuffer+BLOCK_COUNT_OFFSET)) = (bufferOutputPos - es->headerSize) / es->record_size;	/* Block record count */
+					if (0 != extern_sort_write_page(files[outFile], writePos[outFile], outputBuffer, es, metric))
+					{
+						err = 9;
+						goto cleanup;
+					}
+					writePos[outFile] += es->page_size;
+					bufferOutputPos = es->headerSize;
+				}
+
+				/* Increment to next tuple of block */
+				sublsTuplePos[lowId]++;
+
+				/* Check if have more tuples */
+				addr = buffer + lowId * es->page_size;
+				if (sublsTuplePos[lowId] >= *((int16_t*) (addr+BLOCK_COUNT_OFFSET)))
+				{
+					/* Increment to next block */
+					mergeOffset[lowId] += es->page_size;
+					mergeCount[lowId]--;
+					sublsTuplePos[lowId] = 0;
+
+					if (mergeCount[lowId] > 0)
+					{
+						if (0 != extern_sort_read_page(files[mergeFile[lowId]], mergeOffset[lowId], addr, es, metric))
+						{
+							err = 10;
+							goto cleanup;
+						}
+					}
+				}
+			}
+
+			/* Write out output buffer if partially full */
+			if (bufferOutputPos > es->headerSize)
+			{
+				*((int32_t*) outputBuffer) = numblocks++;												/* Block index */
+				*((int16_t*) (outputBuffer+BLOCK_COUNT_OFFSET)) = (bufferOutputPos - es->headerSize) / es->record_size;		/* Block record count */
+				if (0 != extern_sort_write_page(files[outFile], writePos[outFile], outputBuffer, es, metric))
+				{
+					err = 9;
+					goto cleanup;
+				}
+				writePos[outFile] += es->page_size;
+			}
+			runCount[outRun] = numblocks;
+		}
+
+		numSublist = numRuns;
+		outGroup = 1 - outGroup;
+	} /* End of merge */
+
+	/* Return pointer to sorted output */
+	*resultFile = runFile[0];
+	*resultFilePtr = runOffset[0];
+
+cleanup:
+	free(mergeFile);
+	free(mergeCount);
+	free(mergeOffset);
+	free(sublsTuplePos);
+	free(runCount);
+	free(runOffset);
+	free(runFile);
+	free(writePos);
+	return err;
+}
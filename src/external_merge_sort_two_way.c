@@ -0,0 +1,696 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_two_way.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		External merge sort using two-way replacement selection for ascending and descending runs.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_two_way.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/* Input records whose rise or fall is remembered to choose the direction of a new run */
+#define    TWO_WAY_TREND_WINDOW    16
+
+/* Heap of next runs. Records for the next runs are not in a heap. */
+#define    TWO_WAY_PENDING         2
+
+/**
+@brief		Records in memory during run generation. The first heap is stored from
+			the first slot. Records for the next runs follow it. The second heap is
+			stored from the last slot backwards. A heap for an ascending run has its
+			smallest record on top and one for a descending run its largest.
+*/
+typedef struct {
+	char 		*slots;				/* Record storage */
+	int32_t 	capacity;			/* Number of record slots */
+	int32_t 	count[2];			/* Records in each heap */
+	int32_t 	pending;			/* Records for the next runs */
+	int8_t 		descending[2];		/* Heap is for a descending run */
+	char 		*swap;				/* Space for one record */
+	int16_t 	recordSize;
+	metrics_t 	*metric;
+	int8_t 		(*compareFn)(void *a, void *b);
+} two_way_heaps_t;
+
+/**
+@brief		A run being written from a heap.
+*/
+typedef struct {
+	char 		*page;				/* Output block */
+	char 		*last;				/* Last record written to run */
+	long 		startPos;			/* Offset of first block of run */
+	long 		writePos;			/* Offset of next block */
+	int32_t 	blocks;				/* Blocks written */
+	int16_t 	count;				/* Records in output block */
+	int8_t 		active;				/* Run has at least one record */
+	int8_t 		descending;			/* Records are written in decreasing order */
+} two_way_run_t;
+
+/**
+@brief     	Returns slot i of a heap.
+*/
+static char* two_way_slot(two_way_heaps_t *h, int8_t heap, int32_t i)
+{
+	if (heap == 1)
+		i = h->capacity - 1 - i;
+	return h->slots + (size_t) i * h->recordSize;
+}
+
+/**
+@brief     	Returns 1 if record a belongs above record b in heap.
+*/
+static int8_t two_way_before(two_way_heaps_t *h, int8_t heap, void *a, void *b)
+{
+	h->metric->num_compar++;
+	if (h->descending[heap])
+		return h->compareFn(a, b) > 0;
+	return h->compareFn(a, b) < 0;
+}
+
+/**
+@brief     	Swaps two records.
+*/
+static void two_way_swap(two_way_heaps_t *h, char *a, char *b)
+{
+	memcpy(h->swap, a, h->recordSize);
+	memcpy(a, b, h->recordSize);
+	memcpy(b, h->swap, h->recordSize);
+	h->metric->num_memcpys += 3;
+}
+
+/**
+@brief     	Moves record i of a heap down until the heap is ordered.
+*/
+static void two_way_sift_down(two_way_heaps_t *h, int8_t heap, int32_t i)
+{
+	int32_t child;
+
+	while ((child = 2 * i + 1) < h->count[heap])
+	{
+		if (child + 1 < h->count[heap] && two_way_before(h, heap, two_way_slot(h, heap, child+1), two_way_slot(h, heap, child)))
+			child++;
+		if (!two_way_before(h, heap, two_way_slot(h, heap, child), two_way_slot(h, heap, i)))
+			break;
+		two_way_swap(h, two_way_slot(h, heap, child), two_way_slot(h, heap, i));
+		i = child;
+	}
+}
+
+/**
+@brief     	Adds a record to a heap or to the records for the next runs (heap TWO_WAY_PENDING).
+			There must be a free slot.
+*/
+static void two_way_push(two_way_heaps_t *h, int8_t heap, void *record)
+{
+	int32_t i, parent;
+
+	if (heap == TWO_WAY_PENDING)
+	{
+		memcpy(h->slots + (size_t) (h->count[0] + h->pending++) * h->recordSize, record, h->recordSize);
+		h->metric->num_memcpys++;
+		return;
+	}
+	if (heap == 0 && h->pending > 0)
+	{
+		/* Move first record for next runs after the others to make room for the heap */
+		memcpy(two_way_slot(h, heap, h->count[heap] + h->pending), two_way_slot(h, heap, h->count[heap]), h->recordSize);
+		h->metric->num_memcpys++;
+	}
+	i = h->count[heap]++;
+	memcpy(two_way_slot(h, heap, i), record, h->recordSize);
+	h->metric->num_memcpys++;
+	while (i > 0)
+	{
+		parent = (i - 1) / 2;
+		if (!two_way_before(h, heap, two_way_slot(h, heap, i), two_way_slot(h, heap, parent)))
+			break;
+		two_way_swap(h, two_way_slot(h, heap, i), two_way_slot(h, heap, parent));
+		i = parent;
+	}
+}
+
+/**
+@brief     	Removes the top record of a heap and copies it to record.
+*/
+static void two_way_pop(two_way_heaps_t *h, int8_t heap, void *record)
+{
+	int32_t last = --h->count[heap];
+
+	memcpy(record, two_way_slot(h, heap, 0), h->recordSize);
+	memcpy(two_way_slot(h, heap, 0), two_way_slot(h, heap, last), h->recordSize);
+	h->metric->num_memcpys += 2;
+	two_way_sift_down(h, heap, 0);
+	if (heap == 0 && h->pending > 0)
+	{
+		/* Fill the hole left by the heap with the last record for next runs */
+		memcpy(two_way_slot(h, heap, last), two_way_slot(h, heap, last + h->pending), h->recordSize);
+		h->metric->num_memcpys++;
+	}
+}
+
+/**
+@brief     	Makes an empty heap from all records for the next runs.
+*/
+static void two_way_restart(two_way_heaps_t *h, int8_t heap, int8_t descending, void *record)
+{
+	int32_t i;
+
+	h->descending[heap] = descending;
+	if (heap == 0)
+	{
+		h->count[heap] = h->pending;
+		h->pending = 0;
+		for (i = h->count[heap] / 2 - 1; i >= 0; i--)
+			two_way_sift_down(h, heap, i);
+		return;
+	}
+	while (h->pending > 0)
+	{
+		h->pending--;
+		memcpy(record, h->slots + (size_t) (h->count[0] + h->pending) * h->recordSize, h->recordSize);
+		h->metric->num_memcpys++;
+		two_way_push(h, heap, record);
+	}
+}
+
+/**
+@brief     	Makes heaps from the records for the next runs when both heaps are
+			empty. The larger half forms the first heap for an ascending run and
+			the smaller half the second heap for a descending run so the runs grow
+			in both directions from the median.
+*/
+static void two_way_split(two_way_heaps_t *h, void *record)
+{
+	int32_t i, half = h->pending / 2;
+
+	two_way_restart(h, 0, 0, record);
+	h->descending[1] = 1;
+	for (i = 0; i < half; i++)
+	{
+		two_way_pop(h, 0, record);
+		two_way_push(h, 1, record);
+	}
+}
+
+/**
+@brief     	Returns the heap for a record: a heap whose run the record can extend or
+			TWO_WAY_PENDING if it must wait for the next runs. If both runs go in the
+			same direction and can take the record, the run with the closest last
+			record is used.
+*/
+static int8_t two_way_target(two_way_run_t *runs, void *record, metrics_t *metric, int8_t (*compareFn)(void *a, void *b))
+{
+	int8_t heap, cmp, target = TWO_WAY_PENDING;
+
+	for (heap = 0; heap < 2; heap++)
+	{
+		if (!runs[heap].active)
+			continue;
+		metric->num_compar++;
+		cmp = compareFn(record, runs[heap].last);
+		if (runs[heap].descending ? cmp > 0 : cmp < 0)
+			continue;
+		if (target != TWO_WAY_PENDING && runs[0].descending == runs[1].descending)
+		{
+			metric->num_compar++;
+			cmp = compareFn(runs[1].last, runs[0].last);
+			if (runs[0].descending ? cmp >= 0 : cmp <= 0)
+				continue;
+		}
+		target = heap;
+	}
+	return target;
+}
+
+/**
+@brief     	Adds a record to a run and writes the output block if it is full.
+*/
+static int two_way_output(two_way_run_t *run, ION_FILE *file, void *record, int16_t tuplesPerPage, external_sort_t *es, metrics_t *metric)
+{
+	memcpy(run->page + es->headerSize + run->count * es->record_size, record, es->record_size);
+	memcpy(run->last, record, es->record_size);
+	metric->num_memcpys += 2;
+	run->active = 1;
+	if (++run->count < tuplesPerPage)
+		return 0;
+
+	*((int32_t*) run->page) = run->blocks++;								/* Block index */
+	*((int16_t*) (run->page+BLOCK_COUNT_OFFSET)) = run->count;				/* Block record count */
+	if (0 != extern_sort_write_page(file, run->writePos, run->page, es, metric))
+		return 9;
+	run->writePos += es->page_size;
+	run->count = 0;
+	return 0;
+}
+
+/**
+@brief     	Writes the partial output block of a run and adds the run to the run directory.
+*/
+static int two_way_end_run(two_way_run_t *run, int8_t heap, ION_FILE *file, external_sort_t *es, metrics_t *metric,
+	long **runOffset, int32_t **runCount, int8_t **runHeap, int8_t **runDescending, int32_t *numRuns, int32_t *capacity)
+{
+	if (run->count > 0)
+	{
+		*((int32_t*) run->page) = run->blocks++;							/* Block index */
+		*((int16_t*) (run->page+BLOCK_COUNT_OFFSET)) = run->count;			/* Block record count */
+		if (0 != extern_sort_write_page(file, run->writePos, run->page, es, metric))
+			return 9;
+		run->writePos += es->page_size;
+		run->count = 0;
+	}
+	run->active = 0;
+	if (run->blocks == 0)
+		return 0;
+
+	if (*numRuns == *capacity)
+	{
+		*capacity *= 2;
+		long *offsets = (long*) realloc(*runOffset, sizeof(long) * *capacity);
+		if (NULL != offsets)
+			*runOffset = offsets;
+		int32_t *counts = (int32_t*) realloc(*runCount, sizeof(int32_t) * *capacity);
+		if (NULL != counts)
+			*runCount = counts;
+		int8_t *heaps = (int8_t*) realloc(*runHeap, sizeof(int8_t) * *capacity);
+		if (NULL != heaps)
+			*runHeap = heaps;
+		int8_t *directions = (int8_t*) realloc(*runDescending, sizeof(int8_t) * *capacity);
+		if (NULL != directions)
+			*runDescending = directions;
+		if (NULL == offsets || NULL == counts || NULL == heaps || NULL == directions)
+			return 8;
+	}
+	(*runOffset)[*numRuns] = run->startPos;
+	(*runCount)[*numRuns] = run->blocks;
+	(*runHeap)[*numRuns] = heap;
+	(*runDescending)[*numRuns] = run->descending;
+	(*numRuns)++;
+
+	run->startPos = run->writePos;
+	run->blocks = 0;
+	return 0;
+}
+
+/**
+@brief     	External merge sort with input iterator using two-way replacement
+			selection to create ascending and descending runs.
+@details	The buffer (except one output block for each heap) holds two heaps.
+			When memory is full the records are split at the median: the larger
+			half grows an ascending run upwards and the smaller half grows a
+			descending run downwards. Each input record goes to a run it can
+			extend (not smaller than the last record of an ascending run or not
+			larger than the last record of a descending run) or is kept for the
+			next runs. A record is written from the heap the input record goes to
+			(or the larger heap) to make room. When one heap is empty and more
+			records wait for the next runs than the other heap has, its run ends
+			and a new run starts from the waiting records in the direction the
+			recent input has been moving. Otherwise both runs end when neither heap
+			has records and the records are split at the median again. Input with
+			rising and falling trends (such as sensor cycles) gives far fewer runs
+			than sorting one buffer at a time or one-way replacement selection.
+			Runs of the first heap are written to file and runs of the second heap
+			to secondFile. Descending runs are written in decreasing order with
+			increasing block indexes and are merged by reading their blocks and
+			records from last to first. Merge passes alternate between two regions
+			of the output file. A single descending run is reversed by one merge
+			pass. The page cache (es->cache) is only used for the output file.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      file
+                Already opened file to store runs of the first heap and sorting output
+@param      secondFile
+                Already opened file to store runs of the second heap
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 3)
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error.
+*/
+int extern_merge_sort_two_way(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	void	*tupleBuffer,
+	ION_FILE *file,
+	ION_FILE *secondFile,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	printf("External merge sort iterator version with two-way replacement selection.\n");
+
+	int16_t 	tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int16_t 	trend = 0;
+	int32_t 	numRecords = 0, numRuns = 0, capacity = 8;
+	int8_t 		heap;
+	int 		i, err = 0;
+	two_way_heaps_t heaps;
+	two_way_run_t 	runs[2];
+	ION_FILE 	*runFile[2] = { file, secondFile };
+
+	/* Page cache is over the output file only */
+	external_sort_t secondState = *es;
+	secondState.cache = NULL;
+	external_sort_t *runState[2] = { es, &secondState };
+
+	/* Run directory (offset, number of blocks, heap (file), direction). Output runs of a pass overwrite entries of consumed input runs. */
+	long 		*runOffset = (long*) malloc(sizeof(long) * capacity);
+	int32_t 	*runCount = (int32_t*) malloc(sizeof(int32_t) * capacity);
+	int8_t 		*runHeap = (int8_t*) malloc(sizeof(int8_t) * capacity);
+	int8_t 		*runDescending = (int8_t*) malloc(sizeof(int8_t) * capacity);
+	char 		*records = (char*) malloc((size_t) es->record_size * 5);	/* Swap space, a moved record, last record of each run and previous input */
+	char 		*moved, *previous;
+	int32_t 	*sublsTuplePos = NULL;		/* Records of current block used */
+	int32_t 	*mergeBlock = NULL;			/* Blocks of run used */
+
+	*resultFilePtr = 0;
+	if (NULL == runOffset || NULL == runCount || NULL == runHeap || NULL == runDescending || NULL == records || bufferSizeInBlocks < 3 || tuplesPerPage < 1)
+	{
+		err = 8;
+		goto cleanup;
+	}
+	moved = records + es->record_size;
+	previous = records + 4 * es->record_size;
+
+	heaps.slots = buffer + 2 * es->page_size;
+	heaps.capacity = (int32_t) ((bufferSizeInBlocks - 2) * es->page_size / es->record_size);
+	heaps.count[0] = 0;
+	heaps.count[1] = 0;
+	heaps.pending = 0;
+	heaps.swap = records;
+	heaps.recordSize = es->record_size;
+	heaps.metric = metric;
+	heaps.compareFn = compareFn;
+
+	for (heap = 0; heap < 2; heap++)
+	{
+		runs[heap].page = buffer + heap * es->page_size;
+		runs[heap].last = records + (heap + 2) * es->record_size;
+		runs[heap].startPos = 0;
+		runs[heap].writePos = 0;
+		runs[heap].blocks = 0;
+		runs[heap].count = 0;
+		runs[heap].active = 0;
+		runs[heap].descending = heap;
+	}
+
+	/* Create runs. Input continues after the end of input to write out the records in memory. */
+	int status = 1;
+	while (status == 1 || heaps.count[0] + heaps.count[1] + heaps.pending > 0)
+	{
+		if (status == 1)
+		{
+			status = iterator(iteratorState, tupleBuffer);
+			if (status == 1)
+			{
+				/* Track whether input has been rising or falling */
+				if (numRecords++ > 0)
+				{
+					metric->num_compar++;
+					if (compareFn(tupleBuffer, previous) > 0)
+						trend += (trend < TWO_WAY_TREND_WINDOW);
+					else
+						trend -= (trend > -TWO_WAY_TREND_WINDOW);
+				}
+				memcpy(previous, tupleBuffer, es->record_size);
+			}
+		}
+
+		if (status == 1 && heaps.count[0] + heaps.count[1] + heaps.pending < heaps.capacity)
+		{
+			/* Free slot: keep the record for the next runs until memory is full */
+			two_way_push(&heaps, two_way_target(runs, tupleBuffer, metric, compareFn), tupleBuffer);
+			continue;
+		}
+
+		/* A heap with no records left starts a new run when more records wait for the next runs than the other heap has */
+		for (heap = 0; heap < 2; heap++)
+		{
+			if (heaps.count[heap] == 0 && heaps.count[1-heap] > 0 && heaps.pending > heaps.count[1-heap])
+			{
+				err = two_way_end_run(&runs[heap], heap, runFile[heap], runState[heap], metric, &runOffset, &runCount, &runHeap, &runDescending, &numRuns, &capacity);
+				if (0 != err)
+					goto cleanup;
+				runs[heap].descending = (trend < 0);
+				two_way_restart(&heaps, heap, runs[heap].descending, moved);
+			}
+		}
+
+		/* Write a record from the heap the input record would go to or the larger heap */
+		heap = (status == 1) ? two_way_target(runs, tupleBuffer, metric, compareFn) : TWO_WAY_PENDING;
+		if (heap == TWO_WAY_PENDING || heaps.count[heap] == 0)
+			heap = (heaps.count[0] >= heaps.count[1]) ? 0 : 1;
+
+		if (heaps.count[heap] == 0)
+		{
+			/* No records left for current runs. End them and start the next runs from the median. */
+			for (heap = 0; heap < 2; heap++)
+			{
+				err = two_way_end_run(&runs[heap], heap, runFile[heap], runState[heap], metric, &runOffset, &runCount, &runHeap, &runDescending, &numRuns, &capacity);
+				if (0 != err)
+					goto cleanup;
+				runs[heap].descending = heap;
+			}
+			two_way_split(&heaps, moved);
+			for (heap = 0; heap < 2; heap++)
+			{
+				if (heaps.count[heap] == 0)
+					continue;
+				two_way_pop(&heaps, heap, moved);
+				if (0 != two_way_output(&runs[heap], runFile[heap], moved, tuplesPerPage, runState[heap], metric))
+				{
+					err = 9;
+					goto cleanup;
+				}
+			}
+		}
+		else
+		{
+			two_way_pop(&heaps, heap, moved);
+			if (0 != two_way_output(&runs[heap], runFile[heap], moved, tuplesPerPage, runState[heap], metric))
+			{
+				err = 9;
+				goto cleanup;
+			}
+		}
+
+		if (status == 1)
+		{
+			/* Place input record using the last records of the runs after the write */
+			two_way_push(&heaps, two_way_target(runs, tupleBuffer, metric, compareFn), tupleBuffer);
+		}
+	}
+	for (heap = 0; heap < 2; heap++)
+	{
+		err = two_way_end_run(&runs[heap], heap, runFile[heap], runState[heap], metric, &runOffset, &runCount, &runHeap, &runDescending, &numRuns, &capacity);
+		if (0 != err)
+			goto cleanup;
+	}
+	metric->num_reads += (numRecords + tuplesPerPage - 1) / tuplesPerPage;
+
+	#if defined(DEBUG)
+		printf("Records: %li Runs: %li\n", (long) numRecords, (long) numRuns);
+	#endif
+
+	if (numRuns == 0 || (numRuns == 1 && !runDescending[0] && runHeap[0] == 0))
+	{
+		if (numRuns == 1)
+			*resultFilePtr = runOffset[0];
+		goto cleanup;			/* No merge phase necessary */
+	}
+
+	/* Merge passes write after all run blocks of both files */
+	long 		regionSize = runs[0].writePos + runs[1].writePos, inputBase = 0, writePos;
+	void		*tuple, *value;
+	char 		*outputBuffer = buffer + (bufferSizeInBlocks - 1) * es->page_size, *page;
+	int32_t 	lowId, numblocks, outRuns, run, subListsInRun, count;
+	size_t 		bufferOutputPos;
+
+	sublsTuplePos = (int32_t*) malloc(sizeof(int32_t) * (bufferSizeInBlocks - 1));
+	mergeBlock = (int32_t*) malloc(sizeof(int32_t) * (bufferSizeInBlocks - 1));
+	if (NULL == sublsTuplePos || NULL == mergeBlock)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	while (numRuns > 1 || runDescending[0] || runHeap[0] != 0)
+	{
+		/* Output of a pass is written to the region the input of the previous pass was not in */
+		writePos = (inputBase == 0) ? regionSize : 0;
+		inputBase = writePos;
+		outRuns = 0;
+		for (run = 0; run < numRuns; run += subListsInRun)
+		{
+			subListsInRun = (numRuns - run < bufferSizeInBlocks - 1) ? numRuns - run : bufferSizeInBlocks - 1;
+
+			#if defined(DEBUG)
+				printf("Merging %d runs starting at run %d to offset %li\n", subListsInRun, run, writePos);
+			#endif
+
+			/* Read the first block of each run (last block of a descending run) */
+			for (i=0; i < subListsInRun; i++)
+			{
+				mergeBlock[i] = 0;
+				sublsTuplePos[i] = 0;
+				heap = runHeap[run+i];
+				if (0 != extern_sort_read_page(runFile[heap], runOffset[run+i] + (runDescending[run+i] ? (long) (runCount[run+i] - 1) * es->page_size : 0), buffer + i * es->page_size, runState[heap], metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+			}
+
+			/* Continually find lowest tuple in the runs and write to output buffer */
+			numblocks = 0;
+			bufferOutputPos = es->headerSize;
+			while (1)
+			{
+				/* Find smallest record */
+				lowId = -1;
+				tuple = NULL;
+				for (i=0; i < subListsInRun; i++)
+				{
+					if (mergeBlock[i] >= runCount[run+i])
+						continue;			/* Run has been completely used */
+
+					page = buffer + i * es->page_size;
+					count = *((int16_t*) (page+BLOCK_COUNT_OFFSET));
+					value = page + es->headerSize + (runDescending[run+i] ? count - 1 - sublsTuplePos[i] : sublsTuplePos[i]) * es->record_size;
+					if (NULL != tuple)
+					{
+						metric->num_compar++;
+						if (0 >= compareFn(tuple, value))
+							continue;
+					}
+					lowId = i;
+					tuple = value;
+				}
+				if (lowId < 0)
+					break;					/* Processed all input */
+
+				/* Add tuple to buffer */
+				metric->num_memcpys++;
+				memcpy(outputBuffer + bufferOutputPos, tuple, es->record_size);
+				bufferOutputPos += es->record_size;
+
+				/* If the buffer is full write it out */
+				if (bufferOutputPos + es->record_size > es->page_size)
+				{
+					*((int32_t*) outputBuffer) = numblocks++;											/* Block index */
+					*((int16_t*) (outputBuffer+BLOCK_COUNT_OFFSET)) = (bufferOutputPos - es->headerSize) / es->record_size;	/* Block record count */
+					if (0 != extern_sort_write_page(file, writePos + (long) (numblocks - 1) * es->page_size, outputBuffer, es, metric))
+					{
+						err = 9;
+						goto cleanup;
+					}
+					bufferOutputPos = es->headerSize;
+				}
+
+				/* Move to next record of run. Descending runs are read from their last block to their first. */
+				page = buffer + lowId * es->page_size;
+				sublsTuplePos[lowId]++;
+				if (sublsTuplePos[lowId] >= *((int16_t*) (page+BLOCK_COUNT_OFFSET)))
+				{
+					mergeBlock[lowId]++;
+					sublsTuplePos[lowId] = 0;
+					if (mergeBlock[lowId] < runCount[run+lowId])
+					{
+						heap = runHeap[run+lowId];
+						if (0 != extern_sort_read_page(runFile[heap], runOffset[run+lowId] + (long) (runDescending[run+lowId] ? runCount[run+lowId] - 1 - mergeBlock[lowId] : mergeBlock[lowId]) * es->page_size, page, runState[heap], metric))
+						{
+							err = 10;
+							goto cleanup;
+						}
+					}
+				}
+			}
+
+			/* Write out output buffer if partially full */
+			if (bufferOutputPos > es->headerSize)
+			{
+				*((int32_t*) outputBuffer) = numblocks++;												/* Block index */
+				*((int16_t*) (outputBuffer+BLOCK_COUNT_OFFSET)) = (bufferOutputPos - es->headerSize) / es->record_size;		/* Block record count */
+				if (0 != extern_sort_write_page(file, writePos + (long) (numblocks - 1) * es->page_size, outputBuffer, es, metric))
+				{
+					err = 9;
+					goto cleanup;
+				}
+			}
+			runOffset[outRuns] = writePos;
+			runCount[outRuns] = numblocks;
+			runHeap[outRuns] = 0;
+			runDescending[outRuns] = 0;
+			outRuns++;
+			writePos += (long) numblocks * es->page_size;
+		}
+		numRuns = outRuns;
+	} /* End of merge */
+
+	/* Return pointer to sorted output */
+	*resultFilePtr = runOffset[0];
+
+cleanup:
+	if (0 == err && 0 != extern_sort_flush_pages(es, metric))
+		err = 9;
+	free(mergeBlock);
+	free(sublsTuplePos);
+	free(records);
+	free(runDescending);
+	free(runHeap);
+	free(runCount);
+	free(runOffset);
+	return err;
+}
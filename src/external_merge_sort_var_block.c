@@ -0,0 +1,371 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_var_block.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		File-based external merge sort of variable-length records stored in
+			slotted blocks.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_var_block.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/* Records read during run generation are stored with their length in front */
+#define    VAR_LENGTH_SIZE      sizeof(uint16_t)
+
+/**
+@brief		Slotted page being filled in the buffer before it is written to the file.
+*/
+typedef struct {
+	char 		*page;
+	int16_t 	count;				/* Number of records (slots) in page */
+	uint16_t 	heapStart;			/* Offset of first byte used by records */
+	int32_t 	numblocks;			/* Blocks written to current run */
+	long 		writePos;			/* Offset in file to write next block */
+} var_page_writer_t;
+
+/* Record comparison used when sorting pointers to records in run generation (shared by all sorts, so one sort at a time) */
+static int8_t (*varCompareFn)(void *a, void *b);
+
+/**
+@brief     	Compares two records given pointers to their lengths in the run generation buffer.
+*/
+static int8_t var_pointer_compare(void *a, void *b)
+{
+	return varCompareFn(*((char**) a) + VAR_LENGTH_SIZE, *((char**) b) + VAR_LENGTH_SIZE);
+}
+
+/**
+@brief     	Returns a record of a slotted page.
+@param      page
+                Page in memory
+@param      slot
+                Slot of record (0 to block record count - 1)
+@param      es
+                Sorting state info (block size, header size)
+@param      length
+                Set to length of record in bytes
+@return		Pointer to record in page.
+*/
+char* extern_sort_var_record(
+	char 	*page,
+	int16_t slot,
+	external_sort_t *es,
+	uint16_t *length)
+{
+	/* Records are added from the end of the page so a record ends where the previous one starts */
+	uint16_t end = (slot == 0) ? es->page_size : VAR_SLOT(es, page, slot-1);
+	*length = end - VAR_SLOT(es, page, slot);
+	return page + VAR_SLOT(es, page, slot);
+}
+
+/**
+@brief     	Starts a new empty slotted page.
+*/
+static void var_page_init(var_page_writer_t *writer, external_sort_t *es)
+{
+	writer->count = 0;
+	writer->heapStart = es->page_size;
+}
+
+/**
+@brief     	Writes the slotted page to the end of the current run.
+*/
+static int var_page_write(ION_FILE *file, var_page_writer_t *writer, external_sort_t *es, metrics_t *metric)
+{
+	*((int32_t*) writer->page) = writer->numblocks++;								/* Block index */
+	*((int16_t*) (writer->page+BLOCK_COUNT_OFFSET)) = writer->count;				/* Block record count */
+	if (0 != extern_sort_write_page(file, writer->writePos, writer->page, es, metric))
+		return 9;
+
+	#if defined(DEBUG)
+		printf("OUTPUT Block Offset: %li  Records: %d  Free space: %d\n", writer->writePos, writer->count, writer->heapStart - es->headerSize - writer->count * VAR_SLOT_SIZE);
+	#endif
+	writer->writePos += es->page_size;
+	var_page_init(writer, es);
+	return 0;
+}
+
+/**
+@brief     	Adds a record to the slotted page, writing the page out first if the record does not fit.
+*/
+static int var_page_add(ION_FILE *file, var_page_writer_t *writer, char *record, uint16_t length, external_sort_t *es, metrics_t *metric)
+{
+	if (es->headerSize + (writer->count + 1) * VAR_SLOT_SIZE + length > writer->heapStart)
+	{
+		if (0 != var_page_write(file, writer, es, metric))
+			return 9;
+	}
+
+	writer->heapStart -= length;
+	memcpy(writer->page + writer->heapStart, record, length);
+	VAR_SLOT(es, writer->page, writer->count) = writer->heapStart;
+	writer->count++;
+	metric->num_memcpys++;
+	return 0;
+}
+
+/**
+@brief     	External merge sort with input iterator for variable-length records stored in slotted pages.
+			Not reentrant as compareFn is kept in a file static variable during run generation.
+@param      iterator
+                Row iterator for reading input rows. Stores a record in buffer and its length in bytes in length.
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, maximum record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+*/
+int extern_merge_sort_var_block(
+	int (*iterator)(void *state, void* buffer, uint16_t *length),
+	void	*iteratorState,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	printf("External merge sort iterator version with variable-length records in slotted blocks.\n");
+
+	var_page_writer_t writer;
+	long 		*runOffset = NULL;
+	int32_t 	*runCount = NULL, *sublsTuplePos = NULL, *mergeCount = NULL;
+	long 		*mergeOffset = NULL;
+	int32_t 	capacity = 0, numSublist = 0, numRecords, i;
+	uint32_t 	totalBytes = 0, totalRecords = 0;
+	int 		done = 0, err = 0;
+	uint16_t 	length;
+	char 		*pos, **ptrs;
+	char 		*arenaEnd = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+
+	/* Last page of buffer is used to build output blocks */
+	writer.page = arenaEnd;
+	writer.writePos = 0;
+	varCompareFn = compareFn;
+
+	/* Create initial sorted sublists. Records are stored from the start of the buffer and pointers to them from the end. */
+	do
+	{
+		pos = buffer;
+		ptrs = (char**) arenaEnd;
+		numRecords = 0;
+		while ((char*) (ptrs - 1) - pos >= (long) (VAR_LENGTH_SIZE + es->record_size))
+		{
+			if (0 == iterator(iteratorState, pos + VAR_LENGTH_SIZE, &length))
+			{
+				done = 1;
+				break;
+			}
+			*((uint16_t*) pos) = length;
+			*(--ptrs) = pos;
+			pos += VAR_LENGTH_SIZE + length;
+			numRecords++;
+			totalBytes += length + VAR_SLOT_SIZE;
+		}
+		totalRecords += numRecords;
+		if (numRecords == 0)
+			break;
+
+		/* Sort pointers to records in memory */
+		in_memory_sort(ptrs, (uint32_t) numRecords, sizeof(char*), var_pointer_compare, 1);
+
+		/* Write run as slotted blocks */
+		long runStart = writer.writePos;
+		writer.numblocks = 0;
+		var_page_init(&writer, es);
+		for (i=0; i < numRecords; i++)
+		{
+			err = var_page_add(file, &writer, ptrs[i] + VAR_LENGTH_SIZE, *((uint16_t*) ptrs[i]), es, metric);
+			if (err)
+				goto cleanup;
+		}
+		err = var_page_write(file, &writer, es, metric);
+		if (err)
+			goto cleanup;
+
+		/* Input is counted as the blocks it fills without padding */
+		metric->num_reads += writer.numblocks;
+		err = extern_sort_add_run(&runOffset, &runCount, &capacity, numSublist++, runStart, writer.numblocks);
+		if (err)
+			goto cleanup;
+	} while (!done);
+
+	*resultFilePtr = 0;
+	es->num_pages = 0;
+	if (numSublist == 0)
+		goto cleanup;
+
+	/* Merge phase: combine M-1 sublists at a time */
+	int8_t 		maxSublistsInRun = bufferSizeInBlocks - 1;
+	int8_t 		subListsInRun;
+	int32_t 	numRuns, run, lowId, numblocks;
+	int32_t 	minFill = es->page_size - es->headerSize - (es->record_size + VAR_SLOT_SIZE);
+	char 		*tuple, *value, *addr;
+	uint16_t 	tupleLength, valueLength;
+
+	sublsTuplePos = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);		/* Current slot of block being read */
+	mergeOffset = (long*) malloc(sizeof(long) * maxSublistsInRun);				/* Offset of current block of runs being merged */
+	mergeCount = (int32_t*) malloc(sizeof(int32_t) * maxSublistsInRun);			/* Blocks left in runs being merged */
+	if (NULL == sublsTuplePos || NULL == mergeOffset || NULL == mergeCount)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	while (numSublist > 1)
+	{
+		/* A block is written when the next record does not fit, so all blocks but the last of a run hold more than minFill bytes */
+		numRuns = (numSublist + maxSublistsInRun - 1) / maxSublistsInRun;
+		numblocks = (minFill > 0) ? numRuns + totalBytes / minFill : (int32_t) totalRecords;
+		writer.writePos = extern_sort_run_write_pos(runOffset, runCount, numSublist, numblocks, es);
+		numRuns = 0;
+		for (run = 0; run < numSublist; run += subListsInRun)
+		{
+			subListsInRun = (numSublist - run) < maxSublistsInRun ? (numSublist - run) : maxSublistsInRun;
+
+			/* Fill the buffers with one block from each run being merged */
+			for (i=0; i < subListsInRun; i++)
+			{
+				mergeOffset[i] = runOffset[run+i];
+				mergeCount[i] = runCount[run+i];
+				sublsTuplePos[i] = 0;
+				if (0 != extern_sort_read_page(file, mergeOffset[i], buffer + i * es->page_size, es, metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+			}
+
+			long runStart = writer.writePos;
+			writer.numblocks = 0;
+			var_page_init(&writer, es);
+
+			/* Continually find lowest record in the runs and add to output block */
+			while (1)
+			{
+				i = 0;
+				while (i < subListsInRun && mergeCount[i] == 0)
+					i++;
+				if (i == subListsInRun)
+					break;					/* Processed all input */
+				lowId = i;
+				tuple = extern_sort_var_record(buffer + i * es->page_size, sublsTuplePos[i], es, &tupleLength);
+				for (i++; i < subListsInRun; i++)
+				{
+					if (0 == mergeCount[i])
+						continue;			/* Run has been completely used */
+
+					value = extern_sort_var_record(buffer + i * es->page_size, sublsTuplePos[i], es, &valueLength);
+					metric->num_compar++;
+
+					if (0 < compareFn(tuple, value))
+					{
+						lowId = i;
+						tuple = value;
+						tupleLength = valueLength;
+					}
+				}
+
+				err = var_page_add(file, &writer, tuple, tupleLength, es, metric);
+				if (err)
+					goto cleanup;
+
+				/* Advance to next slot and read next block of run when block is used */
+				sublsTuplePos[lowId]++;
+				addr = buffer + lowId * es->page_size;
+				if (sublsTuplePos[lowId] >= *((int16_t*) (addr+BLOCK_COUNT_OFFSET)))
+				{
+					mergeOffset[lowId] += es->page_size;
+					mergeCount[lowId]--;
+					sublsTuplePos[lowId] = 0;
+
+					if (mergeCount[lowId] > 0)
+					{
+						if (0 != extern_sort_read_page(file, mergeOffset[lowId], addr, es, metric))
+						{
+							err = 10;
+							goto cleanup;
+						}
+					}
+				}
+			}
+
+			/* Write out partially full output block */
+			if (writer.count > 0)
+			{
+				err = var_page_write(file, &writer, es, metric);
+				if (err)
+					goto cleanup;
+			}
+
+			/* Output run replaces directory entry of a consumed run */
+			runOffset[numRuns] = runStart;
+			runCount[numRuns] = writer.numblocks;
+			numRuns++;
+		}
+		numSublist = numRuns;
+	} /* End of merge */
+
+	/* Return pointer to sorted output */
+	*resultFilePtr = runOffset[0];
+	es->num_pages = runCount[0];
+	err = extern_sort_flush_pages(es, metric);
+
+cleanup:
+	free(mergeCount);
+	free(mergeOffset);
+	free(sublsTuplePos);
+	free(runCount);
+	free(runOffset);
+	return err;
+}
@@ -0,0 +1,120 @@
+/******************************************************************************/
+/**
+@file		external_merge_sort_var_block.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		This file contains declarations for external merge sort of
+			variable-length records.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/* Slotted page: block header, then slot directory of record offsets. Records are stored from the end of the page. */
+#define    VAR_SLOT_SIZE                sizeof(uint16_t)
+#define    VAR_SLOT(es, page, i)        (*((uint16_t*) ((char*) (page) + (es)->headerSize + (i) * VAR_SLOT_SIZE)))
+
+/**
+@brief     	Returns a record of a slotted page.
+@param      page
+                Page in memory
+@param      slot
+                Slot of record (0 to block record count - 1)
+@param      es
+                Sorting state info (block size, header size)
+@param      length
+                Set to length of record in bytes
+@return		Pointer to record in page.
+*/
+char* extern_sort_var_record(
+	char 	*page,
+	int16_t slot,
+	external_sort_t *es,
+	uint16_t *length);
+
+/**
+@brief     	External merge sort with input iterator for variable-length records stored in slotted pages.
+@details	es->record_size is the maximum record length. Each output block has the
+			usual block header followed by a slot directory with the offset of each
+			record in the block, and the records are packed from the end of the block,
+			so no space is used for padding. Records may be read with
+			extern_sort_var_record(). A merge pass writes its runs at the start of the
+			file if they fit before the runs being merged and otherwise after them, and
+			the sorted output is es->num_pages blocks (updated by the sort) at resultFilePtr.
+			The key must be at the start of each record. The sort is not reentrant:
+			run generation keeps compareFn in a file static variable, so only one
+			sort of variable-length records may run at a time.
+@param      iterator
+                Row iterator for reading input rows. Stores a record in buffer and its length in bytes in length.
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      file
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, maximum record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error.
+*/
+int extern_merge_sort_var_block(
+	int (*iterator)(void *state, void* buffer, uint16_t *length),
+	void	*iteratorState,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	long 	*resultFilePtr,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,497 @@
+/******************************************************************************/
+/**
+@file		external_sort_bounded.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		Single pass sort of nearly sorted input using a sliding heap with
+			spilling of records that break the disorder bound.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_sort_bounded.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief		Sorted run of blocks stored one after another in a file.
+*/
+typedef struct {
+	ION_FILE 	*file;
+	external_sort_t *state;		/* Sort state used to read file (page cache is over output file only) */
+	long 		offset;
+	uint32_t 	num_pages;
+} bounded_run_t;
+
+/**
+@brief		Output block being filled in the buffer before it is written to the file.
+*/
+typedef struct {
+	ION_FILE 	*file;
+	external_sort_t *state;		/* Sort state used to write file (page cache is over output file only) */
+	char 		*page;
+	int16_t 	count;
+	int32_t 	numblocks;
+	long 		writePos;
+} bounded_writer_t;
+
+/**
+@brief     	Writes the output block and advances the write position.
+*/
+static int bounded_write_page(bounded_writer_t *writer, external_sort_t *es, metrics_t *metric)
+{
+	*((int32_t*) writer->page) = writer->numblocks++;								/* Block index */
+	*((int16_t*) (writer->page+BLOCK_COUNT_OFFSET)) = writer->count;				/* Block record count */
+	if (0 != extern_sort_write_page(writer->file, writer->writePos, writer->page, writer->state, metric))
+		return 9;
+	writer->writePos += es->page_size;
+	writer->count = 0;
+	return 0;
+}
+
+/**
+@brief     	Adds a record to the output block, writing the block when it is full.
+*/
+static int bounded_output(bounded_writer_t *writer, char *record, external_sort_t *es, metrics_t *metric)
+{
+	memcpy(writer->page + es->headerSize + writer->count * es->record_size, record, es->record_size);
+	metric->num_memcpys++;
+	if (++writer->count < (es->page_size - es->headerSize) / es->record_size)
+		return 0;
+	return bounded_write_page(writer, es, metric);
+}
+
+/**
+@brief     	Adds a run to the run directory, growing the directory if it is full.
+*/
+static int bounded_add_run(bounded_run_t **runs, int32_t *capacity, int32_t *numRuns, ION_FILE *file, external_sort_t *state, long offset, uint32_t numPages)
+{
+	if (*numRuns >= *capacity)
+	{
+		int32_t newCapacity = (*capacity == 0) ? 8 : *capacity * 2;
+		bounded_run_t *newRuns = (bounded_run_t*) realloc(*runs, sizeof(bounded_run_t) * newCapacity);
+		if (NULL == newRuns)
+			return 8;
+		*runs = newRuns;
+		*capacity = newCapacity;
+	}
+	(*runs)[*numRuns].file = file;
+	(*runs)[*numRuns].state = state;
+	(*runs)[*numRuns].offset = offset;
+	(*runs)[*numRuns].num_pages = numPages;
+	(*numRuns)++;
+	return 0;
+}
+
+/**
+@brief     	Sorts the spill block and writes it as a run.
+*/
+static int bounded_spill_run(bounded_writer_t *spillWriter, bounded_run_t **runs, int32_t *capacity, int32_t *numRuns, external_sort_t *es, metrics_t *metric, int8_t (*compareFn)(void *a, void *b))
+{
+	in_memory_sort(spillWriter->page + es->headerSize, (uint32_t) spillWriter->count, es->record_size, compareFn, 1);
+	if (0 != bounded_add_run(runs, capacity, numRuns, spillWriter->file, spillWriter->state, spillWriter->writePos, 1))
+		return 8;
+	spillWriter->numblocks = 0;
+	return bounded_write_page(spillWriter, es, metric);
+}
+
+/**
+@brief     	Moves the record at position pos of the heap down to restore heap order.
+*/
+static void bounded_sift_down(char *heap, uint32_t count, uint32_t pos, char *tmp, external_sort_t *es, metrics_t *metric, int8_t (*compareFn)(void *a, void *b))
+{
+	uint16_t 	size = es->record_size;
+	uint32_t 	child;
+
+	while ((child = 2 * pos + 1) < count)
+	{
+		if (child + 1 < count)
+		{
+			metric->num_compar++;
+			if (compareFn(heap + (child + 1) * size, heap + child * size) < 0)
+				child++;
+		}
+		metric->num_compar++;
+		if (compareFn(heap + child * size, heap + pos * size) >= 0)
+			break;
+		memcpy(tmp, heap + pos * size, size);
+		memcpy(heap + pos * size, heap + child * size, size);
+		memcpy(heap + child * size, tmp, size);
+		metric->num_memcpys += 3;
+		pos = child;
+	}
+}
+
+/**
+@brief     	Adds a record to the heap.
+*/
+static void bounded_push(char *heap, uint32_t count, char *record, char *tmp, external_sort_t *es, metrics_t *metric, int8_t (*compareFn)(void *a, void *b))
+{
+	uint16_t 	size = es->record_size;
+	uint32_t 	pos = count, parent;
+
+	memcpy(heap + pos * size, record, size);
+	while (pos > 0)
+	{
+		parent = (pos - 1) / 2;
+		metric->num_compar++;
+		if (compareFn(heap + parent * size, heap + pos * size) <= 0)
+			break;
+		memcpy(tmp, heap + pos * size, size);
+		memcpy(heap + pos * size, heap + parent * size, size);
+		memcpy(heap + parent * size, tmp, size);
+		metric->num_memcpys += 3;
+		pos = parent;
+	}
+}
+
+/**
+@brief     	Merges sorted runs into one run. Uses one buffer block for each run and the last block for output.
+*/
+static int bounded_merge(bounded_run_t *runs, int8_t numRuns, bounded_writer_t *writer, char *buffer, external_sort_t *es, metrics_t *metric, int8_t (*compareFn)(void *a, void *b))
+{
+	uint32_t 	*pageNum = (uint32_t*) malloc(sizeof(uint32_t) * numRuns);		/* Current block of each run */
+	int16_t 	*slot = (int16_t*) malloc(sizeof(int16_t) * numRuns);			/* Current record in block of each run */
+	int8_t 		i, lowId;
+	char 		*tuple, *value, *page;
+	int 		err = 0;
+
+	if (NULL == pageNum || NULL == slot)
+	{
+		err = 8;
+		goto cleanup;
+	}
+	for (i=0; i < numRuns; i++)
+	{
+		pageNum[i] = 0;
+		slot[i] = 0;
+		if (0 != extern_sort_read_page(runs[i].file, runs[i].offset, buffer + i * es->page_size, runs[i].state, metric))
+		{
+			err = 10;
+			goto cleanup;
+		}
+	}
+
+	while (1)
+	{
+		lowId = -1;
+		tuple = NULL;
+		for (i=0; i < numRuns; i++)
+		{
+			if (pageNum[i] >= runs[i].num_pages)
+				continue;			/* Run has been completely used */
+			value = buffer + i * es->page_size + es->headerSize + slot[i] * es->record_size;
+			if (lowId >= 0)
+			{
+				metric->num_compar++;
+				if (compareFn(tuple, value) <= 0)
+					continue;
+			}
+			lowId = i;
+			tuple = value;
+		}
+		if (lowId < 0)
+			break;
+
+		if (0 != bounded_output(writer, tuple, es, metric))
+		{
+			err = 9;
+			goto cleanup;
+		}
+
+		page = buffer + lowId * es->page_size;
+		if (++slot[lowId] >= *((int16_t*) (page+BLOCK_COUNT_OFFSET)))
+		{
+			slot[lowId] = 0;
+			if (++pageNum[lowId] < runs[lowId].num_pages)
+			{
+				if (0 != extern_sort_read_page(runs[lowId].file, runs[lowId].offset + (long) pageNum[lowId] * es->page_size, page, runs[lowId].state, metric))
+				{
+					err = 10;
+					goto cleanup;
+				}
+			}
+		}
+	}
+	if (writer->count > 0)
+		err = bounded_write_page(writer, es, metric);
+
+cleanup:
+	free(slot);
+	free(pageNum);
+	return err;
+}
+
+/**
+@brief     	Sort for nearly sorted input where a record is at most maxDisplacement
+			records (or maxKeyDistance keys) away from its sorted position. A heap of
+			that many records slides over the input and its smallest record is
+			output, so sorted output is written in one pass. Records smaller than
+			the last record output break the bound and are spilled as sorted runs
+			to spillFile, then merged with the output at the end.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      file
+                Already opened file to store sorting output
+@param      spillFile
+                Already opened file to store records that break the bound
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 3). All but two blocks hold the heap.
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      maxDisplacement
+                Maximum number of records in heap (limited by buffer size)
+@param      maxKeyDistance
+                If greater than 0, records are also output when their int32 key is more than this less than the largest key read
+@param      resultFilePtr
+                Offset within output file of first output block
+@param      spilledRecords
+                Set to number of records that broke the bound (may be NULL)
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if out of memory, 9 on write error, 10 on read error.
+*/
+int extern_sort_bounded_disorder(
+	int (*iterator)(void *state, void* buffer),
+	void	*iteratorState,
+	ION_FILE *file,
+	ION_FILE *spillFile,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	external_sort_t *es,
+	uint32_t maxDisplacement,
+	int32_t maxKeyDistance,
+	long 	*resultFilePtr,
+	uint32_t *spilledRecords,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	printf("External sort of input with bounded disorder.\n");
+
+	uint16_t 	size = es->record_size;
+	int16_t 	recordsPerPage = (es->page_size - es->headerSize) / size;
+	uint32_t 	capacity = (uint32_t) (bufferSizeInBlocks - 2) * es->page_size / size;
+	uint32_t 	count = 0, numRecords = 0, numSpilled = 0;
+	char 		*heap = buffer;
+	char 		*spillPage = buffer + (bufferSizeInBlocks - 2) * es->page_size;
+	char 		*tuple = NULL, *tmp = NULL, *lastOutput = NULL;
+	int32_t 	maxKey = 0;
+	int8_t 		hasOutput = 0;
+	bounded_run_t *runs = NULL;
+	int32_t 	numRuns = 0, runCapacity = 0;
+	bounded_writer_t writer, spillWriter;
+	int 		err = 0;
+
+	/* Page cache is over the output file only */
+	external_sort_t spillState = *es;
+	spillState.cache = NULL;
+
+	if (bufferSizeInBlocks < 3)
+		return 8;
+	if (maxDisplacement > 0 && maxDisplacement < capacity)
+		capacity = maxDisplacement;
+
+	tuple = (char*) malloc(size);
+	tmp = (char*) malloc(size);
+	lastOutput = (char*) malloc(size);
+	if (NULL == tuple || NULL == tmp || NULL == lastOutput)
+	{
+		err = 8;
+		goto cleanup;
+	}
+
+	writer.file = file;
+	writer.state = es;
+	writer.page = buffer + (bufferSizeInBlocks - 1) * es->page_size;
+	writer.count = 0;
+	writer.numblocks = 0;
+	writer.writePos = 0;
+	spillWriter.file = spillFile;
+	spillWriter.state = &spillState;
+	spillWriter.page = spillPage;
+	spillWriter.count = 0;
+	spillWriter.numblocks = 0;
+	spillWriter.writePos = 0;
+
+	/* Single pass over input keeping a heap of the records that may still be out of order */
+	while (iterator(iteratorState, tuple))
+	{
+		numRecords++;
+		if (maxKeyDistance > 0 && (numRecords == 1 || *((int32_t*) tuple) > maxKey))
+			maxKey = *((int32_t*) tuple);
+
+		if (hasOutput)
+			metric->num_compar++;
+		if (hasOutput && compareFn(tuple, lastOutput) < 0)
+		{
+			/* Record is later than the bound allows. Spill block is sorted and written as a run when full. */
+			numSpilled++;
+			memcpy(spillPage + es->headerSize + spillWriter.count * size, tuple, size);
+			if (++spillWriter.count == recordsPerPage)
+			{
+				err = bounded_spill_run(&spillWriter, &runs, &runCapacity, &numRuns, es, metric, compareFn);
+				if (err)
+					goto cleanup;
+			}
+			continue;
+		}
+
+		if (count < capacity)
+		{
+			bounded_push(heap, count++, tuple, tmp, es, metric, compareFn);
+		}
+		else
+		{
+			/* Heap is full: output the smaller of the new record and the smallest record in heap */
+			metric->num_compar++;
+			if (compareFn(tuple, heap) <= 0)
+			{
+				memcpy(lastOutput, tuple, size);
+			}
+			else
+			{
+				memcpy(lastOutput, heap, size);
+				memcpy(heap, tuple, size);
+				bounded_sift_down(heap, count, 0, tmp, es, metric, compareFn);
+			}
+			hasOutput = 1;
+			err = bounded_output(&writer, lastOutput, es, metric);
+			if (err)
+				goto cleanup;
+		}
+
+		/* Output records that are too far behind the largest key */
+		while (maxKeyDistance > 0 && count > 0 && (int64_t) maxKey - *((int32_t*) heap) > maxKeyDistance)
+		{
+			memcpy(lastOutput, heap, size);
+			memcpy(heap, heap + (--count) * size, size);
+			bounded_sift_down(heap, count, 0, tmp, es, metric, compareFn);
+			hasOutput = 1;
+			err = bounded_output(&writer, lastOutput, es, metric);
+			if (err)
+				goto cleanup;
+		}
+	}
+	metric->num_reads += (numRecords + recordsPerPage - 1) / recordsPerPage;
+
+	/* Output rest of heap */
+	while (count > 0)
+	{
+		err = bounded_output(&writer, heap, es, metric);
+		if (err)
+			goto cleanup;
+		memcpy(heap, heap + (--count) * size, size);
+		bounded_sift_down(heap, count, 0, tmp, es, metric, compareFn);
+	}
+	if (writer.count > 0)
+	{
+		err = bounded_write_page(&writer, es, metric);
+		if (err)
+			goto cleanup;
+	}
+	*resultFilePtr = 0;
+	es->num_pages = writer.numblocks;
+
+	#if defined(DEBUG)
+		printf("Output blocks: %d  Records: %lu  Spilled: %lu\n", writer.numblocks, (unsigned long) numRecords, (unsigned long) numSpilled);
+	#endif
+
+	if (numSpilled > 0)
+	{
+		/* Write last partial spill block as a run. Spill merges use the output block. */
+		if (spillWriter.count > 0)
+		{
+			err = bounded_spill_run(&spillWriter, &runs, &runCapacity, &numRuns, es, metric, compareFn);
+			if (err)
+				goto cleanup;
+		}
+		spillWriter.page = writer.page;
+
+		/* Merge spill runs until they can be merged with the output in one pass */
+		int8_t 	maxRuns = bufferSizeInBlocks - 1;
+		int32_t run, numMerged;
+		while (numRuns > maxRuns - 1)
+		{
+			numMerged = 0;
+			for (run = 0; run < numRuns; run += maxRuns)
+			{
+				int8_t k = (numRuns - run) < maxRuns ? (int8_t) (numRuns - run) : maxRuns;
+				long start = spillWriter.writePos;
+				spillWriter.numblocks = 0;
+				err = bounded_merge(&runs[run], k, &spillWriter, buffer, es, metric, compareFn);
+				if (err)
+					goto cleanup;
+				runs[numMerged].file = spillFile;
+				runs[numMerged].state = &spillState;
+				runs[numMerged].offset = start;
+				runs[numMerged].num_pages = spillWriter.numblocks;
+				numMerged++;
+			}
+			numRuns = numMerged;
+		}
+
+		/* Final merge of output with spilled records is written after the output */
+		err = extern_sort_flush_pages(es, metric);
+		if (err)
+			goto cleanup;
+		err = bounded_add_run(&runs, &runCapacity, &numRuns, file, es, 0, writer.numblocks);
+		if (err)
+			goto cleanup;
+		*resultFilePtr = writer.writePos;
+		writer.numblocks = 0;
+		err = bounded_merge(runs, (int8_t) numRuns, &writer, buffer, es, metric, compareFn);
+		if (err)
+			goto cleanup;
+		es->num_pages = writer.numblocks;
+	}
+	err = extern_sort_flush_pages(es, metric);
+
+cleanup:
+	if (NULL != spilledRecords)
+		*spilledRecords = numSpilled;
+	free(runs);
+	free(lastOutput);
+	free(tmp);
+	free(tuple);
+	return err;
+}
@@ -0,0 +1,208 @@
+/******************************************************************************/
+/**
+@file		external_sort_key.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		Record comparison functions built from multi-field sort key
+			descriptors.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdint.h>
+#include <string.h>
+
+#include "external_sort_key.h"
+
+/**
+@brief		Key field compiled to a comparison function.
+*/
+typedef struct {
+	int8_t 		(*compare)(char *a, char *b, uint16_t width);
+	uint16_t 	offset;
+	uint16_t 	width;
+	int8_t 		descending;
+} sort_key_compiled_t;
+
+/* Descriptor used by comparators. Fields are read with memcpy as their offsets may not be aligned. */
+static sort_key_compiled_t 	keyFields[SORT_KEY_MAX_FIELDS];
+static uint8_t 				numKeyFields;
+
+#define    SORT_KEY_COMPARE(type, a, b)  { type x, y; (void) width; memcpy(&x, a, sizeof(type)); memcpy(&y, b, sizeof(type)); return (x < y) ? -1 : (x > y); }
+
+static int8_t compare_int8(char *a, char *b, uint16_t width) SORT_KEY_COMPARE(int8_t, a, b)
+static int8_t compare_int16(char *a, char *b, uint16_t width) SORT_KEY_COMPARE(int16_t, a, b)
+static int8_t compare_int32(char *a, char *b, uint16_t width) SORT_KEY_COMPARE(int32_t, a, b)
+static int8_t compare_int64(char *a, char *b, uint16_t width) SORT_KEY_COMPARE(int64_t, a, b)
+static int8_t compare_uint8(char *a, char *b, uint16_t width) SORT_KEY_COMPARE(uint8_t, a, b)
+static int8_t compare_uint16(char *a, char *b, uint16_t width) SORT_KEY_COMPARE(uint16_t, a, b)
+static int8_t compare_uint32(char *a, char *b, uint16_t width) SORT_KEY_COMPARE(uint32_t, a, b)
+static int8_t compare_uint64(char *a, char *b, uint16_t width) SORT_KEY_COMPARE(uint64_t, a, b)
+static int8_t compare_float(char *a, char *b, uint16_t width) SORT_KEY_COMPARE(float, a, b)
+static int8_t compare_double(char *a, char *b, uint16_t width) SORT_KEY_COMPARE(double, a, b)
+
+static int8_t compare_bytes(char *a, char *b, uint16_t width)
+{
+	int result = memcmp(a, b, width);
+	return (result < 0) ? -1 : (result > 0);
+}
+
+/**
+@brief     	Compares records on any number of fields.
+*/
+static int8_t sort_key_compare(void *a, void *b)
+{
+	uint8_t i;
+	int8_t 	result;
+
+	for (i=0; i < numKeyFields; i++)
+	{
+		sort_key_compiled_t *field = &keyFields[i];
+		result = field->compare((char*) a + field->offset, (char*) b + field->offset, field->width);
+		if (result != 0)
+			return field->descending ? -result : result;
+	}
+	return 0;
+}
+
+/**
+@brief     	Compares records on two ascending int32 fields.
+*/
+static int8_t sort_key_compare_int32_int32(void *a, void *b)
+{
+	int32_t x, y;
+	memcpy(&x, (char*) a + keyFields[0].offset, sizeof(int32_t));
+	memcpy(&y, (char*) b + keyFields[0].offset, sizeof(int32_t));
+	if (x != y)
+		return (x < y) ? -1 : 1;
+	memcpy(&x, (char*) a + keyFields[1].offset, sizeof(int32_t));
+	memcpy(&y, (char*) b + keyFields[1].offset, sizeof(int32_t));
+	return (x < y) ? -1 : (x > y);
+}
+
+/**
+@brief     	Compares records on an ascending int32 field then an ascending uint64 field.
+*/
+static int8_t sort_key_compare_int32_uint64(void *a, void *b)
+{
+	int32_t x, y;
+	memcpy(&x, (char*) a + keyFields[0].offset, sizeof(int32_t));
+	memcpy(&y, (char*) b + keyFields[0].offset, sizeof(int32_t));
+	if (x != y)
+		return (x < y) ? -1 : 1;
+
+	uint64_t u, v;
+	memcpy(&u, (char*) a + keyFields[1].offset, sizeof(uint64_t));
+	memcpy(&v, (char*) b + keyFields[1].offset, sizeof(uint64_t));
+	return (u < v) ? -1 : (u > v);
+}
+
+/**
+@brief     	Returns the comparison function for a field type and width or NULL if not supported.
+*/
+static int8_t (*sort_key_field_compare(sort_key_field_t *field))(char *a, char *b, uint16_t width)
+{
+	switch (field->type)
+	{
+		case SORT_KEY_INT:
+			switch (field->width)
+			{
+				case 1: return compare_int8;
+				case 2: return compare_int16;
+				case 4: return compare_int32;
+				case 8: return compare_int64;
+			}
+			break;
+		case SORT_KEY_UINT:
+			switch (field->width)
+			{
+				case 1: return compare_uint8;
+				case 2: return compare_uint16;
+				case 4: return compare_uint32;
+				case 8: return compare_uint64;
+			}
+			break;
+		case SORT_KEY_FLOAT:
+			switch (field->width)
+			{
+				case 4: return compare_float;
+				case 8: return compare_double;
+			}
+			break;
+		case SORT_KEY_BYTES:
+			if (field->width > 0)
+				return compare_bytes;
+			break;
+	}
+	return NULL;
+}
+
+/**
+@brief     	Builds a record comparison function from the key descriptor in
+			es->key_fields. Fields are compared in order with the direction of each
+			field. Two ascending int32 fields and an ascending int32 followed by an
+			ascending uint64 use specialized comparators. Otherwise each field is
+			compared by a function selected for its type and width when the
+			comparator is built. Only the last descriptor built is used by the
+			returned comparator. An invalid descriptor does not change it.
+@param      es
+                Sorting state info (key descriptor)
+@return		Comparison function or NULL if the descriptor is invalid (no fields,
+			more than SORT_KEY_MAX_FIELDS, or unsupported type and width).
+*/
+sort_compare_fcn_t extern_sort_key_comparator(external_sort_t *es)
+{
+	sort_key_compiled_t 	compiled[SORT_KEY_MAX_FIELDS];
+	uint8_t i;
+
+	if (NULL == es->key_fields || es->num_key_fields == 0 || es->num_key_fields > SORT_KEY_MAX_FIELDS)
+		return NULL;
+
+	/* Check every field before replacing the descriptor used by comparators already returned */
+	for (i=0; i < es->num_key_fields; i++)
+	{
+		sort_key_field_t *field = &es->key_fields[i];
+		compiled[i].compare = sort_key_field_compare(field);
+		if (NULL == compiled[i].compare)
+			return NULL;
+		compiled[i].offset = field->offset;
+		compiled[i].width = field->width;
+		compiled[i].descending = (field->direction == SORT_KEY_DESC);
+	}
+	memcpy(keyFields, compiled, sizeof(sort_key_compiled_t) * es->num_key_fields);
+	numKeyFields = es->num_key_fields;
+
+	if (numKeyFields == 2 && !keyFields[0].descending && !keyFields[1].descending && keyFields[0].compare == compare_int32)
+	{
+		if (keyFields[1].compare == compare_int32)
+			return sort_key_compare_int32_int32;
+		if (keyFields[1].compare == compare_uint64)
+			return sort_key_compare_int32_uint64;
+	}
+	return sort_key_compare;
+}
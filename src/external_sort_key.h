@@ -0,0 +1,70 @@
+/******************************************************************************/
+/**
+@file		external_sort_key.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		This file contains declarations for building record comparison
+			functions from sort key descriptors.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "external_sort.h"
+
+/* Maximum number of fields in a sort key descriptor */
+#define    SORT_KEY_MAX_FIELDS      8
+
+/**
+@brief		Record comparison function (negative, zero or positive as a is before, equal to or after b).
+*/
+typedef int8_t (*sort_compare_fcn_t)(void *a, void *b);
+
+/**
+@brief     	Builds a record comparison function from the key descriptor in
+			es->key_fields. Fields are compared in order with the direction of each
+			field. Two ascending int32 fields and an ascending int32 followed by an
+			ascending uint64 use specialized comparators. Otherwise each field is
+			compared by a function selected for its type and width when the
+			comparator is built. Only the last descriptor built is used by the
+			returned comparator. An invalid descriptor does not change it.
+@param      es
+                Sorting state info (key descriptor)
+@return		Comparison function or NULL if the descriptor is invalid (no fields,
+			more than SORT_KEY_MAX_FIELDS, or unsupported type and width).
+*/
+sort_compare_fcn_t extern_sort_key_comparator(external_sort_t *es);
+
+#if defined(__cplusplus)
+}
+#endif
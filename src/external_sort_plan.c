@@ -0,0 +1,183 @@
+/******************************************************************************/
+/**
+@file		external_sort_plan.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		Sort planner choosing page size, buffer size and sort method for a memory budget and device.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_distribution_sort.h"
+#include "external_sort_plan.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief     	Plans a sort for a memory budget. Every page size from SORT_PLAN_MIN_PAGE_SIZE
+			(or the device I/O unit if larger and 3 blocks of it fit in the budget)
+			up to SORT_PLAN_MAX_PAGE_SIZE that leaves at least 3 blocks in the budget
+			is tried with the largest buffer that fits and both merge sort and
+			distribution sort. The plan with the lowest cost on the device is chosen.
+			Both methods read and write every block once to create runs or buckets
+			and once for each pass after that. Merge passes alternate reading runs
+			and writing output so every merge read and write is counted as a seek.
+			Distribution writes to buckets and reads buckets back in any order so
+			all but the input and output are counted as seeks.
+@param      es
+                Sorting state info (record size, header size, expected input in num_pages blocks of page_size)
+@param      budget
+                Bytes of memory for the buffer and one record (tupleBuffer)
+@param      profile
+                Device costs (from extern_sort_tune_device() or the device datasheet)
+@param      plan
+                Set to the chosen plan
+@return		0 on success, 8 if the budget does not have room for 3 blocks of the smallest page size.
+*/
+int extern_sort_plan(
+	external_sort_t *es,
+	uint32_t budget,
+	sort_device_profile_t *profile,
+	sort_plan_t *plan)
+{
+	external_sort_t 	candidate = *es;
+	uint32_t 	numRecords = es->num_pages * ((es->page_size - es->headerSize) / es->record_size);
+	uint32_t 	pageSize;
+	int32_t 	mergeWrites, distributionWrites;
+	int8_t 		method;
+	int 		found = 0;
+
+	for (pageSize = SORT_PLAN_MIN_PAGE_SIZE; pageSize < profile->io_unit && 6 * pageSize + es->record_size <= budget; pageSize *= 2)
+		;
+	for (; pageSize <= SORT_PLAN_MAX_PAGE_SIZE; pageSize *= 2)
+	{
+		int32_t tuplesPerPage = (pageSize - es->headerSize) / es->record_size;
+		int32_t blocks = (budget - es->record_size) / pageSize;
+		if (budget < es->record_size || blocks < 3)
+			break;
+		if (tuplesPerPage < 1)
+			continue;
+		if (blocks > SORT_PLAN_MAX_BLOCKS)
+			blocks = SORT_PLAN_MAX_BLOCKS;
+
+		candidate.page_size = pageSize;
+		candidate.num_pages = (numRecords + tuplesPerPage - 1) / tuplesPerPage;
+		extern_sort_choose_method(&candidate, blocks, &mergeWrites, &distributionWrites);
+
+		for (method = EXTERNAL_SORT_METHOD_MERGE; method <= EXTERNAL_SORT_METHOD_DISTRIBUTION; method++)
+		{
+			sort_plan_t p;
+			uint32_t pages = candidate.num_pages;
+
+			p.page_size = pageSize;
+			p.buffer_blocks = blocks;
+			p.method = method;
+			p.num_pages = pages;
+			if (method == EXTERNAL_SORT_METHOD_MERGE)
+			{
+				p.fan_in = blocks - 1;
+				p.writes = mergeWrites;
+				p.seeks = 2 * (mergeWrites - pages);
+			}
+			else
+			{
+				if (INT32_MAX == distributionWrites)
+					continue;
+				p.fan_in = blocks;
+				p.writes = distributionWrites;
+				p.seeks = (distributionWrites > 2 * pages) ? 2 * (distributionWrites - pages) : 0;
+			}
+			p.reads = p.writes;
+			p.passes = (pages > 0) ? (p.writes - pages) / pages : 0;
+			p.cost = (double) p.reads * profile->read_cost * pageSize / 512
+					+ (double) p.writes * profile->write_cost * pageSize / 512
+					+ (double) p.seeks * profile->seek_cost;
+
+			#if defined(DEBUG)
+				printf("Plan page size: %u blocks: %d method: %d passes: %d reads: %lu writes: %lu seeks: %lu cost: %.0f\n",
+					p.page_size, p.buffer_blocks, p.method, p.passes, (unsigned long) p.reads, (unsigned long) p.writes, (unsigned long) p.seeks, p.cost);
+			#endif
+
+			if (!found || p.cost < plan->cost)
+			{
+				*plan = p;
+				found = 1;
+			}
+		}
+	}
+	return found ? 0 : 8;
+}
+
+/**
+@brief     	Sets the page size and number of input pages of the sorting state from a plan.
+@param      plan
+                Plan from extern_sort_plan()
+@param      es
+                Sorting state info to update
+*/
+void extern_sort_apply_plan(
+	sort_plan_t *plan,
+	external_sort_t *es)
+{
+	es->page_size = plan->page_size;
+	es->num_pages = plan->num_pages;
+}
+
+/**
+@brief     	Compares the block reads and writes of a sort with its plan. A difference
+			of more than SORT_PLAN_TOLERANCE percent means the plan was made for a
+			different input size or configuration than the sort used.
+@param      plan
+                Plan from extern_sort_plan()
+@param      metric
+                Metrics of the sort run with the plan
+@return		0 if the sort matched the plan, 1 if not.
+*/
+int8_t extern_sort_check_plan(
+	sort_plan_t *plan,
+	metrics_t *metric)
+{
+	uint32_t predicted = plan->reads + plan->writes;
+	uint32_t actual = metric->num_reads + metric->num_writes;
+	uint32_t difference = (actual > predicted) ? actual - predicted : predicted - actual;
+
+	if ((uint64_t) difference * 100 <= (uint64_t) predicted * SORT_PLAN_TOLERANCE)
+		return 0;
+
+	printf("Sort did not match plan. Predicted reads: %lu writes: %lu passes: %d Actual reads: %lu writes: %lu\n",
+		(unsigned long) plan->reads, (unsigned long) plan->writes, plan->passes, (unsigned long) metric->num_reads, (unsigned long) metric->num_writes);
+	return 1;
+}
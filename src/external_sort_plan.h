@@ -0,0 +1,136 @@
+/******************************************************************************/
+/**
+@file		external_sort_plan.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		Sort planner choosing page size, buffer size and sort method for a memory budget and device.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/* Smallest and largest page sizes considered by the planner */
+#define    SORT_PLAN_MIN_PAGE_SIZE      512
+#define    SORT_PLAN_MAX_PAGE_SIZE      16384
+
+/* Largest buffer in blocks (merge fan-in is stored in an int8_t) */
+#define    SORT_PLAN_MAX_BLOCKS         128
+
+/* Percent difference between predicted and actual I/Os accepted by extern_sort_check_plan() */
+#define    SORT_PLAN_TOLERANCE          25
+
+typedef struct {
+    uint32_t    read_cost;      /* Cost of reading 512 bytes */
+    uint32_t    write_cost;     /* Cost of writing 512 bytes */
+    uint32_t    seek_cost;      /* Extra cost of a read or write not at the current file position */
+    uint16_t    io_unit;        /* Smallest transfer the device does efficiently in bytes (0 if unknown) */
+} sort_device_profile_t;
+
+typedef struct {
+    uint16_t    page_size;          /* Block size in bytes */
+    int16_t     buffer_blocks;      /* Buffer size in blocks (bufferSizeInBlocks) */
+    int16_t     fan_in;             /* Runs merged at a time or buckets per distribution step */
+    int8_t      method;             /* EXTERNAL_SORT_METHOD_MERGE or EXTERNAL_SORT_METHOD_DISTRIBUTION */
+    int16_t     passes;             /* Passes over the data after run generation or the first distribution */
+    uint32_t    num_pages;          /* Input size in blocks of page_size */
+    uint32_t    reads;              /* Predicted block reads (including reading the input) */
+    uint32_t    writes;             /* Predicted block writes */
+    uint32_t    seeks;              /* Predicted reads and writes not at the current file position */
+    double      cost;               /* Predicted cost using the device profile */
+} sort_plan_t;
+
+/**
+@brief     	Plans a sort for a memory budget. Every page size from SORT_PLAN_MIN_PAGE_SIZE
+			(or the device I/O unit if larger and 3 blocks of it fit in the budget)
+			up to SORT_PLAN_MAX_PAGE_SIZE that leaves at least 3 blocks in the budget
+			is tried with the largest buffer that fits and both merge sort and
+			distribution sort. The plan with the lowest cost on the device is chosen.
+			Both methods read and write every block once to create runs or buckets
+			and once for each pass after that. Merge passes alternate reading runs
+			and writing output so every merge read and write is counted as a seek.
+			Distribution writes to buckets and reads buckets back in any order so
+			all but the input and output are counted as seeks.
+@param      es
+                Sorting state info (record size, header size, expected input in num_pages blocks of page_size)
+@param      budget
+                Bytes of memory for the buffer and one record (tupleBuffer)
+@param      profile
+                Device costs (from extern_sort_tune_device() or the device datasheet)
+@param      plan
+                Set to the chosen plan
+@return		0 on success, 8 if the budget does not have room for 3 blocks of the smallest page size.
+*/
+int extern_sort_plan(
+	external_sort_t *es,
+	uint32_t budget,
+	sort_device_profile_t *profile,
+	sort_plan_t *plan);
+
+/**
+@brief     	Sets the page size and number of input pages of the sorting state from a plan.
+@param      plan
+                Plan from extern_sort_plan()
+@param      es
+                Sorting state info to update
+*/
+void extern_sort_apply_plan(
+	sort_plan_t *plan,
+	external_sort_t *es);
+
+/**
+@brief     	Compares the block reads and writes of a sort with its plan. A difference
+			of more than SORT_PLAN_TOLERANCE percent means the plan was made for a
+			different input size or configuration than the sort used.
+@param      plan
+                Plan from extern_sort_plan()
+@param      metric
+                Metrics of the sort run with the plan
+@return		0 if the sort matched the plan, 1 if not.
+*/
+int8_t extern_sort_check_plan(
+	sort_plan_t *plan,
+	metrics_t *metric);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,228 @@
+/******************************************************************************/
+/**
+@file		external_sort_tune.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		Device microbenchmark that measures storage costs for the sort planner.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(ARDUINO)
+#include "Arduino.h"
+#else
+#include <time.h>
+#endif
+
+#include "external_sort_plan.h"
+#include "external_sort_tune.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief     	Returns a time in microseconds.
+*/
+static uint32_t tune_micros(void)
+{
+	#if defined(ARDUINO)
+		return micros();
+	#else
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (uint32_t) ((uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000);
+	#endif
+}
+
+/**
+@brief     	Times reading or writing numOps blocks of size bytes. Blocks are consecutive
+			from the start of the file or at random block offsets in numBlocks blocks.
+@return		Nanoseconds per operation or UINT32_MAX on I/O error.
+*/
+static uint32_t tune_time(ION_FILE *file, char *buffer, uint32_t size, uint32_t numBlocks, uint32_t numOps, int8_t write, int8_t random)
+{
+	uint32_t 	i, start = tune_micros();
+
+	fseek(file, 0, SEEK_SET);
+	for (i=0; i < numOps; i++)
+	{
+		if (random)
+			fseek(file, (long) ((uint32_t) rand() % numBlocks) * size, SEEK_SET);
+		if (write)
+		{
+			if (0 == fwrite(buffer, size, 1, file))
+				return UINT32_MAX;
+		}
+		else if (0 == fread(buffer, size, 1, file))
+			return UINT32_MAX;
+	}
+	if (write)
+		fflush(file);
+	return (uint32_t) ((uint64_t) (tune_micros() - start) * 1000 / numOps);
+}
+
+/**
+@brief     	Measures a storage device with a scratch file and creates a device profile
+			for extern_sort_plan(). For each block size from TUNE_MIN_SIZE up to
+			TUNE_MAX_SIZE (limited by bufferSize) the file is written and read
+			sequentially and read and written at random block offsets. Read and
+			write costs are the sequential transfer times of the largest size.
+			The seek cost is the extra time of a random 512 byte read or write over
+			a sequential one. The I/O unit is the largest size whose random read
+			takes at most TUNE_UNIT_PERCENT percent of the time of a 512 byte random
+			read, as the device transfers at least that much for any read.
+@param      file
+                Scratch file opened for reading and writing. Its contents are overwritten.
+@param      buffer
+                Pre-allocated space for one transfer
+@param      bufferSize
+                Size of buffer in bytes (at least TUNE_MIN_SIZE)
+@param      fileSize
+                Bytes of scratch file to use. Larger than the device and operating system caches gives more accurate results.
+@param      profile
+                Set to the measured device profile (nanoseconds)
+@return		0 on success, 8 if buffer is too small, 9 on write error, 10 on read error.
+*/
+int extern_sort_tune_device(
+	ION_FILE *file,
+	char 	*buffer,
+	uint32_t bufferSize,
+	uint32_t fileSize,
+	sort_device_profile_t *profile)
+{
+	uint32_t 	size, numBlocks, numOps;
+	uint32_t 	seqRead, seqWrite, randRead, randWrite;
+	uint32_t 	firstRandRead = 0, firstSeqRead = 0, firstRandWrite = 0, firstSeqWrite = 0;
+
+	if (bufferSize < TUNE_MIN_SIZE || fileSize < TUNE_MIN_SIZE)
+		return 8;
+
+	printf("Measuring storage device with %lu byte file.\n", (unsigned long) fileSize);
+	memset(buffer, 0xA5, bufferSize);
+	profile->io_unit = TUNE_MIN_SIZE;
+
+	for (size = TUNE_MIN_SIZE; size <= TUNE_MAX_SIZE && size <= bufferSize && size <= fileSize; size *= 2)
+	{
+		numBlocks = fileSize / size;
+		numOps = (numBlocks / 4 > TUNE_MIN_OPS) ? numBlocks / 4 : TUNE_MIN_OPS;
+
+		seqWrite = tune_time(file, buffer, size, numBlocks, numBlocks, 1, 0);
+		if (UINT32_MAX == seqWrite)
+			return 9;
+		seqRead = tune_time(file, buffer, size, numBlocks, numBlocks, 0, 0);
+		if (UINT32_MAX == seqRead)
+			return 10;
+		randRead = tune_time(file, buffer, size, numBlocks, numOps, 0, 1);
+		if (UINT32_MAX == randRead)
+			return 10;
+		randWrite = tune_time(file, buffer, size, numBlocks, numOps, 1, 1);
+		if (UINT32_MAX == randWrite)
+			return 9;
+
+		#if defined(DEBUG)
+			printf("Size: %lu Sequential read: %lu write: %lu Random read: %lu write: %lu (ns per operation)\n",
+				(unsigned long) size, (unsigned long) seqRead, (unsigned long) seqWrite, (unsigned long) randRead, (unsigned long) randWrite);
+		#endif
+
+		if (size == TUNE_MIN_SIZE)
+		{
+			firstSeqRead = seqRead;
+			firstSeqWrite = seqWrite;
+			firstRandRead = randRead;
+			firstRandWrite = randWrite;
+		}
+		else if ((uint64_t) randRead * 100 <= (uint64_t) firstRandRead * TUNE_UNIT_PERCENT)
+			profile->io_unit = size;
+
+		/* Costs per 512 bytes from the largest transfers */
+		profile->read_cost = (uint32_t) ((uint64_t) seqRead * 512 / size);
+		profile->write_cost = (uint32_t) ((uint64_t) seqWrite * 512 / size);
+	}
+
+	profile->seek_cost = ((firstRandRead > firstSeqRead ? firstRandRead - firstSeqRead : 0)
+						+ (firstRandWrite > firstSeqWrite ? firstRandWrite - firstSeqWrite : 0)) / 2;
+
+	printf("Device profile read: %lu write: %lu seek: %lu I/O unit: %u\n", (unsigned long) profile->read_cost,
+		(unsigned long) profile->write_cost, (unsigned long) profile->seek_cost, profile->io_unit);
+	return 0;
+}
+
+/**
+@brief     	Saves a device profile to a file.
+@param      fileName
+                Name of profile file
+@param      profile
+                Device profile to save
+@return		0 on success, 9 on write error.
+*/
+int extern_sort_save_profile(
+	char 	*fileName,
+	sort_device_profile_t *profile)
+{
+	uint32_t 	magic = TUNE_PROFILE_MAGIC;
+	ION_FILE 	*file = fopen(fileName, "w+b");
+	int 		err = 0;
+
+	if (NULL == file)
+		return 9;
+	if (0 == fwrite(&magic, sizeof(magic), 1, file) || 0 == fwrite(profile, sizeof(sort_device_profile_t), 1, file))
+		err = 9;
+	fclose(file);
+	return err;
+}
+
+/**
+@brief     	Loads a device profile saved by extern_sort_save_profile().
+@param      fileName
+                Name of profile file
+@param      profile
+                Set to the saved device profile
+@return		0 on success, 10 if there is no valid profile in the file.
+*/
+int extern_sort_load_profile(
+	char 	*fileName,
+	sort_device_profile_t *profile)
+{
+	uint32_t 	magic = 0;
+	ION_FILE 	*file = fopen(fileName, "rb");
+	int 		err = 0;
+
+	if (NULL == file)
+		return 10;
+	if (0 == fread(&magic, sizeof(magic), 1, file) || TUNE_PROFILE_MAGIC != magic
+		|| 0 == fread(profile, sizeof(sort_device_profile_t), 1, file))
+		err = 10;
+	fclose(file);
+	return err;
+}
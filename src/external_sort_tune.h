@@ -0,0 +1,120 @@
+/******************************************************************************/
+/**
+@file		external_sort_tune.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		Device microbenchmark that measures storage costs for the sort planner.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/* Smallest and largest transfer sizes measured in bytes */
+#define    TUNE_MIN_SIZE            512
+#define    TUNE_MAX_SIZE            16384
+
+/* Fewest random reads and writes timed for a transfer size */
+#define    TUNE_MIN_OPS             16
+
+/* Largest random read time for the I/O unit as a percent of a TUNE_MIN_SIZE random read */
+#define    TUNE_UNIT_PERCENT        120
+
+/* Identifies a saved device profile */
+#define    TUNE_PROFILE_MAGIC       0x54554E45
+
+/**
+@brief     	Measures a storage device with a scratch file and creates a device profile
+			for extern_sort_plan(). For each block size from TUNE_MIN_SIZE up to
+			TUNE_MAX_SIZE (limited by bufferSize) the file is written and read
+			sequentially and read and written at random block offsets. Read and
+			write costs are the sequential transfer times of the largest size.
+			The seek cost is the extra time of a random 512 byte read or write over
+			a sequential one. The I/O unit is the largest size whose random read
+			takes at most TUNE_UNIT_PERCENT percent of the time of a 512 byte random
+			read, as the device transfers at least that much for any read.
+@param      file
+                Scratch file opened for reading and writing. Its contents are overwritten.
+@param      buffer
+                Pre-allocated space for one transfer
+@param      bufferSize
+                Size of buffer in bytes (at least TUNE_MIN_SIZE)
+@param      fileSize
+                Bytes of scratch file to use. Larger than the device and operating system caches gives more accurate results.
+@param      profile
+                Set to the measured device profile (nanoseconds)
+@return		0 on success, 8 if buffer is too small, 9 on write error, 10 on read error.
+*/
+int extern_sort_tune_device(
+	ION_FILE *file,
+	char 	*buffer,
+	uint32_t bufferSize,
+	uint32_t fileSize,
+	sort_device_profile_t *profile);
+
+/**
+@brief     	Saves a device profile to a file.
+@param      fileName
+                Name of profile file
+@param      profile
+                Device profile to save
+@return		0 on success, 9 on write error.
+*/
+int extern_sort_save_profile(
+	char 	*fileName,
+	sort_device_profile_t *profile);
+
+/**
+@brief     	Loads a device profile saved by extern_sort_save_profile().
+@param      fileName
+                Name of profile file
+@param      profile
+                Set to the saved device profile
+@return		0 on success, 10 if there is no valid profile in the file.
+*/
+int extern_sort_load_profile(
+	char 	*fileName,
+	sort_device_profile_t *profile);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,572 @@
+/******************************************************************************/
+/**
+@file		external_sorted_store.c
+@author		Riley Jackson, Ramon Lawrence
+@brief		Incremental sorted store. Inserted records are buffered in memory,
+			written as sorted runs and merged by size tier.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "external_merge_sort_iterator_block.h"
+#include "external_sorted_store.h"
+#include "in_memory_sort.h"
+
+/*
+#define DEBUG  1
+*/
+
+/**
+@brief     	Returns offset of a free region of the file with the given number of blocks.
+			The first free region that is large enough is used, otherwise the file is extended.
+*/
+static long store_allocate(sorted_store_t *store, uint32_t numPages)
+{
+	int8_t 	i;
+	long 	offset;
+
+	for (i=0; i < store->numFree; i++)
+	{
+		if (store->freeList[i].num_pages >= numPages)
+		{
+			offset = store->freeList[i].offset;
+			store->freeList[i].offset += (long) numPages * store->es->page_size;
+			store->freeList[i].num_pages -= numPages;
+			if (store->freeList[i].num_pages == 0)
+			{
+				memmove(&store->freeList[i], &store->freeList[i+1], sizeof(sorted_store_extent_t) * (store->numFree - i - 1));
+				store->numFree--;
+			}
+			return offset;
+		}
+	}
+	offset = store->endOffset;
+	store->endOffset += (long) numPages * store->es->page_size;
+	return offset;
+}
+
+/**
+@brief     	Returns a region of the file to the free list, combining it with adjacent free regions.
+			The region is not reused if the free list is full.
+*/
+static void store_release(sorted_store_t *store, long offset, uint32_t numPages)
+{
+	int8_t 	i;
+	long 	pageSize = store->es->page_size;
+
+	if (numPages == 0)
+		return;
+
+	/* Find position in list sorted by offset */
+	for (i=0; i < store->numFree && store->freeList[i].offset < offset; i++);
+
+	if (i > 0 && store->freeList[i-1].offset + (long) store->freeList[i-1].num_pages * pageSize == offset)
+	{
+		/* Extend previous region and combine with next region if they now touch */
+		i--;
+		store->freeList[i].num_pages += numPages;
+		if (i+1 < store->numFree && store->freeList[i].offset + (long) store->freeList[i].num_pages * pageSize == store->freeList[i+1].offset)
+		{
+			store->freeList[i].num_pages += store->freeList[i+1].num_pages;
+			memmove(&store->freeList[i+1], &store->freeList[i+2], sizeof(sorted_store_extent_t) * (store->numFree - i - 2));
+			store->numFree--;
+		}
+	}
+	else if (i < store->numFree && offset + (long) numPages * pageSize == store->freeList[i].offset)
+	{
+		store->freeList[i].offset = offset;
+		store->freeList[i].num_pages += numPages;
+	}
+	else
+	{
+		if (store->numFree == SORTED_STORE_MAX_FREE)
+			return;
+		memmove(&store->freeList[i+1], &store->freeList[i], sizeof(sorted_store_extent_t) * (store->numFree - i));
+		store->freeList[i].offset = offset;
+		store->freeList[i].num_pages = numPages;
+		store->numFree++;
+	}
+
+	/* Free region at the end of the file shortens the file */
+	i = store->numFree - 1;
+	if (store->freeList[i].offset + (long) store->freeList[i].num_pages * pageSize == store->endOffset)
+	{
+		store->endOffset = store->freeList[i].offset;
+		store->numFree--;
+	}
+}
+
+/**
+@brief     	Writes the output block of a merge or flush and advances the write position.
+*/
+static int store_write_page(sorted_store_t *store, char *page, int32_t blockIndex, int16_t count, long *writePos)
+{
+	*((int32_t*) page) = blockIndex;								/* Block index */
+	*((int16_t*) (page+BLOCK_COUNT_OFFSET)) = count;				/* Block record count */
+	if (0 != extern_sort_write_page(store->file, *writePos, page, store->es, store->metric))
+		return 9;
+	*writePos += store->es->page_size;
+	return 0;
+}
+
+/**
+@brief     	Merges runs into one run that replaces the first of them.
+*/
+static int store_merge(sorted_store_t *store, int8_t *ids, int8_t numIds)
+{
+	external_sort_t *es = store->es;
+	metrics_t 	*metric = store->metric;
+	char 		*mergeBuffer = store->buffer + store->memtableBlocks * es->page_size;
+	char 		*outputBuffer = store->buffer + (store->bufferSizeInBlocks - 1) * es->page_size;
+	int16_t 	recordsPerPage = (es->page_size - es->headerSize) / es->record_size;
+	int16_t 	outputPerPage = (es->page_size - es->headerSize - 1) / es->record_size;
+	long 		runOffset[SORTED_STORE_MAX_RUNS];
+	int32_t 	runCount[SORTED_STORE_MAX_RUNS];
+	int32_t 	runPos[SORTED_STORE_MAX_RUNS];
+	uint32_t 	totalPages = 0, outputPages;
+	int32_t 	numBlocks = 0;
+	int8_t 		i, tier = 0;
+	long 		start, writePos;
+	int 		err;
+	sorted_store_run_t *run;
+
+	for (i=0; i < numIds; i++)
+	{
+		run = &store->runs[ids[i]];
+		totalPages += run->num_pages;
+		if (run->tier > tier)
+			tier = run->tier;
+		runOffset[i] = run->offset;
+		runCount[i] = run->num_pages;
+	}
+
+	/* Merge output blocks are written when there is no room for one more record, so may hold one record less than run blocks */
+	if (outputPerPage < 1)
+		outputPerPage = 1;
+	outputPages = (totalPages * recordsPerPage + outputPerPage - 1) / outputPerPage;
+	start = store_allocate(store, outputPages);
+	writePos = start;
+
+	err = extern_sort_merge_runs(store->file, runOffset, runCount, runPos, numIds, mergeBuffer, outputBuffer, &writePos, &numBlocks, es, metric, store->compareFn);
+	if (0 != err)
+		return err;
+
+	#if defined(DEBUG)
+		printf("Merged %d runs of %lu blocks into tier %d run of %d blocks at %li\n", numIds, (unsigned long) totalPages, tier+1, numBlocks, start);
+	#endif
+
+	/* Free input runs and unused end of output then replace first input run with the output */
+	store_release(store, writePos, outputPages - numBlocks);
+	for (i=0; i < numIds; i++)
+		store_release(store, store->runs[ids[i]].offset, store->runs[ids[i]].num_pages);
+	run = &store->runs[ids[0]];
+	run->offset = start;
+	run->num_pages = numBlocks;
+	run->tier = tier + 1;
+	for (i=numIds-1; i > 0; i--)
+	{
+		memmove(&store->runs[ids[i]], &store->runs[ids[i]+1], sizeof(sorted_store_run_t) * (store->numRuns - ids[i] - 1));
+		store->numRuns--;
+	}
+	return 0;
+}
+
+/**
+@brief     	Initializes an empty sorted store.
+@param      store
+                Store to initialize
+@param      file
+                Already opened file to store runs
+@param      buffer
+                Pre-allocated space used by the store
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      memtableBlocks
+                Blocks of buffer used for the memtable. At least 3 blocks must be left for merging.
+@param      tierFanIn
+                Number of runs of a tier merged together (at most blocks left for merging - 1)
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if the buffer is too small for the memtable and merging.
+*/
+int extern_sorted_store_init(
+	sorted_store_t *store,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	int 	memtableBlocks,
+	int8_t 	tierFanIn,
+	external_sort_t *es,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b))
+{
+	if (memtableBlocks < 1 || bufferSizeInBlocks - memtableBlocks < 3 || tierFanIn < 2
+		|| tierFanIn > bufferSizeInBlocks - memtableBlocks - 1 || tierFanIn > SORTED_STORE_MAX_RUNS)
+		return 8;
+
+	store->file = file;
+	store->es = es;
+	store->metric = metric;
+	store->compareFn = compareFn;
+	store->buffer = buffer;
+	store->bufferSizeInBlocks = bufferSizeInBlocks;
+	store->memtableBlocks = memtableBlocks;
+	store->memCount = 0;
+	store->memCapacity = (uint32_t) memtableBlocks * es->page_size / es->record_size;
+	store->tierFanIn = tierFanIn;
+	store->numRuns = 0;
+	store->numFree = 0;
+	store->endOffset = 0;
+	return 0;
+}
+
+/**
+@brief     	Inserts a record. A full memtable is written as a run. A merge is
+			performed if the store has the maximum number of runs.
+@param      store
+                Sorted store
+@param      record
+                Record to insert
+@return		0 on success, 9 on write error, 10 on read error.
+*/
+int extern_sorted_store_insert(sorted_store_t *store, void *record)
+{
+	memcpy(store->buffer + store->memCount * store->es->record_size, record, store->es->record_size);
+	store->memCount++;
+	if (store->memCount < store->memCapacity)
+		return 0;
+	return extern_sorted_store_flush(store);
+}
+
+/**
+@brief     	Writes the memtable as a sorted run.
+@param      store
+                Sorted store
+@return		0 on success, 9 on write error, 10 on read error.
+*/
+int extern_sorted_store_flush(sorted_store_t *store)
+{
+	external_sort_t *es = store->es;
+	char 		*outputBuffer = store->buffer + (store->bufferSizeInBlocks - 1) * es->page_size;
+	int16_t 	recordsPerPage = (es->page_size - es->headerSize) / es->record_size;
+	uint32_t 	numPages = (store->memCount + recordsPerPage - 1) / recordsPerPage;
+	uint32_t 	i;
+	int16_t 	count;
+	int8_t 		merged;
+	int 		err;
+	long 		writePos;
+
+	if (store->memCount == 0)
+		return 0;
+
+	/* Make room for the run */
+	while (store->numRuns >= SORTED_STORE_MAX_RUNS)
+	{
+		err = extern_sorted_store_merge_step(store, &merged);
+		if (err)
+			return err;
+		if (!merged)
+		{
+			int8_t ids[SORTED_STORE_MAX_RUNS];
+			for (i=0; i < (uint32_t) store->tierFanIn; i++)
+				ids[i] = (int8_t) i;
+			err = store_merge(store, ids, store->tierFanIn);
+			if (err)
+				return err;
+		}
+	}
+
+	in_memory_sort(store->buffer, store->memCount, es->record_size, store->compareFn, 1);
+
+	sorted_store_run_t *run = &store->runs[store->numRuns];
+	run->offset = store_allocate(store, numPages);
+	run->num_pages = numPages;
+	run->tier = 0;
+	writePos = run->offset;
+	for (i=0; i < numPages; i++)
+	{
+		count = (store->memCount - i * recordsPerPage) < (uint32_t) recordsPerPage ? (int16_t) (store->memCount - i * recordsPerPage) : recordsPerPage;
+		memcpy(outputBuffer + es->headerSize, store->buffer + i * recordsPerPage * es->record_size, count * es->record_size);
+		if (0 != store_write_page(store, outputBuffer, (int32_t) i, count, &writePos))
+			return 9;
+	}
+	store->numRuns++;
+	store->memCount = 0;
+	return 0;
+}
+
+/**
+@brief     	Merges the oldest runs of the lowest tier that has tierFanIn runs.
+			Call when idle to merge in the background of ingest.
+@param      store
+                Sorted store
+@param      merged
+                Set to 1 if runs were merged and 0 if no tier was full
+@return		0 on success, 9 on write error, 10 on read error.
+*/
+int extern_sorted_store_merge_step(sorted_store_t *store, int8_t *merged)
+{
+	int8_t 	ids[SORTED_STORE_MAX_RUNS];
+	int8_t 	i, tier, numIds, minTier = -1;
+
+	/* Find lowest tier with enough runs to merge */
+	for (i=0; i < store->numRuns; i++)
+	{
+		tier = store->runs[i].tier;
+		if (minTier >= 0 && tier >= minTier)
+			continue;
+		int8_t j, n = 0;
+		for (j=0; j < store->numRuns; j++)
+			if (store->runs[j].tier == tier)
+				n++;
+		if (n >= store->tierFanIn)
+			minTier = tier;
+	}
+
+	*merged = 0;
+	if (minTier < 0)
+		return 0;
+
+	numIds = 0;
+	for (i=0; i < store->numRuns && numIds < store->tierFanIn; i++)
+		if (store->runs[i].tier == minTier)
+			ids[numIds++] = i;
+	*merged = 1;
+	return store_merge(store, ids, numIds);
+}
+
+/**
+@brief     	Reads a block of a run into the cursor's buffer.
+*/
+static int cursor_read_page(sorted_store_cursor_t *cursor, int8_t i, uint32_t pageNum)
+{
+	sorted_store_t *store = cursor->store;
+
+	cursor->pageNum[i] = pageNum;
+	cursor->slot[i] = 0;
+	if (0 != extern_sort_read_page(store->file, store->runs[i].offset + (long) pageNum * store->es->page_size,
+			cursor->buffer + i * store->es->page_size, store->es, store->metric))
+	{
+		cursor->err = 10;
+		return 10;
+	}
+	return 0;
+}
+
+/**
+@brief     	Returns the current record of a run or NULL if the run is used.
+*/
+static char* cursor_record(sorted_store_cursor_t *cursor, int8_t i)
+{
+	char *page = cursor->buffer + i * cursor->store->es->page_size;
+
+	if (cursor->pageNum[i] >= cursor->store->runs[i].num_pages)
+		return NULL;
+	return page + cursor->store->es->headerSize + cursor->slot[i] * cursor->store->es->record_size;
+}
+
+/**
+@brief     	Moves to the next record of a run reading the next block when needed.
+*/
+static int cursor_advance(sorted_store_cursor_t *cursor, int8_t i)
+{
+	char *page = cursor->buffer + i * cursor->store->es->page_size;
+
+	if (++cursor->slot[i] < *((int16_t*) (page+BLOCK_COUNT_OFFSET)))
+		return 0;
+	if (cursor->pageNum[i] + 1 < cursor->store->runs[i].num_pages)
+		return cursor_read_page(cursor, i, cursor->pageNum[i] + 1);
+	cursor->pageNum[i]++;
+	return 0;
+}
+
+/**
+@brief     	Opens a cursor over the memtable and all runs. Runs are merged first
+			if there are more runs than buffer blocks. The memtable is sorted in
+			place. Inserts invalidate the cursor.
+@param      store
+                Sorted store
+@param      cursor
+                Cursor to open
+@param      buffer
+                Pre-allocated space used by the cursor (one block for each run)
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 1)
+@param      minKey
+                Record with the smallest key to return or NULL to return all records
+@return		0 on success, 8 if buffer has no blocks, 9 on write error, 10 on read error.
+*/
+int extern_sorted_store_cursor_open(
+	sorted_store_t *store,
+	sorted_store_cursor_t *cursor,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	void 	*minKey)
+{
+	external_sort_t *es = store->es;
+	int8_t 		i, merged;
+	int 		err;
+
+	if (bufferSizeInBlocks < 1)
+		return 8;
+
+	/* Merge until every run has a block in the cursor buffer */
+	while (store->numRuns > bufferSizeInBlocks)
+	{
+		err = extern_sorted_store_merge_step(store, &merged);
+		if (err)
+			return err;
+		if (!merged)
+		{
+			int8_t ids[SORTED_STORE_MAX_RUNS];
+			int8_t numIds = (store->numRuns - bufferSizeInBlocks + 1) < store->tierFanIn ? (store->numRuns - bufferSizeInBlocks + 1) : store->tierFanIn;
+			for (i=0; i < numIds; i++)
+				ids[i] = i;
+			err = store_merge(store, ids, numIds);
+			if (err)
+				return err;
+		}
+	}
+
+	cursor->store = store;
+	cursor->buffer = buffer;
+	cursor->numRuns = store->numRuns;
+	cursor->err = 0;
+
+	if (store->memCount > 1)
+		in_memory_sort(store->buffer, store->memCount, es->record_size, store->compareFn, 1);
+	cursor->memPos = 0;
+	if (NULL != minKey)
+	{
+		/* Binary search memtable for first record not less than minKey */
+		uint32_t first = 0, last = store->memCount;
+		while (first < last)
+		{
+			uint32_t mid = (first + last) / 2;
+			store->metric->num_compar++;
+			if (store->compareFn(store->buffer + mid * es->record_size, minKey) < 0)
+				first = mid + 1;
+			else
+				last = mid;
+		}
+		cursor->memPos = first;
+	}
+
+	for (i=0; i < cursor->numRuns; i++)
+	{
+		uint32_t first = 0, last = store->runs[i].num_pages - 1;
+		if (NULL != minKey)
+		{
+			/* Binary search for last block with first record less than minKey */
+			while (first < last)
+			{
+				uint32_t mid = (first + last + 1) / 2;
+				if (0 != cursor_read_page(cursor, i, mid))
+					return 10;
+				store->metric->num_compar++;
+				if (store->compareFn(cursor_record(cursor, i), minKey) < 0)
+					first = mid;
+				else
+					last = mid - 1;
+			}
+		}
+		if (0 != cursor_read_page(cursor, i, first))
+			return 10;
+		if (NULL != minKey)
+		{
+			char *tuple;
+			while (NULL != (tuple = cursor_record(cursor, i)))
+			{
+				store->metric->num_compar++;
+				if (store->compareFn(tuple, minKey) >= 0)
+					break;
+				if (0 != cursor_advance(cursor, i))
+					return 10;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+@brief     	Returns the next record of a cursor in sorted order. Has the same form
+			as a record iterator so a cursor may be the input of a sort or join.
+@param      cursor
+                Open cursor (sorted_store_cursor_t)
+@param      record
+                Set to next record
+@return		1 if a record was returned, 0 at the end or on error (cursor->err set).
+*/
+int extern_sorted_store_next(void *cursor, void *record)
+{
+	sorted_store_cursor_t *cur = (sorted_store_cursor_t*) cursor;
+	sorted_store_t 	*store = cur->store;
+	char 		*tuple = NULL, *value;
+	int8_t 		i, lowId = -1;
+
+	if (cur->err)
+		return 0;
+
+	/* Memtable is lowest id (-1) */
+	if (cur->memPos < store->memCount)
+		tuple = store->buffer + cur->memPos * store->es->record_size;
+
+	for (i=0; i < cur->numRuns; i++)
+	{
+		value = cursor_record(cur, i);
+		if (NULL == value)
+			continue;
+		if (NULL != tuple)
+		{
+			store->metric->num_compar++;
+			if (store->compareFn(tuple, value) <= 0)
+				continue;
+		}
+		lowId = i;
+		tuple = value;
+	}
+	if (NULL == tuple)
+		return 0;
+
+	memcpy(record, tuple, store->es->record_size);
+	if (lowId < 0)
+		cur->memPos++;
+	else if (0 != cursor_advance(cur, lowId))
+		return 0;
+	return 1;
+}
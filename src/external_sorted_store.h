@@ -0,0 +1,211 @@
+/******************************************************************************/
+/**
+@file		external_sorted_store.h
+@author		Riley Jackson, Ramon Lawrence
+@brief		This file contains declarations for an incremental sorted store
+			of size-tiered sorted runs.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "external_sort.h"
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+/* Maximum number of runs in a store (a merge is forced when reached) */
+#define    SORTED_STORE_MAX_RUNS        16
+
+/* Maximum number of free file regions remembered for reuse */
+#define    SORTED_STORE_MAX_FREE        (2*SORTED_STORE_MAX_RUNS)
+
+/**
+@brief		Sorted run in the store file.
+*/
+typedef struct {
+	long 		offset;				/* Offset of first block */
+	uint32_t 	num_pages;			/* Number of blocks */
+	int8_t 		tier;				/* 0 for flushed memtable, one more than inputs for merged runs */
+} sorted_store_run_t;
+
+/**
+@brief		Free region of the store file.
+*/
+typedef struct {
+	long 		offset;
+	uint32_t 	num_pages;
+} sorted_store_extent_t;
+
+/**
+@brief		Incremental sorted store. Records are inserted into an in-memory table
+			that is written as a sorted run when full. Runs of the same tier are
+			merged into a run of the next tier.
+*/
+typedef struct {
+	ION_FILE 	*file;
+	external_sort_t *es;
+	metrics_t 	*metric;
+	int8_t 		(*compareFn)(void *a, void *b);
+	char 		*buffer;				/* Memtable blocks followed by blocks used for merging */
+	int 		bufferSizeInBlocks;
+	int 		memtableBlocks;
+	uint32_t 	memCount;				/* Records in memtable */
+	uint32_t 	memCapacity;
+	int8_t 		tierFanIn;				/* Runs of a tier merged together */
+	int8_t 		numRuns;
+	sorted_store_run_t runs[SORTED_STORE_MAX_RUNS];		/* Oldest run first */
+	int8_t 		numFree;
+	sorted_store_extent_t freeList[SORTED_STORE_MAX_FREE];	/* Sorted by offset */
+	long 		endOffset;				/* End of used part of file */
+} sorted_store_t;
+
+/**
+@brief		Cursor returning records of the memtable and all runs in sorted order.
+*/
+typedef struct {
+	sorted_store_t *store;
+	char 		*buffer;				/* One block for each run */
+	int8_t 		numRuns;
+	uint32_t 	pageNum[SORTED_STORE_MAX_RUNS];		/* Current block of each run */
+	int16_t 	slot[SORTED_STORE_MAX_RUNS];		/* Current record in block of each run */
+	uint32_t 	memPos;					/* Next record in memtable */
+	int 		err;					/* Error code if a read failed */
+} sorted_store_cursor_t;
+
+/**
+@brief     	Initializes an empty sorted store.
+@param      store
+                Store to initialize
+@param      file
+                Already opened file to store runs
+@param      buffer
+                Pre-allocated space used by the store
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      memtableBlocks
+                Blocks of buffer used for the memtable. At least 3 blocks must be left for merging.
+@param      tierFanIn
+                Number of runs of a tier merged together (at most blocks left for merging - 1)
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@return		0 on success, 8 if the buffer is too small for the memtable and merging.
+*/
+int extern_sorted_store_init(
+	sorted_store_t *store,
+	ION_FILE *file,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	int 	memtableBlocks,
+	int8_t 	tierFanIn,
+	external_sort_t *es,
+	metrics_t *metric,
+	int8_t (*compareFn)(void *a, void *b));
+
+/**
+@brief     	Inserts a record. A full memtable is written as a run. A merge is
+			performed if the store has the maximum number of runs.
+@param      store
+                Sorted store
+@param      record
+                Record to insert
+@return		0 on success, 9 on write error, 10 on read error.
+*/
+int extern_sorted_store_insert(sorted_store_t *store, void *record);
+
+/**
+@brief     	Writes the memtable as a sorted run.
+@param      store
+                Sorted store
+@return		0 on success, 9 on write error, 10 on read error.
+*/
+int extern_sorted_store_flush(sorted_store_t *store);
+
+/**
+@brief     	Merges the oldest runs of the lowest tier that has tierFanIn runs.
+			Call when idle to merge in the background of ingest.
+@param      store
+                Sorted store
+@param      merged
+                Set to 1 if runs were merged and 0 if no tier was full
+@return		0 on success, 9 on write error, 10 on read error.
+*/
+int extern_sorted_store_merge_step(sorted_store_t *store, int8_t *merged);
+
+/**
+@brief     	Opens a cursor over the memtable and all runs. Runs are merged first
+			if there are more runs than buffer blocks. The memtable is sorted in
+			place. Inserts invalidate the cursor.
+@param      store
+                Sorted store
+@param      cursor
+                Cursor to open
+@param      buffer
+                Pre-allocated space used by the cursor (one block for each run)
+@param      bufferSizeInBlocks
+                Size of buffer in blocks (at least 1)
+@param      minKey
+                Record with the smallest key to return or NULL to return all records
+@return		0 on success, 8 if buffer has no blocks, 9 on write error, 10 on read error.
+*/
+int extern_sorted_store_cursor_open(
+	sorted_store_t *store,
+	sorted_store_cursor_t *cursor,
+	char 	*buffer,
+	int 	bufferSizeInBlocks,
+	void 	*minKey);
+
+/**
+@brief     	Returns the next record of a cursor in sorted order. Has the same form
+			as a record iterator so a cursor may be the input of a sort or join.
+@param      cursor
+                Open cursor (sorted_store_cursor_t)
+@param      record
+                Set to next record
+@return		1 if a record was returned, 0 at the end or on error (cursor->err set).
+*/
+int extern_sorted_store_next(void *cursor, void *record);
+
+#if defined(__cplusplus)
+}
+#endif
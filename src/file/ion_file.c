@@ -36,6 +36,10 @@
 
 #include "ion_file.h"
 
+#if !defined(ARDUINO) && defined(__linux__)
+#include <fcntl.h>
+#endif
+
 ion_boolean_t
 ion_fexists(
 	char *name
@@ -251,3 +255,44 @@ ion_fread_at(
 	error = ion_fread(file, num_bytes, write_to);
 	return error;
 }
+
+ion_err_t
+ion_fpreallocate(
+	ion_file_handle_t	file,
+	ion_file_offset_t	num_bytes
+) {
+#if defined(ARDUINO)
+
+	if (0 != sd_fpreallocate(file.file, num_bytes)) {
+		return err_file_write_error;
+	}
+
+	return err_ok;
+#elif defined(__linux__)
+	fflush(file);
+
+	/* Reserve the extents up front so the file system does not allocate while writing */
+	if (0 != posix_fallocate(fileno(file), 0, num_bytes)) {
+		return err_file_write_error;
+	}
+
+	return err_ok;
+#else
+
+	ion_file_offset_t	previous;
+	ion_byte_t			payload = 0;
+
+	if (num_bytes <= ion_fend(file)) {
+		return err_ok;
+	}
+
+	/* Extend the file by writing its last byte */
+	previous = ion_ftell(file);
+
+	if (err_ok != ion_fwrite_at(file, num_bytes - 1, 1, &payload)) {
+		return err_file_write_error;
+	}
+
+	return ion_fseek(file, previous, ION_FILE_START);
+#endif
+}
@@ -141,6 +141,23 @@ ion_fread_at(
 	ion_byte_t			*write_to
 );
 
+/**
+@brief		Reserves space for a file so that it does not grow while it is written.
+@details	On Linux the space is allocated with @c posix_fallocate(). On the Arduino
+			the file is extended on the SD card before use so that cluster allocation
+			does not happen in the middle of later writes.
+@param		file
+				The file to reserve space for.
+@param		num_bytes
+				The size in bytes that the file should be able to hold without growing.
+@returns	@c err_ok on success, @c err_file_write_error otherwise.
+*/
+ion_err_t
+ion_fpreallocate(
+	ion_file_handle_t	file,
+	ion_file_offset_t	num_bytes
+);
+
 #if defined(__cplusplus)
 }
 #endif
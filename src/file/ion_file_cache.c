@@ -0,0 +1,308 @@
+/******************************************************************************/
+/**
+@file		ion_file_cache.c
+@author		Ramon Lawrence
+@brief		A page cache for the ionDB file API using least recently used
+			replacement and write-back of modified pages.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include "ion_file_cache.h"
+
+ion_err_t
+ion_fcache_init(
+	ion_file_cache_t	*cache,
+	ion_file_handle_t	file,
+	unsigned int		page_size,
+	uint16_t			num_frames,
+	ion_byte_t			*buffer
+) {
+	uint16_t i;
+
+	if (0 == num_frames) {
+		return err_invalid_initial_size;
+	}
+
+	cache->file			= file;
+	cache->page_size	= page_size;
+	cache->num_frames	= num_frames;
+	cache->frame_info	= (ion_file_cache_frame_t *) buffer;
+	cache->frames		= buffer + num_frames * sizeof(ion_file_cache_frame_t);
+	cache->clock		= 0;
+	cache->num_hits		= 0;
+	cache->num_misses	= 0;
+	cache->num_reads	= 0;
+	cache->num_writes	= 0;
+
+	for (i = 0; i < num_frames; i++) {
+		cache->frame_info[i].offset		= ION_FILE_NULL;
+		cache->frame_info[i].last_used	= 0;
+		cache->frame_info[i].dirty		= boolean_false;
+	}
+
+	return err_ok;
+}
+
+/**
+@brief		Writes the page in a frame to the file if it has been modified.
+*/
+static ion_err_t
+ion_fcache_write_back(
+	ion_file_cache_t	*cache,
+	uint16_t			frame
+) {
+	ion_err_t error;
+
+	if (!cache->frame_info[frame].dirty) {
+		return err_ok;
+	}
+
+	error = ion_fwrite_at(cache->file, cache->frame_info[frame].offset, cache->page_size, cache->frames + (long) frame * cache->page_size);
+
+	if (err_ok != error) {
+		return error;
+	}
+
+	cache->frame_info[frame].dirty = boolean_false;
+	cache->num_writes++;
+	return err_ok;
+}
+
+/**
+@brief		Writes modified pages that overlap a range of the file so the range
+			can be read from the file directly.
+*/
+static ion_err_t
+ion_fcache_write_back_range(
+	ion_file_cache_t	*cache,
+	ion_file_offset_t	offset,
+	unsigned int		num_bytes
+) {
+	ion_file_offset_t	page_offset;
+	uint16_t			i;
+	ion_err_t			error;
+
+	for (i = 0; i < cache->num_frames; i++) {
+		page_offset = cache->frame_info[i].offset;
+
+		if ((ION_FILE_NULL == page_offset) || (page_offset + (ion_file_offset_t) cache->page_size <= offset) || (page_offset >= offset + (ion_file_offset_t) num_bytes)) {
+			continue;
+		}
+
+		error = ion_fcache_write_back(cache, i);
+
+		if (err_ok != error) {
+			return error;
+		}
+	}
+
+	return err_ok;
+}
+
+/**
+@brief		Finds the frame holding a page, loading the page into the least
+			recently used frame on a miss.
+@param		cache
+				The cache to search.
+@param		page_offset
+				Offset of the start of the page in the file.
+@param		read_page
+				@c boolean_false if the whole page will be overwritten so the page
+				does not need to be read from the file.
+@param		frame
+				Set to the frame holding the page.
+*/
+static ion_err_t
+ion_fcache_get_frame(
+	ion_file_cache_t	*cache,
+	ion_file_offset_t	page_offset,
+	ion_boolean_t		read_page,
+	uint16_t			*frame
+) {
+	uint16_t	i;
+	uint16_t	victim = 0;
+	ion_err_t	error;
+
+	cache->clock++;
+
+	for (i = 0; i < cache->num_frames; i++) {
+		if (cache->frame_info[i].offset == page_offset) {
+			cache->frame_info[i].last_used = cache->clock;
+			cache->num_hits++;
+			*frame = i;
+			return err_ok;
+		}
+
+		/* Empty frames have never been used so are chosen first */
+		if (cache->frame_info[i].last_used < cache->frame_info[victim].last_used) {
+			victim = i;
+		}
+	}
+
+	cache->num_misses++;
+	*frame	= victim;
+	error	= ion_fcache_write_back(cache, victim);
+
+	if (err_ok != error) {
+		return error;
+	}
+
+	/* Frame is left empty if the page cannot be read */
+	cache->frame_info[victim].offset	= ION_FILE_NULL;
+	cache->frame_info[victim].last_used = 0;
+
+	if (read_page) {
+		error = ion_fread_at(cache->file, page_offset, cache->page_size, cache->frames + (long) victim * cache->page_size);
+
+		if (err_ok != error) {
+			return error;
+		}
+
+		cache->num_reads++;
+	}
+
+	cache->frame_info[victim].offset	= page_offset;
+	cache->frame_info[victim].last_used = cache->clock;
+	return err_ok;
+}
+
+ion_err_t
+ion_fcache_read_at(
+	ion_file_cache_t	*cache,
+	ion_file_offset_t	offset,
+	unsigned int		num_bytes,
+	ion_byte_t			*write_to
+) {
+	ion_file_offset_t	page_offset;
+	unsigned int		start;
+	unsigned int		length;
+	uint16_t			frame;
+	ion_err_t			error;
+
+	while (num_bytes > 0) {
+		start		= offset % cache->page_size;
+		page_offset = offset - start;
+		length		= cache->page_size - start;
+
+		if (length > num_bytes) {
+			length = num_bytes;
+		}
+
+		error = ion_fcache_get_frame(cache, page_offset, boolean_true, &frame);
+
+		if (err_ok != error) {
+			/* Page is not complete in the file (at end of file) so read directly after writing cached pages in the range */
+			if (ION_FILE_NULL != cache->frame_info[frame].offset) {
+				return error;
+			}
+
+			error = ion_fcache_write_back_range(cache, offset, num_bytes);
+
+			if (err_ok != error) {
+				return error;
+			}
+
+			return ion_fread_at(cache->file, offset, num_bytes, write_to);
+		}
+
+		memcpy(write_to, cache->frames + (long) frame * cache->page_size + start, length);
+		offset		+= length;
+		write_to	+= length;
+		num_bytes	-= length;
+	}
+
+	return err_ok;
+}
+
+ion_err_t
+ion_fcache_write_at(
+	ion_file_cache_t	*cache,
+	ion_file_offset_t	offset,
+	unsigned int		num_bytes,
+	ion_byte_t			*to_write
+) {
+	ion_file_offset_t	page_offset;
+	unsigned int		start;
+	unsigned int		length;
+	uint16_t			frame;
+	ion_byte_t			*page;
+	ion_err_t			error;
+
+	while (num_bytes > 0) {
+		start		= offset % cache->page_size;
+		page_offset = offset - start;
+		length		= cache->page_size - start;
+
+		if (length > num_bytes) {
+			length = num_bytes;
+		}
+
+		error = ion_fcache_get_frame(cache, page_offset, length < cache->page_size, &frame);
+
+		if (err_ok != error) {
+			if (ION_FILE_NULL != cache->frame_info[frame].offset) {
+				return error;
+			}
+
+			/* Page is past the end of the file so starts as zeros */
+			cache->frame_info[frame].offset		= page_offset;
+			cache->frame_info[frame].last_used	= cache->clock;
+			memset(cache->frames + (long) frame * cache->page_size, 0, cache->page_size);
+		}
+
+		page = cache->frames + (long) frame * cache->page_size;
+		memcpy(page + start, to_write, length);
+		cache->frame_info[frame].dirty = boolean_true;
+		offset		+= length;
+		to_write	+= length;
+		num_bytes	-= length;
+	}
+
+	return err_ok;
+}
+
+ion_err_t
+ion_fcache_flush(
+	ion_file_cache_t *cache
+) {
+	uint16_t	i;
+	ion_err_t	error;
+
+	for (i = 0; i < cache->num_frames; i++) {
+		error = ion_fcache_write_back(cache, i);
+
+		if (err_ok != error) {
+			return error;
+		}
+	}
+
+	return err_ok;
+}
@@ -0,0 +1,182 @@
+/******************************************************************************/
+/**
+@file		ion_file_cache.h
+@author		Ramon Lawrence
+@brief		A page cache for the ionDB file API.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#if !defined(ION_FILE_CACHE_H_)
+#define ION_FILE_CACHE_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "ion_file.h"
+
+/**
+@brief		State of one frame (cached page) of a file cache.
+*/
+typedef struct {
+	ion_file_offset_t	offset;
+	/**< Offset in the file of the page in the frame, or @ref ION_FILE_NULL if empty. */
+	uint32_t			last_used;
+	/**< Access stamp used to find the least recently used frame. */
+	ion_boolean_t		dirty;	/**< Page has been modified since it was read. */
+} ion_file_cache_frame_t;
+
+/**
+@brief		A small page cache over a file using least recently used replacement.
+@details	Pages are cached in frames taken from a caller supplied buffer so no
+			memory is allocated. Writes are kept in the cache and written back when
+			the frame is evicted or the cache is flushed. All access to the file
+			must go through the cache while it is in use.
+*/
+typedef struct {
+	ion_file_handle_t		file;
+	/**< File being cached. */
+	unsigned int			page_size;
+	/**< Size of a page (and frame) in bytes. Page @c i starts at offset @c i*page_size. */
+	uint16_t				num_frames;
+	/**< Number of frames in the cache. */
+	ion_file_cache_frame_t	*frame_info;
+	/**< State of each frame. */
+	ion_byte_t				*frames;
+	/**< Page data of each frame. */
+	uint32_t				clock;
+	/**< Access counter used to stamp frames. */
+	uint32_t				num_hits;
+	/**< Number of page accesses found in the cache. */
+	uint32_t				num_misses;
+	/**< Number of page accesses not found in the cache. */
+	uint32_t				num_reads;
+	/**< Number of pages read from the file. */
+	uint32_t				num_writes;	/**< Number of pages written to the file. */
+} ion_file_cache_t;
+
+/**
+@brief		Size of the buffer in bytes needed for a cache.
+@param		page_size
+				Size of a page in bytes.
+@param		num_frames
+				Number of pages the cache holds.
+*/
+#define ION_FILE_CACHE_BUFFER_SIZE(page_size, num_frames) \
+	((num_frames) * (sizeof(ion_file_cache_frame_t) + (page_size)))
+
+/**
+@brief		Initializes a cache over a file.
+@param		cache
+				The cache to initialize.
+@param		file
+				An open file that all reads and writes will go through the cache to.
+@param		page_size
+				Size of a page in bytes.
+@param		num_frames
+				Number of pages the cache holds. Must be at least one.
+@param		buffer
+				Memory for the cache of at least @ref ION_FILE_CACHE_BUFFER_SIZE bytes.
+@returns	@c err_ok on success, @c err_invalid_initial_size if there are no frames.
+*/
+ion_err_t
+ion_fcache_init(
+	ion_file_cache_t	*cache,
+	ion_file_handle_t	file,
+	unsigned int		page_size,
+	uint16_t			num_frames,
+	ion_byte_t			*buffer
+);
+
+/**
+@brief		Reads bytes from a file through the cache.
+@details	Reads of pages in the cache do not access the file. On a miss, the
+			whole page is read into the least recently used frame after writing
+			back its contents if modified. A page that is not complete in the file
+			is read directly after modified pages in the range are written back.
+@param		cache
+				The cache to read through.
+@param		offset
+				Offset in the file to read from.
+@param		num_bytes
+				Number of bytes to read. May span pages.
+@param		write_to
+				Memory to copy the bytes to.
+@returns	@c err_ok on success, or the error of a failed file operation.
+*/
+ion_err_t
+ion_fcache_read_at(
+	ion_file_cache_t	*cache,
+	ion_file_offset_t	offset,
+	unsigned int		num_bytes,
+	ion_byte_t			*write_to
+);
+
+/**
+@brief		Writes bytes to a file through the cache.
+@details	The bytes are copied into the cached page and written to the file
+			when the frame is evicted or the cache is flushed. A write of a whole
+			page does not read the page from the file.
+@param		cache
+				The cache to write through.
+@param		offset
+				Offset in the file to write to.
+@param		num_bytes
+				Number of bytes to write. May span pages.
+@param		to_write
+				Memory to copy the bytes from.
+@returns	@c err_ok on success, or the error of a failed file operation.
+*/
+ion_err_t
+ion_fcache_write_at(
+	ion_file_cache_t	*cache,
+	ion_file_offset_t	offset,
+	unsigned int		num_bytes,
+	ion_byte_t			*to_write
+);
+
+/**
+@brief		Writes all modified pages in the cache to the file.
+@details	Pages stay in the cache after they are written.
+@param		cache
+				The cache to flush.
+@returns	@c err_ok on success, or the error of a failed write.
+*/
+ion_err_t
+ion_fcache_flush(
+	ion_file_cache_t *cache
+);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
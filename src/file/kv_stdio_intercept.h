@@ -68,6 +68,7 @@ extern "C" {
 #define  fremove(x)			sd_remove(x)
 #define  frewind(x)			sd_rewind(x)
 #define  fdeleteall()		SD_File_Delete_All()
+#define  fpreallocate(x, y)	sd_fpreallocate(x, y)
 #if defined(__cplusplus)
 }
 #endif
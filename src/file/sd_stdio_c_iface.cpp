@@ -51,6 +51,43 @@ struct _SD_File {
 								 file currently is. */
 };
 
+/**
+@brief		Size of the zero-filled chunk used when padding a file.
+*/
+#define SD_PAD_CHUNK_SIZE 32
+
+/**
+@brief		Append @p bytes_to_pad zero bytes at the current file position.
+@details	Writes are issued in chunks rather than one byte per call.
+@param		stream
+				A pointer to the C file struct associated with an SD file object.
+@param		bytes_to_pad
+				The number of zero bytes to write.
+@returns	@c 0 for success, a non-zero integer otherwise.
+*/
+static int
+sd_fpad(
+	SD_FILE			*stream,
+	unsigned long	bytes_to_pad
+) {
+	char	payload[SD_PAD_CHUNK_SIZE];
+	size_t	chunk;
+
+	memset(payload, 0, SD_PAD_CHUNK_SIZE);
+
+	while (bytes_to_pad > 0) {
+		chunk = (bytes_to_pad < SD_PAD_CHUNK_SIZE) ? bytes_to_pad : SD_PAD_CHUNK_SIZE;
+
+		if (chunk != stream->f.write((uint8_t *) payload, chunk)) {
+			return -1;
+		}
+
+		bytes_to_pad -= chunk;
+	}
+
+	return 0;
+}
+
 int
 sd_fclose(
 	SD_FILE *stream
@@ -227,11 +264,9 @@ sd_fseek(
 					return -1;
 				}
 
-				unsigned long	bytes_to_pad	= offset - cur_end;
-				char			payload			= 0x0;
-				size_t			num_written		= sd_fwrite(&payload, sizeof(payload), bytes_to_pad, stream);
+				unsigned long bytes_to_pad = offset - cur_end;
 
-				if (num_written != bytes_to_pad) {
+				if (0 != sd_fpad(stream, bytes_to_pad)) {
 					return -1;
 				}
 
@@ -249,11 +284,9 @@ sd_fseek(
 					return -1;
 				}
 
-				unsigned long	bytes_to_pad	= (offset + cur_pos) - cur_end;
-				char			payload			= 0x0;
-				size_t			num_written		= sd_fwrite(&payload, sizeof(payload), bytes_to_pad, stream);
+				unsigned long bytes_to_pad = (offset + cur_pos) - cur_end;
 
-				if (num_written != bytes_to_pad) {
+				if (0 != sd_fpad(stream, bytes_to_pad)) {
 					return -1;
 				}
 
@@ -275,11 +308,9 @@ sd_fseek(
 					return -1;
 				}
 
-				unsigned long	bytes_to_pad	= offset;
-				char			payload			= 0x0;
-				size_t			num_written		= sd_fwrite(&payload, sizeof(payload), bytes_to_pad, stream);
+				unsigned long bytes_to_pad = offset;
 
-				if (num_written != bytes_to_pad) {
+				if (0 != sd_fpad(stream, bytes_to_pad)) {
 					return -1;
 				}
 
@@ -296,6 +327,35 @@ sd_fseek(
 	}
 }
 
+int
+sd_fpreallocate(
+	SD_FILE				*stream,
+	unsigned long int	size
+) {
+	if (NULL == stream) {
+		return -1;
+	}
+
+	unsigned long	cur_pos = stream->f.position();
+	unsigned long	cur_end = stream->f.size();
+
+	if (size <= cur_end) {
+		return 0;
+	}
+
+	if (!stream->f.seek(cur_end)) {
+		return -1;
+	}
+
+	if (0 != sd_fpad(stream, size - cur_end)) {
+		return -1;
+	}
+
+	/* Commit the new clusters and directory entry before the file is used */
+	stream->f.flush();
+	return stream->f.seek(cur_pos) ? 0 : -1;
+}
+
 long int
 sd_ftell(
 	SD_FILE *stream
@@ -175,6 +175,24 @@ sd_fseek(
 	int					whence
 );
 
+/**
+@brief		Extend an Arduino SD file so that it holds at least @p size bytes.
+@details	The file is padded with zeros in multi-byte chunks and the file
+			position is restored afterwards. Growing the file before it is used
+			keeps FAT cluster allocation out of later writes.
+@param		stream
+				A pointer to a C file struct type associated with an SD
+				file object.
+@param		size
+				The minimum size of the file in bytes.
+@returns	@c 0 for success, a non-zero integer otherwise.
+*/
+int
+sd_fpreallocate(
+	SD_FILE				*stream,
+	unsigned long int	size
+);
+
 /**
 @brief		Set the current position of an Arduino SD file.
 @details	The parameter @pos should be retrieved using fgetpos.
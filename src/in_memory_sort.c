@@ -116,6 +116,78 @@ in_memory_quick_sort(
 	return 0;
 }
 
+/**
+ * Sorts low to high (inclusive) with 3-way partitioning. Values equal to the pivot are
+ * gathered in the middle and not sorted again, so many equal keys take linear time.
+ * Recurses on the smaller side and loops on the larger to bound the stack depth.
+ */
+void
+in_memory_quick_sort_3way_helper(
+	void *tmp_buffer,
+	int value_size,
+	int8_t (*compare_fcn)(void* a, void* b),
+	char* low,
+	char* high
+) {
+	char* pivot = (char*)tmp_buffer + value_size;
+
+	while (low < high) {
+		char* less_end	= low;		/* values before are less than pivot */
+		char* current	= low;
+		char* greater_start	= high;	/* values after are greater than pivot */
+		int8_t result;
+
+		memcpy(pivot, low + ((high - low) / value_size / 2) * value_size, value_size);
+		while (current <= greater_start) {
+			result = compare_fcn(current, pivot);
+			if (result < 0) {
+				if (current != less_end) {
+					in_memory_swap(tmp_buffer, value_size, less_end, current);
+				}
+				less_end += value_size;
+				current += value_size;
+			}
+			else if (result > 0) {
+				in_memory_swap(tmp_buffer, value_size, current, greater_start);
+				greater_start -= value_size;
+			}
+			else {
+				current += value_size;
+			}
+		}
+
+		if (less_end - low < high - greater_start) {
+			in_memory_quick_sort_3way_helper(tmp_buffer, value_size, compare_fcn, low, less_end - value_size);
+			low = greater_start + value_size;
+		}
+		else {
+			in_memory_quick_sort_3way_helper(tmp_buffer, value_size, compare_fcn, greater_start + value_size, high);
+			high = less_end - value_size;
+		}
+	}
+}
+
+int
+in_memory_quick_sort_3way(
+	void *data,
+	uint32_t num_values,
+	int value_size,
+	int8_t (*compare_fcn)(void* a, void* b)
+) {
+	if (num_values < 2) return 0;
+
+	/* Swap space followed by copy of the pivot */
+	void* tmp_buffer = malloc(2 * value_size);
+	if(NULL == tmp_buffer) return 8;
+
+	char* high = (char*)data + (num_values-1)*value_size;
+	in_memory_quick_sort_3way_helper(tmp_buffer, value_size, compare_fcn, (char*)data, high);
+
+	free(tmp_buffer);
+
+	return 0;
+}
+
 int
 in_memory_sort(
 	void *data,
@@ -130,6 +202,10 @@ in_memory_sort(
 			err = in_memory_quick_sort(data, num_values, value_size, compare_fcn);
 			break;
 		}
+		case IN_MEMORY_QUICK_SORT_3WAY: {
+			err = in_memory_quick_sort_3way(data, num_values, value_size, compare_fcn);
+			break;
+		}
 	}
 
 	return err;
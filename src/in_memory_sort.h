@@ -9,6 +9,10 @@ extern "C" {
 #include <stdint.h>
 // #include <alloca.h>
 
+/* Values of sort_algorithm */
+#define IN_MEMORY_QUICK_SORT		1
+#define IN_MEMORY_QUICK_SORT_3WAY	2		/* 3-way partitioning for many equal keys */
+
 int
 in_memory_sort(
 	void *data,
@@ -56,6 +56,7 @@ extern "C" {
 #define fremove(x)	remove(x)
 #define frewind(x)	rewind(x)
 #define fdeleteall()
+#define fpreallocate(x, y)	ion_fpreallocate(x, y)
 #endif
 
 #define ION_USING_MASTER_TABLE	1
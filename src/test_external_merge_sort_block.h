@@ -37,10 +37,127 @@
 #include <string.h>
 
 #include "external_merge_sort_iterator_block.h"
+#include "external_merge_sort_block_recycle.h"
+#include "external_merge_sort_striped.h"
+#include "external_merge_sort_polyphase.h"
+#include "external_merge_sort_mini_page.h"
+#include "external_merge_sort_no_output_buffer.h"
+#include "external_merge_sort_adaptive.h"
+#include "external_merge_sort_two_way.h"
+#include "external_merge_sort_skip_merge.h"
+#include "external_merge_sort_rle.h"
+#include "external_merge_sort_ovc.h"
+#include "external_merge_sort_var_block.h"
+#include "external_merge_sort_prefix_block.h"
+#include "external_merge_join.h"
+#include "external_sorted_store.h"
+#include "external_sort_bounded.h"
+#include "external_distribution_sort.h"
+#include "external_sort_plan.h"
+#include "external_sort_tune.h"
+#include "external_merge_sort_kv_separated.h"
+#include "external_sort_key.h"
 #include "in_memory_sort.h"
 
 #define EXTERNAL_SORT_MAX_RAND 1000000
 
+/* Test sort that recycles blocks between merge passes (output is a chain of blocks)
+#define TEST_BLOCK_RECYCLE  1
+*/
+
+/* Test sort with runs striped across this number of files
+#define TEST_STRIPE_FILES   2
+*/
+
+/* Test polyphase merge over this number of sequential stream files
+#define TEST_POLYPHASE_FILES 4
+*/
+
+/* Test merge with mini pages sized from SD read command and block transfer costs (microseconds)
+#define TEST_MINI_PAGE      1
+*/
+
+/* Test merge with output written from merged input blocks instead of an output buffer
+#define TEST_NO_OUTPUT_BUFFER 1
+*/
+
+/* Test sort that asks a memory broker for its buffer size. Blocks allowed after the first run.
+#define TEST_MEMORY_BROKER  8
+*/
+
+/* Test two-way replacement selection creating ascending and descending runs
+#define TEST_TWO_WAY        1
+*/
+
+/* Test merge that concatenates runs with disjoint key ranges instead of merging them
+#define TEST_SKIP_MERGE     1
+*/
+
+/* Test sort that stores exact duplicate records once with a repeat count in runs
+#define TEST_DUPLICATES     1
+*/
+
+/* Test offset-value coded merge of keys stored big-endian (ordered by unsigned byte comparison)
+#define TEST_OVC            1
+*/
+
+/* Test sort of variable-length records (key and 0 to 12 bytes of value) in slotted blocks
+#define TEST_VAR_BLOCK      1
+*/
+
+/* Test prefix encoded string keys with a restart point every this many records. Output is read with prefix next and seek.
+#define TEST_PREFIX_BLOCK   8
+*/
+
+/* Test sort of records with even keys projected to the key and this many bytes of the value.
+   Every second run keeps 7 bytes so the records exactly fill the block.
+#define TEST_FILTER_PROJECT 4
+*/
+
+/* Test distribution sort (buffer of at least 4 blocks). Every second run has only this many distinct keys.
+#define TEST_DISTRIBUTION   4
+*/
+
+/* Test page size and buffer size chosen by the planner for a memory budget in bytes
+#define TEST_PLAN_BUDGET    4096
+*/
+
+/* Plan with a device profile measured on a scratch file of this many bytes (saved and reused)
+#define TEST_TUNE_DEVICE    262144
+*/
+
+/* Test sort of keys only with records gathered from a value log into the output file
+#define TEST_KV_SEPARATED   1
+*/
+
+/* Test comparator built from a key descriptor instead of merge_sort_int32_comparator
+#define TEST_KEY_DESCRIPTOR 1
+*/
+
+/* Test inner, left outer and semi merge joins of two sorted files after the sort tests
+#define TEST_MERGE_JOIN     1
+*/
+
+/* Test inserts, background merges, cursors and file space reuse of a sorted store after the sort tests
+#define TEST_SORTED_STORE   1
+*/
+
+/* Test sort of nearly sorted input with outliers that break the disorder bound after the sort tests
+#define TEST_BOUNDED_DISORDER 1
+*/
+
+/* Number of distinct keys in random test data (few keys for tests of duplicate handling) */
+#if defined(TEST_DUPLICATES)
+#define TEST_DISTINCT_KEYS  16
+#else
+#define TEST_DISTINCT_KEYS  EXTERNAL_SORT_MAX_RAND
+#endif
+
+/* Number of pages in page cache over sort file (0 for no cache) */
+#if !defined(TEST_CACHE_PAGES)
+#define TEST_CACHE_PAGES    0
+#endif
+
 /**
  * Generates random test data records
  */ 
@@ -64,7 +181,7 @@ external_sort_write_int32_random_data(
 	for (i = 0; i < num_values; i++)
 	{
 	 	/* Generate random key */
-        buf.key = rand() % EXTERNAL_SORT_MAX_RAND;	
+        buf.key = rand() % TEST_DISTINCT_KEYS;	
 
 		if (0 == fwrite(&buf, record_size, 1, unsorted_file))
 		{
@@ -75,6 +192,35 @@ external_sort_write_int32_random_data(
 	return 0;
 }
 
+/**
+ * Generates random test data records with keys from 0 to num_keys-1
+ */
+int
+external_sort_write_int32_duplicate_data(
+	ION_FILE *unsorted_file,
+	int32_t num_values,
+	int32_t record_size,
+	int32_t num_keys)
+{
+	printf("Duplicate Data: %d Keys: %d\n", num_values, num_keys);
+
+	int32_t i;
+	test_record_t buf;
+
+	memset(&buf, 0, sizeof(test_record_t));
+	for (i = 0; i < num_values; i++)
+	{
+		buf.key = rand() % num_keys;
+
+		if (0 == fwrite(&buf, record_size, 1, unsorted_file))
+		{
+			return 10;
+		}
+	}
+
+	return 0;
+}
+
 /**
  * Generates increasing or decreasing test data records
  */
@@ -125,13 +271,550 @@ int fileRecordIterator(void* state, void* buffer)
 	if (fileState->recordsRead >= fileState->totalRecords)
 		return 0;
 
-	/* Read next record */
-    /* TODO: Improve by reading a block at a time */
+	/* Read next record. Use fileBatchIterator to read a block at a time. */
 	fread(buffer, fileState->recordSize, 1, fileState->file);
 	fileState->recordsRead++;
 	return 1;
 }
 
+/**
+ * Iterates through records in a file reading up to max_records records per call. Returns 0 when no more records.
+ */
+size_t fileBatchIterator(void* state, void* dst, size_t max_records)
+{
+	file_iterator_state_t* fileState = (file_iterator_state_t*) state;
+	uint32_t count = fileState->totalRecords - fileState->recordsRead;
+
+	if (count > max_records)
+		count = max_records;
+	if (count == 0)
+		return 0;
+
+	/* Read a block of records directly into the sort buffer */
+	count = fread(dst, fileState->recordSize, count, fileState->file);
+	fileState->recordsRead += count;
+	return count;
+}
+
+#if defined(TEST_OVC)
+/**
+ * Iterates through records in a file storing keys big-endian so they are ordered by unsigned byte comparison.
+ */
+int fileByteOrderedIterator(void* state, void* buffer)
+{
+	if (0 == fileRecordIterator(state, buffer))
+		return 0;
+
+	uint32_t key = (uint32_t) ((test_record_t*) buffer)->key;
+	unsigned char *bytes = (unsigned char*) buffer;
+	bytes[0] = (unsigned char) (key >> 24);
+	bytes[1] = (unsigned char) (key >> 16);
+	bytes[2] = (unsigned char) (key >> 8);
+	bytes[3] = (unsigned char) key;
+	return 1;
+}
+#endif
+
+#if defined(TEST_VAR_BLOCK)
+/**
+ * Returns the length of the test record with this key: the key and 0 to 12 bytes of the value.
+ */
+uint16_t testVarRecordLength(int32_t key)
+{
+	return sizeof(int32_t) + (uint16_t) ((uint32_t) key % 13);
+}
+
+/**
+ * Iterates through records in a file shortening each record to a length set by its key.
+ */
+int fileVarRecordIterator(void* state, void* buffer, uint16_t *length)
+{
+	if (0 == fileRecordIterator(state, buffer))
+		return 0;
+
+	*length = testVarRecordLength(((test_record_t*) buffer)->key);
+	return 1;
+}
+#endif
+
+#if defined(TEST_PREFIX_BLOCK)
+/* String key size: "key/" and 7 digits padded with zeros */
+#define TEST_PREFIX_KEY_SIZE 12
+
+/**
+ * Iterates through records in a file storing the key as a string followed by the integer key as the value.
+ */
+int filePrefixKeyIterator(void* state, void* buffer)
+{
+	if (0 == fileRecordIterator(state, buffer))
+		return 0;
+
+	int32_t key = ((test_record_t*) buffer)->key;
+	memset(buffer, 0, TEST_PREFIX_KEY_SIZE);
+	sprintf((char*) buffer, "key/%07ld", (long) key);
+	memcpy((char*) buffer + TEST_PREFIX_KEY_SIZE, &key, sizeof(int32_t));
+	return 1;
+}
+#endif
+
+#if defined(TEST_FILTER_PROJECT)
+/**
+ * Filter predicate that keeps records with even keys.
+ */
+int8_t testFilterPredicate(void* state, void* record)
+{
+	return ((test_record_t*) record)->key % 2 == 0;
+}
+
+/**
+ * Projection that keeps the first es->record_size bytes (key and start of value) of a record.
+ */
+void testProjection(void* state, void* record, void* dst)
+{
+	memcpy(dst, record, ((external_sort_t*) state)->record_size);
+}
+#endif
+
+#if defined(TEST_MEMORY_BROKER)
+/**
+ * Memory broker that allows more blocks after the first run, like firmware freeing memory after startup.
+ */
+int16_t testMemoryBroker(void* state, int16_t blocksInUse)
+{
+	if (blocksInUse == 0)
+		return *((int16_t*) state);
+	return TEST_MEMORY_BROKER;
+}
+#endif
+
+#if defined(TEST_MERGE_JOIN)
+/* Keys in join inputs are 0 to TEST_JOIN_KEYS-1. Both inputs have extra records with TEST_JOIN_DUP_KEY. */
+#define TEST_JOIN_KEYS      64
+#define TEST_JOIN_DUP_KEY   17
+
+typedef struct {
+	int32_t count[TEST_JOIN_KEYS];      /* Results for each key */
+	int32_t lastKey;                    /* Key of last left record output */
+	int8_t joinType;
+	int8_t error;
+} test_join_state_t;
+
+/**
+ * Counts join results for each key. Checks left records are output in key order with a right record with the same key.
+ */
+void testJoinOutput(void* state, void* leftRecord, void* rightRecord)
+{
+	test_join_state_t *join = (test_join_state_t*) state;
+	int32_t key = ((test_record_t*) leftRecord)->key;
+
+	if (key < join->lastKey || key < 0 || key >= TEST_JOIN_KEYS)
+		join->error = 1;
+	else if (NULL != rightRecord && (join->joinType == MERGE_JOIN_SEMI || ((test_record_t*) rightRecord)->key != key))
+		join->error = 1;
+	else
+		join->count[key]++;
+	join->lastKey = key;
+}
+
+/**
+ * Writes random records and dupCount records with the duplicate key to a file and sorts them into a join input.
+ */
+int testJoinInput(char *name, int32_t numValues, int32_t dupCount, int32_t *keyCount, merge_join_input_t *input, external_sort_t *es, char *buffer, int bufferSizeInBlocks, metrics_t *metric)
+{
+	test_record_t buf;
+	file_iterator_state_t iteratorState;
+	int32_t i, values_per_page = (es->page_size - es->headerSize) / es->record_size;
+
+	ION_FILE *fp = fopen("myfile.bin", "w+b");
+	input->file = fopen(name, "w+b");
+	if (NULL == fp || NULL == input->file)
+	{
+		printf("Error: Can't open file!\n");
+		return 10;
+	}
+
+	memset(&buf, 0, sizeof(test_record_t));
+	for (i = 0; i < numValues + dupCount; i++)
+	{
+		buf.key = (i < numValues) ? rand() % TEST_JOIN_KEYS : TEST_JOIN_DUP_KEY;
+		keyCount[buf.key]++;
+		fwrite(&buf, es->record_size, 1, fp);
+	}
+	fflush(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	iteratorState.file = fp;
+	iteratorState.recordsRead = 0;
+	iteratorState.totalRecords = numValues + dupCount;
+	iteratorState.recordSize = es->record_size;
+	es->num_pages = (uint32_t) (iteratorState.totalRecords + values_per_page - 1) / values_per_page;
+
+	int err = extern_merge_sort_batch_iterator_block(&fileBatchIterator, &iteratorState, input->file, buffer, bufferSizeInBlocks, es, &input->offset, metric, es->compare_fcn);
+	fclose(fp);
+	input->num_pages = es->num_pages;
+	input->es = es;
+	return err;
+}
+
+/**
+ * Sorts two inputs and checks inner, left outer and semi join results for each key. Right records with the
+ * duplicate key do not fit in the join buffer so they are read again for each left record with that key.
+ */
+void runtest_external_merge_join()
+{
+	external_sort_t es;
+	metrics_t metric;
+	test_join_state_t join;
+	merge_join_input_t left, right;
+	int32_t leftCount[TEST_JOIN_KEYS], rightCount[TEST_JOIN_KEYS], expected;
+	int bufferSizeInBlocks = 3, passed = 1, err;
+	int8_t joinType;
+
+	printf("--- Merge Join Test ---\n");
+	memset(&es, 0, sizeof(external_sort_t));
+	es.key_size = sizeof(int32_t);
+	es.value_size = 12;
+	es.headerSize = BLOCK_HEADER_SIZE;
+	es.record_size = es.key_size + es.value_size;
+	es.page_size = 512;
+	es.compare_fcn = merge_sort_int32_comparator;
+	memset(&metric, 0, sizeof(metrics_t));
+	memset(leftCount, 0, sizeof(leftCount));
+	memset(rightCount, 0, sizeof(rightCount));
+
+	char *buffer = (char*) malloc((size_t) bufferSizeInBlocks * es.page_size);
+	if (NULL == buffer)
+	{
+		printf("Error: Out of memory!\n");
+		return;
+	}
+
+	/* Right duplicate group is larger than the (bufferSizeInBlocks - 2) blocks that buffer right records */
+	if (0 != testJoinInput("tmpjoin1.bin", 300, 3, leftCount, &left, &es, buffer, bufferSizeInBlocks, &metric)
+		|| 0 != testJoinInput("tmpjoin2.bin", 200, 2 * es.page_size / es.record_size, rightCount, &right, &es, buffer, bufferSizeInBlocks, &metric))
+	{
+		printf("Error: Sort of join input failed!\n");
+		passed = 0;
+	}
+
+	for (joinType = MERGE_JOIN_INNER; passed && joinType <= MERGE_JOIN_SEMI; joinType++)
+	{
+		memset(&join, 0, sizeof(test_join_state_t));
+		join.joinType = joinType;
+		memset(&metric, 0, sizeof(metrics_t));
+		err = extern_merge_join(&left, &right, joinType, buffer, bufferSizeInBlocks, &testJoinOutput, &join, &metric, es.compare_fcn);
+		if (0 != err || join.error)
+		{
+			printf("ERROR: Join type: %d Error: %d Output out of order or keys do not match\n", joinType, err);
+			passed = 0;
+		}
+
+		for (int32_t k = 0; k < TEST_JOIN_KEYS; k++)
+		{
+			if (joinType == MERGE_JOIN_SEMI)
+				expected = (rightCount[k] > 0) ? leftCount[k] : 0;
+			else if (rightCount[k] > 0)
+				expected = leftCount[k] * rightCount[k];
+			else
+				expected = (joinType == MERGE_JOIN_LEFT_OUTER) ? leftCount[k] : 0;
+
+			if (join.count[k] != expected)
+			{
+				printf("ERROR: Join type: %d Key: %li Results: %li Expected: %li\n", joinType, (long) k, (long) join.count[k], (long) expected);
+				passed = 0;
+			}
+		}
+		printf("Join type: %d Reads: %li Compares: %li\n", joinType, (long) metric.num_reads, (long) metric.num_compar);
+	}
+
+	free(buffer);
+	if (NULL != left.file)
+		fclose(left.file);
+	if (NULL != right.file)
+		fclose(right.file);
+	if (passed)
+		printf("SUCCESS");
+	else
+		printf("FAILURE");
+	printf("\n\n");
+}
+#endif
+
+#if defined(TEST_SORTED_STORE)
+/**
+ * Reads a cursor to the end checking records are in order with keys of at least minKey. Returns the number of records or -1 on error.
+ */
+int32_t testStoreScan(sorted_store_cursor_t *cursor, int32_t minKey)
+{
+	test_record_t record;
+	int32_t count = 0, last = minKey;
+
+	while (extern_sorted_store_next(cursor, &record))
+	{
+		if (record.key < last)
+		{
+			printf("ERROR: Store key %li before %li\n", (long) last, (long) record.key);
+			return -1;
+		}
+		last = record.key;
+		count++;
+	}
+	return (0 == cursor->err) ? count : -1;
+}
+
+/**
+ * Inserts random records into a sorted store with merges between inserts. Checks cursors over all records and
+ * from a minimum key, and that merged runs free file space that later runs reuse.
+ */
+void runtest_external_sorted_store()
+{
+	external_sort_t es;
+	metrics_t metric;
+	sorted_store_t store;
+	sorted_store_cursor_t cursor;
+	test_record_t buf, minRecord;
+	int32_t i, numValues = 1488, numAbove = 0, count;
+	int bufferSizeInBlocks = 8, cursorBlocks = 4, passed = 1, err = 0, merges = 0;
+	int8_t merged;
+	long maxEnd = 0;
+
+	printf("--- Sorted Store Test ---\n");
+	memset(&es, 0, sizeof(external_sort_t));
+	es.key_size = sizeof(int32_t);
+	es.value_size = 12;
+	es.headerSize = BLOCK_HEADER_SIZE;
+	es.record_size = es.key_size + es.value_size;
+	es.page_size = 512;
+	es.compare_fcn = merge_sort_int32_comparator;
+	memset(&metric, 0, sizeof(metrics_t));
+	memset(&buf, 0, sizeof(test_record_t));
+	memset(&minRecord, 0, sizeof(test_record_t));
+	minRecord.key = TEST_DISTINCT_KEYS / 2;
+
+	char *buffer = (char*) malloc((size_t) (bufferSizeInBlocks + cursorBlocks) * es.page_size);
+	ION_FILE *fp = fopen("tmpstore.bin", "w+b");
+	if (NULL == buffer || NULL == fp)
+	{
+		printf("Error: Can't create store!\n");
+		return;
+	}
+
+	/* Memtable of 2 blocks and runs of a tier merged 3 at a time */
+	if (0 != extern_sorted_store_init(&store, fp, buffer, bufferSizeInBlocks, 2, 3, &es, &metric, es.compare_fcn))
+	{
+		printf("Error: Can't create store!\n");
+		passed = 0;
+		numValues = 0;
+	}
+
+	for (i = 0; i < numValues && 0 == err; i++)
+	{
+		buf.key = rand() % TEST_DISTINCT_KEYS;
+		if (buf.key >= minRecord.key)
+			numAbove++;
+		err = extern_sorted_store_insert(&store, &buf);
+
+		/* Merge in the background of ingest */
+		if (0 == err && i % 100 == 99)
+		{
+			err = extern_sorted_store_merge_step(&store, &merged);
+			merges += merged;
+		}
+		if (store.endOffset > maxEnd)
+			maxEnd = store.endOffset;
+	}
+	if (0 != err)
+	{
+		printf("ERROR: Store insert or merge error: %d\n", err);
+		passed = 0;
+	}
+	printf("Runs: %d Merges: %d Free extents: %d Peak file blocks: %li Blocks written: %li\n", store.numRuns, merges, store.numFree, maxEnd / es.page_size, (long) metric.num_writes);
+
+	/* Merged runs are freed and reused, so the file is smaller than all blocks written */
+	if (0 == merges || maxEnd / es.page_size >= (long) metric.num_writes)
+	{
+		printf("ERROR: Merged runs were not reused\n");
+		passed = 0;
+	}
+
+	char *cursorBuffer = buffer + bufferSizeInBlocks * es.page_size;
+	count = -1;
+	if (0 == extern_sorted_store_cursor_open(&store, &cursor, cursorBuffer, cursorBlocks, NULL))
+		count = testStoreScan(&cursor, INT32_MIN);
+	if (count != numValues)
+	{
+		printf("ERROR: Store cursor records: %li Expected: %li\n", (long) count, (long) numValues);
+		passed = 0;
+	}
+
+	count = -1;
+	if (0 == extern_sorted_store_cursor_open(&store, &cursor, cursorBuffer, cursorBlocks, &minRecord))
+		count = testStoreScan(&cursor, minRecord.key);
+	if (count != numAbove)
+	{
+		printf("ERROR: Store cursor from key %li records: %li Expected: %li\n", (long) minRecord.key, (long) count, (long) numAbove);
+		passed = 0;
+	}
+
+	free(buffer);
+	fclose(fp);
+	if (passed)
+		printf("SUCCESS");
+	else
+		printf("FAILURE");
+	printf("\n\n");
+}
+#endif
+
+#if defined(TEST_BOUNDED_DISORDER)
+/* Records in nearly sorted input are shuffled within windows of this many records */
+#define TEST_DISORDER_WINDOW 8
+
+/**
+ * Sorts nearly sorted input with outliers (small keys far from their sorted position) using the bounded disorder
+ * sort. Checks the output is sorted with every record and that exactly the outliers were spilled.
+ */
+void runtest_external_sort_bounded()
+{
+	external_sort_t es;
+	metrics_t metric;
+	file_iterator_state_t iteratorState;
+	test_record_t buf, *rec;
+	int32_t i, j, numValues = 1400, outlierEvery = 15, numOutliers = 0, numvals, last;
+	int64_t inputKeySum = 0, keySum;
+	uint32_t spilled;
+	long result_file_ptr;
+	int bufferSizeInBlocks = 3, passed = 1, cached, err;
+	ion_file_cache_t cache;
+
+	printf("--- Bounded Disorder Test ---\n");
+	memset(&es, 0, sizeof(external_sort_t));
+	es.key_size = sizeof(int32_t);
+	es.value_size = 12;
+	es.headerSize = BLOCK_HEADER_SIZE;
+	es.record_size = es.key_size + es.value_size;
+	es.page_size = 512;
+	es.compare_fcn = merge_sort_int32_comparator;
+	memset(&buf, 0, sizeof(test_record_t));
+
+	char *buffer = (char*) malloc((size_t) bufferSizeInBlocks * es.page_size);
+	ion_byte_t *cache_buffer = (ion_byte_t*) malloc(ION_FILE_CACHE_BUFFER_SIZE(es.page_size, 4));
+	ION_FILE *fp = fopen("myfile.bin", "w+b");
+	if (NULL == buffer || NULL == cache_buffer || NULL == fp)
+	{
+		printf("Error: Can't open file!\n");
+		return;
+	}
+
+	/* Keys from 1000 up reversed in each window. Once output has started, an outlier key below 1000 follows every
+	   outlierEvery records and must be spilled. */
+	for (i = 0; i < numValues; i++)
+	{
+		j = i - i % TEST_DISORDER_WINDOW + (TEST_DISORDER_WINDOW - 1 - i % TEST_DISORDER_WINDOW);
+		buf.key = 1000 + (j < numValues ? j : i);
+		inputKeySum += buf.key;
+		fwrite(&buf, es.record_size, 1, fp);
+		if (i >= 200 && i % outlierEvery == outlierEvery - 1)
+		{
+			buf.key = numOutliers++;
+			inputKeySum += buf.key;
+			fwrite(&buf, es.record_size, 1, fp);
+		}
+	}
+	fflush(fp);
+
+	/* Sort without and with a page cache over the output file. Spill file pages must not go through the cache. */
+	for (cached = 0; cached < 2; cached++)
+	{
+		ION_FILE *outFilePtr = fopen("tmpsort.bin", "w+b");
+		ION_FILE *spillFilePtr = fopen("tmpsrt1.bin", "w+b");
+		if (NULL == outFilePtr || NULL == spillFilePtr)
+		{
+			printf("Error: Can't open file!\n");
+			return;
+		}
+		es.cache = NULL;
+		if (cached)
+		{
+			#if defined(ARDUINO)
+			ion_file_handle_t cache_file = {outFilePtr};
+			#else
+			ion_file_handle_t cache_file = outFilePtr;
+			#endif
+			if (err_ok != ion_fcache_init(&cache, cache_file, es.page_size, 4, cache_buffer))
+			{
+				printf("Error: Can't create page cache!\n");
+				return;
+			}
+			es.cache = &cache;
+		}
+		memset(&metric, 0, sizeof(metrics_t));
+		fseek(fp, 0, SEEK_SET);
+		iteratorState.file = fp;
+		iteratorState.recordsRead = 0;
+		iteratorState.totalRecords = numValues + numOutliers;
+		iteratorState.recordSize = es.record_size;
+		spilled = 0;
+
+		err = extern_sort_bounded_disorder(&fileRecordIterator, &iteratorState, outFilePtr, spillFilePtr, buffer, bufferSizeInBlocks, &es, 2 * TEST_DISORDER_WINDOW, 0, &result_file_ptr, &spilled, &metric, es.compare_fcn);
+		if (0 != err)
+		{
+			printf("ERROR: Bounded disorder sort error: %d\n", err);
+			passed = 0;
+		}
+		if (spilled != (uint32_t) numOutliers)
+		{
+			printf("ERROR: Spilled records: %lu Expected: %li\n", (unsigned long) spilled, (long) numOutliers);
+			passed = 0;
+		}
+
+		/* Read blocks of output file to check if sorted */
+		numvals = 0;
+		last = INT32_MIN;
+		keySum = inputKeySum;
+		fseek(outFilePtr, result_file_ptr, SEEK_SET);
+		for (i = 0; 0 == err && i < (int32_t) es.num_pages; i++)
+		{
+			if (0 == fread(buffer, es.page_size, 1, outFilePtr))
+			{
+				printf("Failed to read block.\n");
+				passed = 0;
+				break;
+			}
+			for (j = 0; j < *((int16_t*) (buffer+BLOCK_COUNT_OFFSET)); j++)
+			{
+				rec = (test_record_t*) (buffer + es.headerSize + j * es.record_size);
+				if (rec->key < last)
+				{
+					printf("ERROR: %li not less than %li\n", (long) last, (long) rec->key);
+					passed = 0;
+				}
+				last = rec->key;
+				keySum -= rec->key;
+				numvals++;
+			}
+		}
+		if (numvals != numValues + numOutliers || 0 != keySum)
+		{
+			printf("ERROR: Output records: %li Expected: %li\n", (long) numvals, (long) (numValues + numOutliers));
+			passed = 0;
+		}
+		printf("Cached: %d Spilled: %lu Reads: %li Writes: %li Compares: %li\n", cached, (unsigned long) spilled, (long) metric.num_reads, (long) metric.num_writes, (long) metric.num_compar);
+		fclose(outFilePtr);
+		fclose(spillFilePtr);
+	}
+
+	free(buffer);
+	free(cache_buffer);
+	fclose(fp);
+	if (passed)
+		printf("SUCCESS");
+	else
+		printf("FAILURE");
+	printf("\n\n");
+}
+#endif
+
 /**
  * Runs all tests and collects benchmarks
  */ 
@@ -159,15 +842,29 @@ void runalltests_external_merge_sort()
             {            
                 printf("--- Run Number %d ---\n", (r+1));
                 int buffer_max_pages = mem;
+                #if defined(TEST_DISTRIBUTION)
+                /* Distribution sort needs a block for input and at least three buckets */
+                if (buffer_max_pages < 4)
+                    buffer_max_pages = 4;
+                #endif
                     
                 metric[r].num_reads = 0;
                 metric[r].num_writes = 0;
                 metric[r].num_compar = 0;
                 metric[r].num_memcpys = 0;                
+                metric[r].num_cache_hits = 0;
+                metric[r].num_cache_misses = 0;
+                metric[r].num_seeks = 0;
+                metric[r].num_filtered = 0;
+                metric[r].bytes_saved = 0;
 
                 es.key_size = sizeof(int32_t); 
                 es.value_size = 12;
+                #if defined(TEST_BLOCK_RECYCLE)
+                es.headerSize = BLOCK_CHAIN_HEADER_SIZE;
+                #else
                 es.headerSize = BLOCK_HEADER_SIZE;
+                #endif
                 es.record_size = es.key_size + es.value_size;
                 es.page_size = 512;
 
@@ -184,8 +881,50 @@ void runalltests_external_merge_sort()
                 }
                 /* Add variable number of records so pages not completely full (optional) */
                 // num_test_values += rand() % 10;
+                #if defined(TEST_OVC) || defined(TEST_DUPLICATES)
+                /* First run sorts exactly the records that fill the run generation buffer, so all input is one run */
+                if (r == 0)
+                    num_test_values = (buffer_max_pages - 1) * es.page_size / es.record_size;
+                #endif
                 es.num_pages = (uint32_t) (num_test_values + values_per_page - 1) / values_per_page; 
                 es.compare_fcn = merge_sort_int32_comparator;
+                es.key_fields = NULL;
+                es.num_key_fields = 0;
+                #if defined(TEST_KEY_DESCRIPTOR)
+                sort_key_field_t key_field = { 0, sizeof(int32_t), SORT_KEY_INT, SORT_KEY_ASC };
+                es.key_fields = &key_field;
+                es.num_key_fields = 1;
+                es.compare_fcn = extern_sort_key_comparator(&es);
+                #endif
+
+                #if defined(TEST_PLAN_BUDGET)
+                /* Plan for an SD card with read, write and seek costs in microseconds */
+                sort_device_profile_t profile = { 1000, 1500, 500, 0 };
+                #if defined(TEST_TUNE_DEVICE)
+                if (0 != extern_sort_load_profile("devprof.bin", &profile))
+                {
+                    char *tuneBuffer = (char*) malloc(TEST_PLAN_BUDGET);
+                    ION_FILE *tuneFile = fopen("tunesrt.bin", "w+b");
+                    if (NULL == tuneBuffer || NULL == tuneFile || 0 != extern_sort_tune_device(tuneFile, tuneBuffer, TEST_PLAN_BUDGET, TEST_TUNE_DEVICE, &profile))
+                    {
+                        printf("Error: Device measurement failed!\n");
+                        return;
+                    }
+                    fclose(tuneFile);
+                    free(tuneBuffer);
+                    extern_sort_save_profile("devprof.bin", &profile);
+                }
+                #endif
+                sort_plan_t plan;
+                if (0 != extern_sort_plan(&es, TEST_PLAN_BUDGET, &profile, &plan))
+                {
+                    printf("Error: Memory budget too small!\n");
+                    return;
+                }
+                extern_sort_apply_plan(&plan, &es);
+                buffer_max_pages = plan.buffer_blocks;
+                printf("Plan page size: %d blocks: %d method: %d passes: %d reads: %li writes: %li\n", plan.page_size, plan.buffer_blocks, plan.method, plan.passes, plan.reads, plan.writes);
+                #endif
 
                 /* Buffers and file offsets used by sorting algorithim*/                
                 long result_file_ptr;
@@ -205,6 +944,12 @@ void runalltests_external_merge_sort()
                 }
 
                	// external_sort_write_int32_sequential_data(fp, num_test_values, es.record_size, 0);
+                #if defined(TEST_DISTRIBUTION)
+                /* Buckets of records that all equal a repeated splitter are written without sorting */
+                if (r % 2 == 1)
+                    external_sort_write_int32_duplicate_data(fp, num_test_values, es.record_size, TEST_DISTRIBUTION);
+                else
+                #endif
 				external_sort_write_int32_random_data(fp, num_test_values, es.record_size);
 
                 fflush(fp);                
@@ -226,6 +971,68 @@ void runalltests_external_merge_sort()
                     printf("Error: Can't open output file!\n");			
                 }
 
+                /* Page cache over sort file uses its own memory */
+                es.cache = NULL;
+                #if TEST_CACHE_PAGES > 0
+                ion_file_cache_t cache;
+                ion_byte_t *cache_buffer = (ion_byte_t*) malloc(ION_FILE_CACHE_BUFFER_SIZE(es.page_size, TEST_CACHE_PAGES));
+                #if defined(ARDUINO)
+                ion_file_handle_t cache_file = {outFilePtr};
+                #else
+                ion_file_handle_t cache_file = outFilePtr;
+                #endif
+                if (NULL == cache_buffer || err_ok != ion_fcache_init(&cache, cache_file, es.page_size, TEST_CACHE_PAGES, cache_buffer))
+                {
+                    printf("Error: Can't create page cache!\n");
+                }
+                else
+                {
+                    es.cache = &cache;
+                }
+                #endif
+
+                #if defined(TEST_STRIPE_FILES)
+                /* First file is the output file. Each other file would be on a different device. */
+                ION_FILE *stripeFiles[TEST_STRIPE_FILES];
+                int8_t result_file;
+                stripeFiles[0] = outFilePtr;
+                for (int f = 1; f < TEST_STRIPE_FILES; f++)
+                {
+                    char stripeName[ION_MAX_FILENAME_LENGTH];
+                    sprintf(stripeName, "tmpsrt%d.bin", f);
+                    stripeFiles[f] = fopen(stripeName, "w+b");
+                    if (NULL == stripeFiles[f])
+                    {
+                        printf("Error: Can't open stripe file!\n");
+                    }
+                }
+                #endif
+
+                #if defined(TEST_POLYPHASE_FILES)
+                /* First file is the output file. Each other file is a separate sequential stream. */
+                ION_FILE *streamFiles[TEST_POLYPHASE_FILES];
+                int8_t result_file;
+                streamFiles[0] = outFilePtr;
+                for (int f = 1; f < TEST_POLYPHASE_FILES; f++)
+                {
+                    char streamName[ION_MAX_FILENAME_LENGTH];
+                    sprintf(streamName, "tmpsrt%d.bin", f);
+                    streamFiles[f] = fopen(streamName, "w+b");
+                    if (NULL == streamFiles[f])
+                    {
+                        printf("Error: Can't open stream file!\n");
+                    }
+                }
+                #endif
+
+                #if !defined(TEST_BLOCK_RECYCLE) && !defined(TEST_STRIPE_FILES) && !defined(TEST_KV_SEPARATED) && !defined(TEST_POLYPHASE_FILES) && !defined(TEST_MINI_PAGE) && !defined(TEST_NO_OUTPUT_BUFFER) && !defined(TEST_MEMORY_BROKER) && !defined(TEST_TWO_WAY) && !defined(TEST_SKIP_MERGE) && !defined(TEST_DUPLICATES) && !defined(TEST_OVC) && !defined(TEST_VAR_BLOCK) && !defined(TEST_PREFIX_BLOCK) && !defined(TEST_DISTRIBUTION)
+                /* Reserve temporary space so the file does not grow during the sort */
+                if (0 != extern_merge_sort_preallocate(outFilePtr, &es, buffer_max_pages))
+                {
+                    printf("Error: Can't preallocate output file!\n");
+                }
+                #endif
+
                 /* Run and time the algorithim */
                 printf("num test values: %li\n", num_test_values);
                 printf("blocks:%li\n", es.num_pages);
@@ -235,7 +1042,66 @@ void runalltests_external_merge_sort()
                 clock_t start = clock();
                 #endif                    
 
-               	int err = extern_merge_sort_iterator_block(&fileRecordIterator, &iteratorState, &tuple_buffer, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], merge_sort_int32_comparator);	
+                #if defined(TEST_BLOCK_RECYCLE)
+               	int err = extern_merge_sort_iterator_block_recycle(&fileRecordIterator, &iteratorState, &tuple_buffer, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                #elif defined(TEST_KV_SEPARATED)
+                ION_FILE *valueLog = fopen("kvlog.bin", "w+b");
+                ION_FILE *pairFile = fopen("kvpairs.bin", "w+b");
+                es.cache = NULL;	/* Cache is over output file which does not hold sorted pairs */
+               	int err = extern_merge_sort_kv_separated(&fileRecordIterator, &iteratorState, tuple_buffer, valueLog, pairFile, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                fclose(valueLog);
+                fclose(pairFile);
+                #elif defined(TEST_STRIPE_FILES)
+               	int err = extern_merge_sort_iterator_block_striped(&fileRecordIterator, &iteratorState, &tuple_buffer, stripeFiles, TEST_STRIPE_FILES, buffer, buffer_max_pages, &es, &result_file, &result_file_ptr, &metric[r], es.compare_fcn);
+                outFilePtr = stripeFiles[result_file];
+                #elif defined(TEST_POLYPHASE_FILES)
+               	int err = extern_merge_sort_polyphase(&fileRecordIterator, &iteratorState, &tuple_buffer, streamFiles, TEST_POLYPHASE_FILES, buffer, buffer_max_pages, &es, &result_file, &result_file_ptr, &metric[r], es.compare_fcn);
+                outFilePtr = streamFiles[result_file];
+                #elif defined(TEST_MINI_PAGE)
+               	int err = extern_merge_sort_mini_page(&fileRecordIterator, &iteratorState, &tuple_buffer, outFilePtr, buffer, buffer_max_pages, &es, 0, 1000, 200, &result_file_ptr, &metric[r], es.compare_fcn);
+                #elif defined(TEST_NO_OUTPUT_BUFFER)
+               	int err = extern_merge_sort_no_output_buffer(&fileRecordIterator, &iteratorState, &tuple_buffer, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                #elif defined(TEST_MEMORY_BROKER)
+                int16_t broker_blocks = buffer_max_pages;
+               	int err = extern_merge_sort_adaptive(&fileRecordIterator, &iteratorState, &tuple_buffer, outFilePtr, testMemoryBroker, &broker_blocks, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                #elif defined(TEST_TWO_WAY)
+                ION_FILE *secondFile = fopen("tmpsrt1.bin", "w+b");
+               	int err = extern_merge_sort_two_way(&fileRecordIterator, &iteratorState, tuple_buffer, outFilePtr, secondFile, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                fclose(secondFile);
+                #elif defined(TEST_SKIP_MERGE)
+               	int err = extern_merge_sort_skip_merge(&fileRecordIterator, &iteratorState, tuple_buffer, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                #elif defined(TEST_DUPLICATES)
+               	int err = extern_merge_sort_rle(&fileRecordIterator, &iteratorState, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                #elif defined(TEST_OVC)
+               	int err = extern_merge_sort_ovc(&fileByteOrderedIterator, &iteratorState, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r]);
+                #elif defined(TEST_VAR_BLOCK)
+               	int err = extern_merge_sort_var_block(&fileVarRecordIterator, &iteratorState, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                #elif defined(TEST_PREFIX_BLOCK)
+                es.key_size = TEST_PREFIX_KEY_SIZE;
+               	int err = extern_merge_sort_prefix_block(&filePrefixKeyIterator, &iteratorState, outFilePtr, buffer, buffer_max_pages, &es, TEST_PREFIX_BLOCK, &result_file_ptr, &metric[r]);
+                #elif defined(TEST_FILTER_PROJECT)
+                uint16_t input_record_size = es.record_size;
+                es.value_size = (r % 2 == 0) ? TEST_FILTER_PROJECT : 7;
+                es.record_size = es.key_size + es.value_size;
+               	int err = extern_merge_sort_iterator_block_filtered(&fileRecordIterator, &iteratorState, &testFilterPredicate, &testProjection, &es, input_record_size, tuple_buffer, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                #elif defined(TEST_DISTRIBUTION)
+                ION_FILE *bucketFile = fopen("tmpsrt1.bin", "w+b");
+               	int err = extern_distribution_sort_iterator_block(&fileRecordIterator, &iteratorState, tuple_buffer, outFilePtr, bucketFile, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                fclose(bucketFile);
+                #else
+                int err;
+                #if defined(TEST_PLAN_BUDGET)
+                /* Run the sort method chosen by the planner */
+                if (EXTERNAL_SORT_METHOD_DISTRIBUTION == plan.method)
+                {
+                    ION_FILE *bucketFile = fopen("tmpsrt1.bin", "w+b");
+                    err = extern_distribution_sort_iterator_block(&fileRecordIterator, &iteratorState, tuple_buffer, outFilePtr, bucketFile, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);
+                    fclose(bucketFile);
+                }
+                else
+                #endif
+               	err = extern_merge_sort_batch_iterator_block(&fileBatchIterator, &iteratorState, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], es.compare_fcn);	
+                #endif
 
                 if (8 == err) {
                     printf("Out of memory!\n");
@@ -244,6 +1110,8 @@ void runalltests_external_merge_sort()
                 } else if (9 == err) {
                     printf("File Write Error!\n");
                     result_file_ptr = 0;
+                } else if (11 == err) {
+                    printf("Block header too small!\n");
                 }
 
                 #if defined(ARDUINO)
@@ -268,6 +1136,11 @@ void runalltests_external_merge_sort()
                 uint32_t i;
                 test_record_t last, *buf;
                 int32_t numvals = 0;
+                #if defined(TEST_PREFIX_BLOCK)
+                prefix_cursor_t cursor;
+                test_record_t decoded;
+                char prefixRecord[sizeof(test_record_t)], keyString[TEST_PREFIX_KEY_SIZE];
+                #endif
 
                 /* Read blocks of output file to check if sorted */
                 for (i=0; i < es.num_pages; i++)
@@ -276,15 +1149,52 @@ void runalltests_external_merge_sort()
                     {	printf("Failed to read block.\n");
                         sorted = 0;
                     }
+                    #if defined(TEST_BLOCK_RECYCLE)
+                    /* Follow chain to next block of output */
+                    fseek(outFilePtr, (long) *((int32_t*) (buffer+BLOCK_NEXT_OFFSET)) * es.page_size, SEEK_SET);
+                    #endif
 
                     /* Read records from file */
                     int count = *((int16_t*) (buffer+BLOCK_COUNT_OFFSET));
                     /* printf("Block: %d Count: %d\n", *((int16_t*) buffer), count); */
                     void* addr = &(buffer[0]);
+                    #if defined(TEST_PREFIX_BLOCK)
+                    extern_sort_prefix_cursor_init(&cursor, buffer, &es);
+                    #endif
            
                     for (int j=0; j < count; j++)
                     {	
+                        #if defined(TEST_VAR_BLOCK)
+                        uint16_t length;
+                        buf = (test_record_t*) extern_sort_var_record(buffer, (int16_t) j, &es, &length);
+                        if (length != testVarRecordLength(buf->key))
+                        {
+                            printf("ERROR: Record length: %d Expected: %d\n", length, testVarRecordLength(buf->key));
+                            sorted = 0;
+                        }
+                        #elif defined(TEST_PREFIX_BLOCK)
+                        if (0 == extern_sort_prefix_next(&cursor, prefixRecord, &es))
+                        {
+                            printf("ERROR: Block has fewer records than its count: %d\n", count);
+                            sorted = 0;
+                            break;
+                        }
+                        memcpy(&decoded.key, prefixRecord + TEST_PREFIX_KEY_SIZE, sizeof(int32_t));
+                        memset(keyString, 0, TEST_PREFIX_KEY_SIZE);
+                        sprintf(keyString, "key/%07ld", (long) decoded.key);
+                        if (0 != memcmp(keyString, prefixRecord, TEST_PREFIX_KEY_SIZE))
+                        {
+                            printf("ERROR: Decoded key: %s Expected: %s\n", prefixRecord, keyString);
+                            sorted = 0;
+                        }
+                        buf = &decoded;
+                        #else
                         buf = (test_record_t*) (buffer+es.headerSize+j*es.record_size);				
+                        #endif
+                        #if defined(TEST_OVC)
+                        unsigned char *keyBytes = (unsigned char*) buf;
+                        buf->key = (int32_t) ((uint32_t) keyBytes[0] << 24 | (uint32_t) keyBytes[1] << 16 | (uint32_t) keyBytes[2] << 8 | keyBytes[3]);
+                        #endif
                         numvals++;
                         #ifdef DATA_COMPARE
                         if (sampleData[numvals-1] != buf->key)
@@ -308,29 +1218,76 @@ void runalltests_external_merge_sort()
 
                         memcpy(&last, buf, es.record_size);				
                     }
+                    #if defined(TEST_PREFIX_BLOCK)
+                    /* Seek to the last key of the block and past the last key */
+                    if (count > 0)
+                    {
+                        memcpy(keyString, prefixRecord, TEST_PREFIX_KEY_SIZE);
+                        extern_sort_prefix_cursor_init(&cursor, buffer, &es);
+                        if (0 == extern_sort_prefix_seek(&cursor, prefixRecord, keyString, &es) || 0 != memcmp(keyString, prefixRecord, TEST_PREFIX_KEY_SIZE))
+                        {
+                            printf("ERROR: Seek did not find key: %s\n", keyString);
+                            sorted = 0;
+                        }
+                        memset(keyString, 0xFF, TEST_PREFIX_KEY_SIZE);
+                        extern_sort_prefix_cursor_init(&cursor, buffer, &es);
+                        if (0 != extern_sort_prefix_seek(&cursor, prefixRecord, keyString, &es))
+                        {
+                            printf("ERROR: Seek found key past last key of block\n");
+                            sorted = 0;
+                        }
+                    }
+                    #endif
                     /* Need to preserve buf between page loads as buffer is repalced */
                 }		
 
-                if (numvals != num_test_values)
+                if (numvals != num_test_values - (int32_t) metric[r].num_filtered)
                 {
-                    printf("ERROR: Missing values: %d\n", (num_test_values-numvals));
+                    printf("ERROR: Missing values: %d\n", (num_test_values-(int32_t) metric[r].num_filtered-numvals));
                     sorted = 0;
                 };
 
+                #if defined(TEST_PLAN_BUDGET)
+                if (0 != extern_sort_check_plan(&plan, &metric[r]))
+                    sorted = 0;
+                #endif
+
                 /* Print Results*/
                 printf("Sorted: %d\n", sorted);
                 printf("Reads:%li\n", metric[r].num_reads);
                 printf("Writes:%li\n", metric[r].num_writes);
-                printf("I/Os:%li\n\n", metric[r].num_reads + metric[r].num_writes);
+                printf("I/Os:%li\n", metric[r].num_reads + metric[r].num_writes);
+                printf("Seeks:%li\n\n", metric[r].num_seeks);
                 printf("Num Comparisons:%li\n", metric[r].num_compar);
                 printf("Num Memcpys:%li\n", metric[r].num_memcpys);
+                printf("Cache Hits:%li\n", metric[r].num_cache_hits);
+                printf("Cache Misses:%li\n", metric[r].num_cache_misses);
+                printf("Filtered:%li\n", metric[r].num_filtered);
+                printf("Bytes Saved:%li\n", metric[r].bytes_saved);
                 /* printf("Num Runs:%li\n", metric[r].num_runs); */
 
                 /* Clean up and print final result*/
                 free(buffer);
+                #if TEST_CACHE_PAGES > 0
+                free(cache_buffer);
+                #endif
                 if (0 != fclose(fp)) {
                     printf("Error file not closed!");
                 }
+                #if defined(TEST_STRIPE_FILES)
+                for (int f = 0; f < TEST_STRIPE_FILES; f++)
+                {
+                    if (stripeFiles[f] != fp)
+                        fclose(stripeFiles[f]);
+                }
+                #endif
+                #if defined(TEST_POLYPHASE_FILES)
+                for (int f = 0; f < TEST_POLYPHASE_FILES; f++)
+                {
+                    if (streamFiles[f] != fp)
+                        fclose(streamFiles[f]);
+                }
+                #endif
                 if (sorted)
                     printf("SUCCESS");
                 else
@@ -368,6 +1325,14 @@ void runalltests_external_merge_sort()
             printf("%li\n", value/numRuns);
             vals[2] = value/numRuns;
             value = 0;
+            printf("Seeks: \t\t");
+            for (int i=0; i < numRuns; i++)
+            {
+                printf("%li\t", metric[i].num_seeks);
+                value += metric[i].num_seeks;
+            }
+            printf("%li\n", value/numRuns);
+            value = 0;
             printf("Compares: \t");
             for (int i=0; i < numRuns; i++)
             {                
@@ -388,4 +1353,14 @@ void runalltests_external_merge_sort()
             printf("%li\t%li\t%li\t%li\t%li\n",vals[0], vals[1], vals[2], vals[3], vals[4]);
         }
     }
+
+    #if defined(TEST_MERGE_JOIN)
+    runtest_external_merge_join();
+    #endif
+    #if defined(TEST_SORTED_STORE)
+    runtest_external_sorted_store();
+    #endif
+    #if defined(TEST_BOUNDED_DISORDER)
+    runtest_external_sort_bounded();
+    #endif
 }